@@ -19,6 +19,7 @@
 #include <cstring>
 #include <limits>
 #include <memory>
+#include <new>
 #include <ostream>
 #include <string>
 #include <type_traits>
@@ -46,6 +47,156 @@ void WritePadding(std::ostream& out, size_t pad) {
   }
 }
 
+// Memory of internal blocks up to kMaxCachedSize bytes (enough for a block of
+// kMaxBufferSize()) is allocated in size classes and kept in a per-thread cache
+// after the block is deleted, so that repeatedly creating and deleting blocks,
+// e.g. during encoding and decoding consecutive chunks, mostly avoids the
+// global allocator.
+//
+// Each thread caches at most kMaxCachedBytesPerThread bytes. Memory may be
+// released in a different thread than it was allocated in.
+//
+// The cache is disabled in sanitizer builds, where it would hide errors.
+
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__) || \
+    RIEGELI_INTERNAL_HAS_FEATURE(address_sanitizer) ||              \
+    RIEGELI_INTERNAL_HAS_FEATURE(memory_sanitizer) ||               \
+    RIEGELI_INTERNAL_HAS_FEATURE(thread_sanitizer)
+#define RIEGELI_INTERNAL_CHAIN_BLOCK_CACHE 0
+#else
+#define RIEGELI_INTERNAL_CHAIN_BLOCK_CACHE 1
+#endif
+
+constexpr size_t kMaxCachedSize = (size_t{64} << 10) + 64;
+constexpr size_t kMaxCachedBytesPerThread = size_t{2} << 20;
+
+// Size classes: 128 bytes, then 4 classes for each power of 2, e.g. 160, 192,
+// 224, 256, 320, 384, 448, 512, ..., up to 64KiB, then a class of exactly
+// kMaxCachedSize, so that the most common large block (a block of
+// kMaxBufferSize()) does not waste a quarter of its memory.
+constexpr size_t kMinSizeClass = 128;
+constexpr size_t kMaxRegularSizeClass = size_t{64} << 10;
+constexpr size_t kNumSizeClasses = 1 + 4 * 9 + 1;
+
+// Returns the floor of log2(value) for value > 0.
+inline size_t FloorLog2(size_t value) {
+#if RIEGELI_INTERNAL_HAS_BUILTIN(__builtin_clzll) || \
+    RIEGELI_INTERNAL_IS_GCC_VERSION(3, 4)
+  return IntCast<size_t>(__builtin_clzll(1) ^
+                         __builtin_clzll(IntCast<unsigned long long>(value)));
+#else
+  size_t floor_log2 = 0;
+  while (value > 1) {
+    ++floor_log2;
+    value >>= 1;
+  }
+  return floor_log2;
+#endif
+}
+
+// Returns the index of the smallest size class which fits num_bytes.
+//
+// Precondition: num_bytes <= kMaxCachedSize
+inline size_t SizeClassIndex(size_t num_bytes) {
+  if (num_bytes <= kMinSizeClass) return 0;
+  if (num_bytes > kMaxRegularSizeClass) return kNumSizeClasses - 1;
+  // 2^floor_log2 < num_bytes <= 2^(floor_log2 + 1)
+  const size_t floor_log2 = FloorLog2(num_bytes - 1);
+  const size_t step_log2 = floor_log2 - 2;
+  // 1 <= step_index <= 4
+  const size_t step_index =
+      ((num_bytes - (size_t{1} << floor_log2) - 1) >> step_log2) + 1;
+  return (floor_log2 - FloorLog2(kMinSizeClass)) * 4 + step_index;
+}
+
+// Returns the size of the size class with the given index.
+inline size_t SizeClassSize(size_t index) {
+  if (index == 0) return kMinSizeClass;
+  if (index == kNumSizeClasses - 1) return kMaxCachedSize;
+  const size_t floor_log2 = (index - 1) / 4 + FloorLog2(kMinSizeClass);
+  const size_t step_index = (index - 1) % 4 + 1;
+  return (size_t{1} << floor_log2) + (step_index << (floor_log2 - 2));
+}
+
+#if RIEGELI_INTERNAL_CHAIN_BLOCK_CACHE
+
+struct FreeBlock {
+  FreeBlock* next;
+};
+
+// Trivially destructible, so that it remains usable while other thread-local
+// objects are destroyed.
+struct BlockCache {
+  FreeBlock* free_lists[kNumSizeClasses];
+  size_t cached_bytes;
+  bool disabled;
+};
+
+thread_local BlockCache block_cache;
+
+// Releases the memory cached by the current thread when the thread exits.
+class BlockCacheCleanup {
+ public:
+  BlockCacheCleanup() {}
+
+  BlockCacheCleanup(const BlockCacheCleanup&) = delete;
+  BlockCacheCleanup& operator=(const BlockCacheCleanup&) = delete;
+
+  ~BlockCacheCleanup() {
+    for (size_t index = 0; index < kNumSizeClasses; ++index) {
+      FreeBlock* free_block = block_cache.free_lists[index];
+      while (free_block != nullptr) {
+        FreeBlock* const next = free_block->next;
+        operator delete(free_block);
+        free_block = next;
+      }
+      block_cache.free_lists[index] = nullptr;
+    }
+    block_cache.cached_bytes = 0;
+    // Memory released later in this thread goes directly to the allocator.
+    block_cache.disabled = true;
+  }
+};
+
+#endif  // RIEGELI_INTERNAL_CHAIN_BLOCK_CACHE
+
+inline void* AllocateBlockMemory(size_t num_bytes) {
+  if (num_bytes > kMaxCachedSize) return operator new(num_bytes);
+  const size_t index = SizeClassIndex(num_bytes);
+#if RIEGELI_INTERNAL_CHAIN_BLOCK_CACHE
+  FreeBlock* const free_block = block_cache.free_lists[index];
+  if (free_block != nullptr) {
+    block_cache.free_lists[index] = free_block->next;
+    block_cache.cached_bytes -= SizeClassSize(index);
+    return free_block;
+  }
+#endif
+  return operator new(SizeClassSize(index));
+}
+
+inline void DeleteBlockMemory(void* ptr, size_t num_bytes) {
+  if (num_bytes > kMaxCachedSize) {
+    operator delete(ptr);
+    return;
+  }
+#if RIEGELI_INTERNAL_CHAIN_BLOCK_CACHE
+  const size_t index = SizeClassIndex(num_bytes);
+  const size_t size = SizeClassSize(index);
+  if (ABSL_PREDICT_TRUE(!block_cache.disabled) &&
+      ABSL_PREDICT_TRUE(block_cache.cached_bytes + size <=
+                        kMaxCachedBytesPerThread)) {
+    // Ensure that cached memory is released at thread exit.
+    static thread_local BlockCacheCleanup block_cache_cleanup;
+    FreeBlock* const free_block = static_cast<FreeBlock*>(ptr);
+    free_block->next = block_cache.free_lists[index];
+    block_cache.free_lists[index] = free_block;
+    block_cache.cached_bytes += size;
+    return;
+  }
+#endif
+  operator delete(ptr);
+}
+
 }  // namespace
 
 class Chain::BlockRef {
@@ -144,11 +295,14 @@ inline void Chain::StringRef::DumpStructure(absl::string_view data,
 }
 
 inline Chain::Block* Chain::Block::NewInternal(size_t capacity) {
+  static_assert(kInternalAllocatedOffset() + kMaxBufferSize() <= kMaxCachedSize,
+                "Chain blocks of kMaxBufferSize() should be cached");
   RIEGELI_ASSERT_GT(capacity, 0u)
       << "Failed precondition of Chain::Block::NewInternal(): zero capacity";
   RIEGELI_CHECK_LE(capacity, Block::kMaxCapacity())
       << "Chain block capacity overflow";
-  return NewAligned<Block>(kInternalAllocatedOffset() + capacity, capacity, 0);
+  return new (AllocateBlockMemory(kInternalAllocatedOffset() + capacity))
+      Block(capacity, 0);
 }
 
 inline Chain::Block* Chain::Block::NewInternalForPrepend(size_t capacity) {
@@ -157,8 +311,8 @@ inline Chain::Block* Chain::Block::NewInternalForPrepend(size_t capacity) {
          "capacity";
   RIEGELI_CHECK_LE(capacity, Block::kMaxCapacity())
       << "Chain block capacity overflow";
-  return NewAligned<Block>(kInternalAllocatedOffset() + capacity, capacity,
-                           capacity);
+  return new (AllocateBlockMemory(kInternalAllocatedOffset() + capacity))
+      Block(capacity, capacity);
 }
 
 inline Chain::Block::Block(size_t capacity, size_t space_before)
@@ -177,7 +331,9 @@ inline void Chain::Block::Unref() {
   if (has_unique_owner() ||
       ref_count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
     if (is_internal()) {
-      DeleteAligned<Block>(this, kInternalAllocatedOffset() + capacity());
+      const size_t num_bytes = kInternalAllocatedOffset() + capacity();
+      this->~Block();
+      DeleteBlockMemory(this, num_bytes);
     } else {
       external_.methods->delete_block(this);
     }
@@ -203,6 +203,13 @@ ValueParser::Function ValueParser::FailIfAnySeen() {
   };
 }
 
+ValueParser::Function ValueParser::FailMissing(absl::string_view key) {
+  return [key](ValueParser* value_parser) {
+    return value_parser->Fail(
+        absl::StrCat("Option ", value_parser->key(), " requires option ", key));
+  };
+}
+
 bool ValueParser::InvalidValue(absl::string_view valid_values) {
   RIEGELI_ASSERT(!valid_values.empty())
       << "Failed precondition of OptionsParser::InvalidValue(): "
@@ -36,10 +36,10 @@ class ValueParser : public Object {
   // Parser of an option value.
   //
   // Return values:
-  //  * true  - success (FailIfSeen() nor FailIfAnySeen() must not have been
-  //            called)
-  //  * false - failure (InvalidValue(), FailIfSeen(), or FailIfAnySeen() may
-  //            have been called)
+  //  * true  - success (FailIfSeen(), FailIfAnySeen(), nor FailMissing() must
+  //            not have been called)
+  //  * false - failure (InvalidValue(), FailIfSeen(), FailIfAnySeen(), or
+  //            FailMissing() may have been called)
   using Function = std::function<bool(ValueParser*)>;
 
   ValueParser(const ValueParser&) = delete;
@@ -70,8 +70,9 @@ class ValueParser : public Object {
   // Value parser which tries multiple parsers and returns the result of the
   // first one which succeeds.
   //
-  // The parsers must not include FailIfSeen() nor FailIfAnySeen(). Conflicts
-  // with other options should be checked outside the Or().
+  // The parsers must not include FailIfSeen(), FailIfAnySeen(), nor
+  // FailMissing(). Conflicts with other options should be checked outside the
+  // Or().
   static Function Or(Function function1, Function function2);
   template <typename... Functions>
   static Function Or(Function function1, Function function2,
@@ -102,6 +103,13 @@ class ValueParser : public Object {
   // option.
   static Function FailIfAnySeen();
 
+  // Value parser which reports that this option requires an option with the
+  // given key, which is absent. The caller decides whether to use it, e.g.
+  // depending on options parsed earlier with a separate OptionsParser.
+  //
+  // Always fails.
+  static Function FailMissing(absl::string_view key);
+
   // Returns the key of the option being parsed.
   absl::string_view key() const { return key_; }
 
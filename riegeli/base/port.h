@@ -23,6 +23,14 @@
 #define RIEGELI_INTERNAL_HAS_BUILTIN(x) 0
 #endif
 
+// Clang has __has_feature(). Other compilers need other means to detect
+// features, e.g. predefined macros.
+#ifdef __has_feature
+#define RIEGELI_INTERNAL_HAS_FEATURE(x) __has_feature(x)
+#else
+#define RIEGELI_INTERNAL_HAS_FEATURE(x) 0
+#endif
+
 #define RIEGELI_INTERNAL_IS_GCC_VERSION(major, minor) \
   (__GNUC__ > (major) || (__GNUC__ == (major) && __GNUC_MINOR__ >= (minor)))
 
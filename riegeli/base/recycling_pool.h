@@ -0,0 +1,235 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BASE_RECYCLING_POOL_H_
+#define RIEGELI_BASE_RECYCLING_POOL_H_
+
+#include <stddef.h>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/memory.h"
+
+namespace riegeli {
+namespace internal {
+
+// RecyclingPool<T, Deleter> keeps objects of type T which are expensive to
+// create, e.g. compression contexts, after they are no longer used, so that
+// they can be reused instead of created again.
+//
+// Objects are obtained as Handle, which returns the object to the pool when
+// destroyed. At most max_size objects are kept; further objects are deleted.
+//
+// RecyclingPool is thread-safe.
+template <typename T, typename Deleter = std::default_delete<T>>
+class RecyclingPool {
+ public:
+  class Recycler {
+   public:
+    Recycler() noexcept {}
+
+    explicit Recycler(RecyclingPool* pool) noexcept : pool_(pool) {}
+
+    void operator()(T* ptr) const;
+
+   private:
+    RecyclingPool* pool_ = nullptr;
+  };
+
+  using Handle = std::unique_ptr<T, Recycler>;
+
+  explicit RecyclingPool(size_t max_size = 16) noexcept
+      : max_size_(max_size) {}
+
+  RecyclingPool(const RecyclingPool&) = delete;
+  RecyclingPool& operator=(const RecyclingPool&) = delete;
+
+  // Returns a default global pool. It is never destroyed, so handles obtained
+  // from it may outlive static destruction.
+  static RecyclingPool& global();
+
+  // Returns an object from the pool, or an object created by factory() if the
+  // pool is empty. Returns nullptr if factory() returns nullptr.
+  //
+  // factory() must return std::unique_ptr<T, Deleter>.
+  //
+  // A reused object is in the state left by its previous user, so it must be
+  // reinitialized as needed.
+  template <typename Factory>
+  Handle Get(Factory factory);
+
+ private:
+  void RawPut(T* ptr);
+
+  const size_t max_size_;
+  absl::Mutex mutex_;
+  std::vector<std::unique_ptr<T, Deleter>> ideal_ GUARDED_BY(mutex_);
+};
+
+// KeyedRecyclingPool<T, Key, Deleter> is like RecyclingPool<T, Deleter>, but
+// an object is reused only for the same key it was obtained with. This is
+// useful if resources held by the object depend on parameters it was used
+// with.
+//
+// Key must be copyable and equality comparable. If max_size objects are
+// already kept, the least recently returned object is deleted.
+template <typename T, typename Key, typename Deleter = std::default_delete<T>>
+class KeyedRecyclingPool {
+ public:
+  class Recycler {
+   public:
+    Recycler() noexcept {}
+
+    explicit Recycler(KeyedRecyclingPool* pool, Key key)
+        : pool_(pool), key_(std::move(key)) {}
+
+    void operator()(T* ptr) const;
+
+   private:
+    KeyedRecyclingPool* pool_ = nullptr;
+    Key key_{};
+  };
+
+  using Handle = std::unique_ptr<T, Recycler>;
+
+  explicit KeyedRecyclingPool(size_t max_size = 16) noexcept
+      : max_size_(max_size) {}
+
+  KeyedRecyclingPool(const KeyedRecyclingPool&) = delete;
+  KeyedRecyclingPool& operator=(const KeyedRecyclingPool&) = delete;
+
+  // Returns a default global pool. It is never destroyed, so handles obtained
+  // from it may outlive static destruction.
+  static KeyedRecyclingPool& global();
+
+  // Returns an object from the pool with the given key, or an object created
+  // by factory() if there is none. Returns nullptr if factory() returns
+  // nullptr.
+  //
+  // factory() must return std::unique_ptr<T, Deleter>.
+  //
+  // A reused object is in the state left by its previous user, so it must be
+  // reinitialized as needed.
+  template <typename Factory>
+  Handle Get(Key key, Factory factory);
+
+ private:
+  void RawPut(const Key& key, T* ptr);
+
+  const size_t max_size_;
+  absl::Mutex mutex_;
+  // The most recently returned objects are at the end.
+  std::vector<std::pair<Key, std::unique_ptr<T, Deleter>>> ideal_
+      GUARDED_BY(mutex_);
+};
+
+// Implementation details follow.
+
+template <typename T, typename Deleter>
+void RecyclingPool<T, Deleter>::Recycler::operator()(T* ptr) const {
+  RIEGELI_ASSERT(pool_ != nullptr)
+      << "Failed precondition of RecyclingPool::Recycler: "
+         "default-constructed recycler used with an object to recycle";
+  pool_->RawPut(ptr);
+}
+
+template <typename T, typename Deleter>
+RecyclingPool<T, Deleter>& RecyclingPool<T, Deleter>::global() {
+  static NoDestructor<RecyclingPool> kStaticRecyclingPool;
+  return *kStaticRecyclingPool;
+}
+
+template <typename T, typename Deleter>
+template <typename Factory>
+typename RecyclingPool<T, Deleter>::Handle RecyclingPool<T, Deleter>::Get(
+    Factory factory) {
+  std::unique_ptr<T, Deleter> returned;
+  {
+    absl::MutexLock lock(&mutex_);
+    if (!ideal_.empty()) {
+      returned = std::move(ideal_.back());
+      ideal_.pop_back();
+    }
+  }
+  if (returned == nullptr) returned = factory();
+  return Handle(returned.release(), Recycler(this));
+}
+
+template <typename T, typename Deleter>
+void RecyclingPool<T, Deleter>::RawPut(T* ptr) {
+  std::unique_ptr<T, Deleter> returned(ptr);
+  // Destroy the object outside the lock if it is not kept.
+  absl::MutexLock lock(&mutex_);
+  if (ABSL_PREDICT_FALSE(ideal_.size() >= max_size_)) return;
+  ideal_.push_back(std::move(returned));
+}
+
+template <typename T, typename Key, typename Deleter>
+void KeyedRecyclingPool<T, Key, Deleter>::Recycler::operator()(T* ptr) const {
+  RIEGELI_ASSERT(pool_ != nullptr)
+      << "Failed precondition of KeyedRecyclingPool::Recycler: "
+         "default-constructed recycler used with an object to recycle";
+  pool_->RawPut(key_, ptr);
+}
+
+template <typename T, typename Key, typename Deleter>
+KeyedRecyclingPool<T, Key, Deleter>&
+KeyedRecyclingPool<T, Key, Deleter>::global() {
+  static NoDestructor<KeyedRecyclingPool> kStaticKeyedRecyclingPool;
+  return *kStaticKeyedRecyclingPool;
+}
+
+template <typename T, typename Key, typename Deleter>
+template <typename Factory>
+typename KeyedRecyclingPool<T, Key, Deleter>::Handle
+KeyedRecyclingPool<T, Key, Deleter>::Get(Key key, Factory factory) {
+  std::unique_ptr<T, Deleter> returned;
+  {
+    absl::MutexLock lock(&mutex_);
+    for (auto iter = ideal_.rbegin(); iter != ideal_.rend(); ++iter) {
+      if (iter->first == key) {
+        returned = std::move(iter->second);
+        ideal_.erase(std::next(iter).base());
+        break;
+      }
+    }
+  }
+  if (returned == nullptr) returned = factory();
+  return Handle(returned.release(), Recycler(this, std::move(key)));
+}
+
+template <typename T, typename Key, typename Deleter>
+void KeyedRecyclingPool<T, Key, Deleter>::RawPut(const Key& key, T* ptr) {
+  std::unique_ptr<T, Deleter> returned(ptr);
+  // Destroy the evicted object outside the lock.
+  std::unique_ptr<T, Deleter> evicted;
+  absl::MutexLock lock(&mutex_);
+  if (ABSL_PREDICT_FALSE(max_size_ == 0)) return;
+  if (ideal_.size() >= max_size_) {
+    evicted = std::move(ideal_.front().second);
+    ideal_.erase(ideal_.begin());
+  }
+  ideal_.emplace_back(key, std::move(returned));
+}
+
+}  // namespace internal
+}  // namespace riegeli
+
+#endif  // RIEGELI_BASE_RECYCLING_POOL_H_
@@ -53,8 +53,8 @@ bool BufferedWriter::WriteSlow(absl::string_view src) {
   RIEGELI_ASSERT_GT(src.size(), available())
       << "Failed precondition of Writer::WriteSlow(string_view): "
          "length too small, use Write(string_view) instead";
-  if (written_to_buffer() == 0 ? src.size() >= buffer_.size()
-                               : src.size() - available() >= buffer_.size()) {
+  if (written_to_buffer() == 0 ? src.size() >= buffer_size()
+                               : src.size() - available() >= buffer_size()) {
     // If writing through the buffer would need multiple WriteInternal() calls,
     // it is faster to push current contents of the buffer and write the
     // remaining data directly from src.
@@ -50,6 +50,9 @@ class BufferedWriter : public Writer {
   bool PushSlow() override;
   bool WriteSlow(absl::string_view src) override;
 
+  // Returns the size of the buffer, whether or not it is allocated yet.
+  size_t buffer_size() const { return buffer_.size(); }
+
   // Writes buffered data to the destination, but unlike PushSlow(), does not
   // ensure that a buffer is allocated.
   //
@@ -15,8 +15,10 @@
 #include "riegeli/bytes/chain_reader.h"
 
 #include <stddef.h>
+#include <algorithm>
 #include <limits>
 #include <utility>
+#include <vector>
 
 #include "absl/base/optimization.h"
 #include "absl/strings/string_view.h"
@@ -30,6 +32,7 @@ namespace riegeli {
 
 void ChainReaderBase::Done() {
   iter_ = Chain::BlockIterator();
+  block_limits_ = std::vector<Position>();
   limit_pos_ = pos();
   Reader::Done();
 }
@@ -175,17 +178,36 @@ bool ChainReaderBase::SeekSlow(Position new_pos) {
   const Chain* const src = iter_.chain();
   RIEGELI_ASSERT_LE(limit_pos_, src->size())
       << "ChainReader source changed unexpectedly";
-  if (new_pos > limit_pos_) {
-    // Seeking forwards.
-    if (ABSL_PREDICT_FALSE(new_pos > src->size())) {
-      // Source ends.
-      iter_ = src->blocks().cend();
-      start_ = nullptr;
-      cursor_ = nullptr;
-      limit_ = nullptr;
-      limit_pos_ = src->size();
-      return false;
+  if (ABSL_PREDICT_FALSE(new_pos > src->size())) {
+    // Source ends.
+    iter_ = src->blocks().cend();
+    start_ = nullptr;
+    cursor_ = nullptr;
+    limit_ = nullptr;
+    limit_pos_ = src->size();
+    return false;
+  }
+  if (src->blocks().size() >= kMinBlocksForIndex) {
+    // Binary search for the first block ending at or after new_pos.
+    if (block_limits_.empty()) {
+      block_limits_.reserve(src->blocks().size());
+      Position block_limit = 0;
+      for (const absl::string_view block : src->blocks()) {
+        block_limit += block.size();
+        block_limits_.push_back(block_limit);
+      }
     }
+    RIEGELI_ASSERT_EQ(block_limits_.size(), src->blocks().size())
+        << "ChainReader source changed unexpectedly";
+    const std::vector<Position>::const_iterator found =
+        std::lower_bound(block_limits_.cbegin(), block_limits_.cend(), new_pos);
+    RIEGELI_ASSERT(found != block_limits_.cend())
+        << "ChainReader source changed unexpectedly";
+    iter_ = Chain::BlockIterator(
+        src, IntCast<size_t>(found - block_limits_.cbegin()));
+    limit_pos_ = *found;
+  } else if (new_pos > limit_pos_) {
+    // Seeking forwards.
     if (src->size() - new_pos < new_pos - limit_pos_) {
       // Iterate backwards from the end, it is closer.
       iter_ = src->blocks().cend();
@@ -17,6 +17,7 @@
 
 #include <stddef.h>
 #include <utility>
+#include <vector>
 
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
@@ -52,6 +53,16 @@ class ChainReaderBase : public Reader {
   bool SeekSlow(Position new_pos) override;
 
   Chain::BlockIterator iter_;
+
+ private:
+  // Seeking in a Chain with at least this many blocks uses block_limits_.
+  static constexpr size_t kMinBlocksForIndex = 16;
+
+  // If not empty, block_limits_[i] is the position after block i of the Chain
+  // being read, so that SeekSlow() can find a block by binary search instead of
+  // iterating over blocks. Built by the first SeekSlow() which needs it; valid
+  // because the Chain must not change while being read.
+  std::vector<Position> block_limits_;
 };
 
 // A Reader which reads from a Chain. It supports random access.
@@ -98,12 +109,14 @@ class ChainReader : public ChainReaderBase {
 
 inline ChainReaderBase::ChainReaderBase(ChainReaderBase&& that) noexcept
     : Reader(std::move(that)),
-      iter_(absl::exchange(that.iter_, Chain::BlockIterator())) {}
+      iter_(absl::exchange(that.iter_, Chain::BlockIterator())),
+      block_limits_(std::move(that.block_limits_)) {}
 
 inline ChainReaderBase& ChainReaderBase::operator=(
     ChainReaderBase&& that) noexcept {
   Reader::operator=(std::move(that));
   iter_ = absl::exchange(that.iter_, Chain::BlockIterator());
+  block_limits_ = std::move(that.block_limits_);
   return *this;
 }
 
@@ -47,6 +47,7 @@
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/buffered_reader.h"
 #include "riegeli/bytes/fd_dependency.h"
+#include "riegeli/bytes/fd_writer.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/writer.h"
 
@@ -139,6 +140,44 @@ bool FdReaderCommon::FailOperation(absl::string_view operation) {
                            ", reading ", filename_));
 }
 
+bool FdReaderCommon::CopyToSlow(Writer* dest, Position length) {
+  RIEGELI_ASSERT_GT(length, UnsignedMin(available(), kMaxBytesToCopy()))
+      << "Failed precondition of Reader::CopyToSlow(Writer*): "
+         "length too small, use CopyTo(Writer*) instead";
+  if (dest->GetTypeId() == TypeId::For<FdWriterCommon>() &&
+      length >= available() && length - available() >= buffer_size_) {
+    // If copying through buffer_ would need multiple ReadInternal() calls, it
+    // is faster to write current contents of buffer_ and copy the remaining
+    // data directly between the fds.
+    if (ABSL_PREDICT_FALSE(!healthy())) return false;
+    FdWriterCommon* const fd_dest = static_cast<FdWriterCommon*>(dest);
+    const size_t available_length = available();
+    if (available_length > 0) {
+      const bool write_ok =
+          dest->Write(absl::string_view(cursor_, available_length));
+      cursor_ = limit_;
+      if (ABSL_PREDICT_FALSE(!write_ok)) return false;
+      length -= available_length;
+    }
+    ClearBuffer();
+    // FdReader reads at limit_pos_ with pread(), FdStreamReader reads at the
+    // current fd position with read(). Exceeding the maximum file position is
+    // reported when the remaining data are copied through the buffer.
+    const Position length_to_copy = UnsignedMin(
+        length, Position{std::numeric_limits<off_t>::max()} - limit_pos_);
+    Position length_copied;
+    if (ABSL_PREDICT_FALSE(!fd_dest->CopyFromFd(
+            src_fd(), SupportsRandomAccess() ? &limit_pos_ : nullptr,
+            length_to_copy, &length_copied))) {
+      return false;
+    }
+    limit_pos_ += length_copied;
+    length -= length_copied;
+    if (length == 0) return true;
+  }
+  return BufferedReader::CopyToSlow(dest, length);
+}
+
 }  // namespace internal
 
 void FdReaderBase::Initialize(int src) {
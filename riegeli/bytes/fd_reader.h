@@ -67,6 +67,13 @@ class FdReaderCommon : public BufferedReader {
   int OpenFd(absl::string_view filename, int flags);
   ABSL_ATTRIBUTE_COLD bool FailOperation(absl::string_view operation);
 
+  // If dest is an FdWriter or FdStreamWriter and copying through the buffer
+  // would need multiple ReadInternal() calls, copies the remaining data
+  // directly between the fds in the kernel, avoiding passing them through user
+  // space. Data which cannot be copied this way are copied through the buffer.
+  bool CopyToSlow(Writer* dest, Position length) override;
+  using BufferedReader::CopyToSlow;
+
   std::string filename_;
   // errno value of the last fd operation, or 0 if none.
   //
@@ -18,6 +18,17 @@
 #define _XOPEN_SOURCE 500
 #endif
 
+// Make pwritev() available.
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+// Make copy_file_range(), splice(), fallocate() with its flags, and mremap()
+// available.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 // Make file offsets 64-bit even on 32-bit systems.
 #undef _FILE_OFFSET_BITS
 #define _FILE_OFFSET_BITS 64
@@ -25,9 +36,15 @@
 #include "riegeli/bytes/fd_writer.h"
 
 #include <fcntl.h>
+#include <limits.h>
 #include <stddef.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <cerrno>
 #include <limits>
@@ -38,6 +55,8 @@
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/object.h"
 #include "riegeli/base/str_error.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/fd_dependency.h"
@@ -47,6 +66,100 @@ namespace riegeli {
 
 namespace internal {
 
+namespace {
+
+// Maximum number of iovec elements passed to a single writev() or pwritev().
+// The iovec array is on the stack, so this is kept small; Chain blocks are
+// usually large enough for a batch to amortize the syscall.
+constexpr int kMaxIovecs() {
+#ifdef IOV_MAX
+  return IOV_MAX < 64 ? IOV_MAX : 64;
+#else
+  return 16;
+#endif
+}
+
+// Removes length bytes from the beginning of data described by *iov and
+// *iovcnt, adjusting them to describe the remaining data.
+inline void RemoveIovecPrefix(size_t length, struct iovec** iov, int* iovcnt) {
+  while (length >= (*iov)->iov_len) {
+    length -= (*iov)->iov_len;
+    ++*iov;
+    --*iovcnt;
+    if (*iovcnt == 0) {
+      RIEGELI_ASSERT_EQ(length, 0u) << "Removing more than available";
+      return;
+    }
+  }
+  (*iov)->iov_base = static_cast<char*>((*iov)->iov_base) + length;
+  (*iov)->iov_len -= length;
+}
+
+// Copies up to length bytes from src to dest in the kernel. Methods are tried
+// in turn until one succeeds: copy_file_range() (both fds are files),
+// splice() (one of fds is a pipe), and sendfile() (dest is written at its
+// current position).
+//
+// src is read from *src_pos if src_pos != nullptr, or from its current
+// position otherwise, and similarly for dest and *dest_pos. Positions are
+// incremented by the length copied.
+//
+// Returns the length copied, which is less than length if src ended, or if no
+// method is supported for these fds or copying failed.
+Position CopyFdRange(int src, off_t* src_pos, int dest, off_t* dest_pos,
+                     Position length) {
+  Position length_copied = 0;
+#ifdef __linux__
+  enum class Method { kCopyFileRange, kSplice, kSendfile };
+  Method method = Method::kCopyFileRange;
+  while (length_copied < length) {
+    const size_t length_to_copy = IntCast<size_t>(
+        UnsignedMin(length - length_copied,
+                    size_t{std::numeric_limits<ssize_t>::max()}));
+    ssize_t result;
+    switch (method) {
+      case Method::kCopyFileRange:
+        result = copy_file_range(src, src_pos, dest, dest_pos, length_to_copy,
+                                 0);
+        break;
+      case Method::kSplice:
+        result = splice(src, src_pos, dest, dest_pos, length_to_copy,
+                        SPLICE_F_MOVE);
+        break;
+      case Method::kSendfile:
+        if (dest_pos != nullptr) return length_copied;
+        result = sendfile(dest, src, src_pos, length_to_copy);
+        break;
+    }
+    if (ABSL_PREDICT_FALSE(result < 0)) {
+      if (errno == EINTR) continue;
+      switch (method) {
+        case Method::kCopyFileRange:
+          method = Method::kSplice;
+          continue;
+        case Method::kSplice:
+          method = Method::kSendfile;
+          continue;
+        case Method::kSendfile:
+          return length_copied;
+      }
+    }
+    // Source ends.
+    if (result == 0) return length_copied;
+    RIEGELI_ASSERT_LE(IntCast<size_t>(result), length_to_copy)
+        << "Copying between fds copied more than requested";
+    length_copied += IntCast<size_t>(result);
+  }
+#endif
+  return length_copied;
+}
+
+}  // namespace
+
+TypeId FdWriterCommon::GetTypeId() const {
+  return TypeId::For<FdWriterCommon>();
+}
+
 FdWriterCommon::FdWriterCommon(size_t buffer_size)
     : BufferedWriter(UnsignedMin(
           buffer_size, Position{std::numeric_limits<off_t>::max()})) {}
@@ -80,8 +193,98 @@ bool FdWriterCommon::FailOperation(absl::string_view operation) {
                            ", writing ", filename_));
 }
 
+bool FdWriterCommon::WriteSlow(const Chain& src) {
+  RIEGELI_ASSERT_GT(src.size(), UnsignedMin(available(), kMaxBytesToCopy()))
+      << "Failed precondition of Writer::WriteSlow(Chain): "
+         "length too small, use Write(Chain) instead";
+  if (src.size() <= available()) return Writer::WriteSlow(src);
+  if (written_to_buffer() == 0 ? src.size() < buffer_size()
+                               : src.size() - available() < buffer_size()) {
+    return Writer::WriteSlow(src);
+  }
+  // Writing through the buffer would need multiple WriteInternal() calls. It is
+  // faster to write current contents of the buffer together with fragments of
+  // src with writev() or pwritev() than to copy src to the buffer first.
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  const size_t buffered_length = written_to_buffer();
+  if (ABSL_PREDICT_FALSE(src.size() >
+                         Position{std::numeric_limits<off_t>::max()} -
+                             start_pos_ - buffered_length)) {
+    limit_ = start_;
+    return FailOverflow();
+  }
+  struct iovec iov[kMaxIovecs()];
+  int iovcnt = 0;
+  if (buffered_length > 0) {
+    iov[iovcnt].iov_base = start_;
+    iov[iovcnt].iov_len = buffered_length;
+    ++iovcnt;
+    cursor_ = start_;
+  }
+  for (const absl::string_view fragment : src.blocks()) {
+    if (ABSL_PREDICT_FALSE(iovcnt == kMaxIovecs())) {
+      if (ABSL_PREDICT_FALSE(!WriteVInternal(iov, iovcnt))) return false;
+      iovcnt = 0;
+    }
+    iov[iovcnt].iov_base = const_cast<char*>(fragment.data());
+    iov[iovcnt].iov_len = fragment.size();
+    ++iovcnt;
+  }
+  return WriteVInternal(iov, iovcnt);
+}
+
+bool FdWriterCommon::WriteSlow(Chain&& src) {
+  RIEGELI_ASSERT_GT(src.size(), UnsignedMin(available(), kMaxBytesToCopy()))
+      << "Failed precondition of Writer::WriteSlow(Chain&&): "
+         "length too small, use Write(Chain&&) instead";
+  // Not std::move(src): the data are written directly from src, so there is no
+  // benefit from taking its ownership.
+  return WriteSlow(src);
+}
+
+bool FdWriterCommon::CopyFromFd(int src, const Position* src_pos,
+                                Position length, Position* length_copied) {
+  *length_copied = 0;
+  if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "BufferedWriter::PushInternal() did not empty the buffer";
+  // Exceeding the maximum file position is reported when the remaining data
+  // are written through user space.
+  length = UnsignedMin(
+      length, Position{std::numeric_limits<off_t>::max()} - start_pos_);
+  off_t src_offset = src_pos == nullptr ? 0 : IntCast<off_t>(*src_pos);
+  // FdWriter writes at start_pos_ with pwrite(), FdStreamWriter writes at the
+  // current fd position with write().
+  off_t dest_offset = IntCast<off_t>(start_pos_);
+  Preallocate(start_pos_ + length);
+  *length_copied =
+      CopyFdRange(src, src_pos == nullptr ? nullptr : &src_offset, dest_fd(),
+                  SupportsRandomAccess() ? &dest_offset : nullptr, length);
+  start_pos_ += *length_copied;
+  return true;
+}
+
 }  // namespace internal
 
+void FdWriterBase::Done() {
+  if (preallocated_end_ > 0 && ABSL_PREDICT_TRUE(healthy())) {
+    // Release space preallocated after the end of file: truncating a file
+    // releases space after its new size even if the size is unchanged.
+    const int dest = dest_fd();
+    struct stat stat_info;
+    if (ABSL_PREDICT_FALSE(fstat(dest, &stat_info) < 0)) {
+      FailOperation("fstat()");
+    } else if (preallocated_end_ > IntCast<Position>(stat_info.st_size)) {
+    again:
+      if (ABSL_PREDICT_FALSE(ftruncate(dest, stat_info.st_size) < 0)) {
+        if (errno == EINTR) goto again;
+        FailOperation("ftruncate()");
+      }
+    }
+  }
+  FdWriterCommon::Done();
+}
+
 void FdWriterBase::Initialize(int flags, int dest) {
   if (sync_pos_) {
     const off_t result = lseek(dest, 0, SEEK_CUR);
@@ -113,6 +316,29 @@ bool FdWriterBase::SyncPos(int dest) {
   return true;
 }
 
+void FdWriterBase::Preallocate(Position end) {
+  if (preallocate_ == 0 || end <= preallocated_end_) return;
+#ifdef __linux__
+  const Position begin = UnsignedMax(preallocated_end_, start_pos_);
+  const Position new_end =
+      UnsignedMin(end, Position{std::numeric_limits<off_t>::max()} -
+                           preallocate_) +
+      preallocate_;
+again:
+  if (ABSL_PREDICT_FALSE(fallocate(dest_fd(), FALLOC_FL_KEEP_SIZE,
+                                   IntCast<off_t>(begin),
+                                   IntCast<off_t>(new_end - begin)) < 0)) {
+    if (errno == EINTR) goto again;
+    if (errno == EOPNOTSUPP || errno == ENOSYS) preallocate_ = 0;
+    // Other failures, e.g. ENOSPC, are reported by writing if they matter.
+    return;
+  }
+  preallocated_end_ = new_end;
+#else
+  preallocate_ = 0;
+#endif
+}
+
 bool FdWriterBase::WriteInternal(absl::string_view src) {
   RIEGELI_ASSERT(!src.empty())
       << "Failed precondition of BufferedWriter::WriteInternal(): "
@@ -130,6 +356,7 @@ bool FdWriterBase::WriteInternal(absl::string_view src) {
     limit_ = start_;
     return FailOverflow();
   }
+  Preallocate(start_pos_ + src.size());
   do {
   again:
     const ssize_t result = pwrite(
@@ -150,6 +377,38 @@ bool FdWriterBase::WriteInternal(absl::string_view src) {
   return true;
 }
 
+bool FdWriterBase::WriteVInternal(struct iovec* iov, int iovcnt) {
+  RIEGELI_ASSERT_GT(iovcnt, 0)
+      << "Failed precondition of FdWriterCommon::WriteVInternal(): "
+         "nothing to write";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of FdWriterCommon::WriteVInternal(): "
+      << message();
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "Failed precondition of FdWriterCommon::WriteVInternal(): "
+         "buffer not empty";
+  const int dest = dest_fd();
+  if (preallocate_ > 0) {
+    Position length = 0;
+    for (int i = 0; i < iovcnt; ++i) length += iov[i].iov_len;
+    Preallocate(start_pos_ + length);
+  }
+  do {
+  again:
+    const ssize_t result =
+        pwritev(dest, iov, iovcnt, IntCast<off_t>(start_pos_));
+    if (ABSL_PREDICT_FALSE(result < 0)) {
+      if (errno == EINTR) goto again;
+      limit_ = start_;
+      return FailOperation("pwritev()");
+    }
+    RIEGELI_ASSERT_GT(result, 0) << "pwritev() returned 0";
+    start_pos_ += IntCast<size_t>(result);
+    internal::RemoveIovecPrefix(IntCast<size_t>(result), &iov, &iovcnt);
+  } while (iovcnt > 0);
+  return true;
+}
+
 bool FdWriterBase::Flush(FlushType flush_type) {
   if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
   const int dest = dest_fd();
@@ -228,6 +487,8 @@ again:
     return FailOperation("ftruncate()");
   }
   start_pos_ = new_size;
+  // Truncation releases space preallocated after the new end.
+  preallocated_end_ = UnsignedMin(preallocated_end_, new_size);
   return true;
 }
 
@@ -278,6 +539,32 @@ bool FdStreamWriterBase::WriteInternal(absl::string_view src) {
   return true;
 }
 
+bool FdStreamWriterBase::WriteVInternal(struct iovec* iov, int iovcnt) {
+  RIEGELI_ASSERT_GT(iovcnt, 0)
+      << "Failed precondition of FdWriterCommon::WriteVInternal(): "
+         "nothing to write";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of FdWriterCommon::WriteVInternal(): "
+      << message();
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "Failed precondition of FdWriterCommon::WriteVInternal(): "
+         "buffer not empty";
+  const int dest = dest_fd();
+  do {
+  again:
+    const ssize_t result = writev(dest, iov, iovcnt);
+    if (ABSL_PREDICT_FALSE(result < 0)) {
+      if (errno == EINTR) goto again;
+      limit_ = start_;
+      return FailOperation("writev()");
+    }
+    RIEGELI_ASSERT_GT(result, 0) << "writev() returned 0";
+    start_pos_ += IntCast<size_t>(result);
+    internal::RemoveIovecPrefix(IntCast<size_t>(result), &iov, &iovcnt);
+  } while (iovcnt > 0);
+  return true;
+}
+
 bool FdStreamWriterBase::Flush(FlushType flush_type) {
   if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
   const int dest = dest_fd();
@@ -292,9 +579,215 @@ bool FdStreamWriterBase::Flush(FlushType flush_type) {
       << "Unknown flush type: " << static_cast<int>(flush_type);
 }
 
+void FdMMapWriterBase::SetFilename(int dest) {
+  filename_ = absl::StrCat("/proc/self/fd/", dest);
+}
+
+int FdMMapWriterBase::OpenFd(absl::string_view filename, int flags,
+                             mode_t permissions) {
+  filename_.assign(filename.data(), filename.size());
+again:
+  const int dest = open(filename_.c_str(), flags, permissions);
+  if (ABSL_PREDICT_FALSE(dest < 0)) {
+    if (errno == EINTR) goto again;
+    FailOperation("open()");
+    return -1;
+  }
+  return dest;
+}
+
+bool FdMMapWriterBase::FailOperation(absl::string_view operation) {
+  error_code_ = errno;
+  return Fail(absl::StrCat(operation, " failed: ", StrError(error_code_),
+                           ", writing ", filename_));
+}
+
+void FdMMapWriterBase::Initialize(int dest) {
+  struct stat stat_info;
+  if (ABSL_PREDICT_FALSE(fstat(dest, &stat_info) < 0)) {
+    FailOperation("fstat()");
+    return;
+  }
+  if (ABSL_PREDICT_FALSE(IntCast<Position>(stat_info.st_size) >
+                         std::numeric_limits<size_t>::max())) {
+    Fail("File is too large for mmap()");
+    return;
+  }
+  if (stat_info.st_size != 0) {
+    if (ABSL_PREDICT_FALSE(!Resize(IntCast<size_t>(stat_info.st_size)))) {
+      return;
+    }
+    cursor_ = limit_;
+    growth_base_ = mapping_size_;
+  }
+}
+
+void FdMMapWriterBase::Done() {
+  // Truncate the file to the current position.
+  if (ABSL_PREDICT_TRUE(healthy())) Resize(written_to_buffer());
+  if (mapping_size_ > 0) {
+    const int result = munmap(start_, mapping_size_);
+    mapping_size_ = 0;
+    if (ABSL_PREDICT_FALSE(result < 0) && ABSL_PREDICT_TRUE(healthy())) {
+      cursor_ = start_;
+      limit_ = start_;
+      FailOperation("munmap()");
+    }
+  }
+  start_pos_ = pos();
+  Writer::Done();
+}
+
+bool FdMMapWriterBase::PushSlow() {
+  RIEGELI_ASSERT_EQ(available(), 0u)
+      << "Failed precondition of Writer::PushSlow(): "
+         "space available, use Push() instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  const size_t max_size =
+      UnsignedMin(std::numeric_limits<size_t>::max(),
+                  Position{std::numeric_limits<off_t>::max()});
+  if (ABSL_PREDICT_FALSE(mapping_size_ == max_size)) {
+    cursor_ = start_;
+    limit_ = start_;
+    return FailOverflow();
+  }
+  const size_t growth = UnsignedMax(mapping_size_ - growth_base_, min_growth_);
+  return Resize(growth > max_size - mapping_size_ ? max_size
+                                                  : mapping_size_ + growth);
+}
+
+bool FdMMapWriterBase::Flush(FlushType flush_type) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  switch (flush_type) {
+    case FlushType::kFromObject:
+      // Data written to the mapping are already in the file.
+      return true;
+    case FlushType::kFromProcess:
+    case FlushType::kFromMachine:
+      // Truncate the file to the current position, so that data written so far
+      // are visible as the whole file. PushSlow() will extend it again,
+      // starting from min_growth_.
+      if (ABSL_PREDICT_FALSE(!Resize(written_to_buffer()))) return false;
+      growth_base_ = mapping_size_;
+      if (flush_type == FlushType::kFromProcess) return true;
+      if (mapping_size_ > 0 &&
+          ABSL_PREDICT_FALSE(msync(start_, mapping_size_, MS_SYNC) < 0)) {
+        cursor_ = start_;
+        limit_ = start_;
+        return FailOperation("msync()");
+      }
+      if (ABSL_PREDICT_FALSE(fsync(dest_fd()) < 0)) {
+        cursor_ = start_;
+        limit_ = start_;
+        return FailOperation("fsync()");
+      }
+      return true;
+  }
+  RIEGELI_ASSERT_UNREACHABLE()
+      << "Unknown flush type: " << static_cast<int>(flush_type);
+}
+
+bool FdMMapWriterBase::Truncate(Position new_size) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(new_size > written_to_buffer())) return false;
+  cursor_ = start_ + new_size;
+  return true;
+}
+
+bool FdMMapWriterBase::Resize(size_t new_size) {
+  RIEGELI_ASSERT_GE(new_size, written_to_buffer())
+      << "Failed precondition of FdMMapWriterBase::Resize(): "
+         "discarding written data";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of FdMMapWriterBase::Resize(): " << message();
+  const int dest = dest_fd();
+  const size_t old_size = mapping_size_;
+  const size_t cursor_index = written_to_buffer();
+  if (new_size > old_size) {
+    // Extend the file before the mapping, so that the whole mapping is backed
+    // by the file.
+#ifdef __linux__
+    // Allocate space if supported, so that running out of space is reported
+    // here rather than by SIGBUS when writing to the mapping. Otherwise
+    // ftruncate() below makes a sparse file.
+  again_fallocate:
+    if (ABSL_PREDICT_FALSE(fallocate(dest, 0, IntCast<off_t>(old_size),
+                                     IntCast<off_t>(new_size - old_size)) <
+                           0)) {
+      if (errno == EINTR) goto again_fallocate;
+      if (ABSL_PREDICT_FALSE(errno != EOPNOTSUPP && errno != ENOSYS)) {
+        cursor_ = start_;
+        limit_ = start_;
+        return FailOperation("fallocate()");
+      }
+    }
+#endif
+  again_extend:
+    if (ABSL_PREDICT_FALSE(ftruncate(dest, IntCast<off_t>(new_size)) < 0)) {
+      if (errno == EINTR) goto again_extend;
+      cursor_ = start_;
+      limit_ = start_;
+      return FailOperation("ftruncate()");
+    }
+  }
+  if (new_size != old_size) {
+    char* mapping = nullptr;
+#ifdef __linux__
+    if (old_size > 0 && new_size > 0) {
+      void* const result = mremap(start_, old_size, new_size, MREMAP_MAYMOVE);
+      if (ABSL_PREDICT_FALSE(result == MAP_FAILED)) {
+        cursor_ = start_;
+        limit_ = start_;
+        return FailOperation("mremap()");
+      }
+      mapping = static_cast<char*>(result);
+    }
+#endif
+    if (mapping == nullptr) {
+      if (old_size > 0) {
+        const int result = munmap(start_, old_size);
+        start_ = nullptr;
+        mapping_size_ = 0;
+        if (ABSL_PREDICT_FALSE(result < 0)) {
+          cursor_ = start_;
+          limit_ = start_;
+          return FailOperation("munmap()");
+        }
+      }
+      if (new_size > 0) {
+        void* const result = mmap(nullptr, new_size, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED, dest, 0);
+        if (ABSL_PREDICT_FALSE(result == MAP_FAILED)) {
+          cursor_ = start_;
+          limit_ = start_;
+          return FailOperation("mmap()");
+        }
+        mapping = static_cast<char*>(result);
+      }
+    }
+    start_ = mapping;
+    cursor_ = start_ + cursor_index;
+    limit_ = start_ + new_size;
+    mapping_size_ = new_size;
+  }
+  if (new_size < old_size) {
+    // Shrink the file after the mapping.
+  again_shrink:
+    if (ABSL_PREDICT_FALSE(ftruncate(dest, IntCast<off_t>(new_size)) < 0)) {
+      if (errno == EINTR) goto again_shrink;
+      cursor_ = start_;
+      limit_ = start_;
+      return FailOperation("ftruncate()");
+    }
+  }
+  return true;
+}
+
 template class FdWriter<OwnedFd>;
 template class FdWriter<int>;
 template class FdStreamWriter<OwnedFd>;
 template class FdStreamWriter<int>;
+template class FdMMapWriter<OwnedFd>;
+template class FdMMapWriter<int>;
 
 }  // namespace riegeli
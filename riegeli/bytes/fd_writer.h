@@ -18,6 +18,7 @@
 #include <fcntl.h>
 #include <stddef.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <string>
 #include <utility>
 
@@ -27,7 +28,9 @@
 #include "absl/types/optional.h"
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/object.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/fd_dependency.h"
 #include "riegeli/bytes/writer.h"
@@ -36,6 +39,8 @@ namespace riegeli {
 
 namespace internal {
 
+class FdReaderCommon;
+
 // Implementation shared between FdWriter and FdStreamWriter.
 class FdWriterCommon : public BufferedWriter {
  public:
@@ -51,6 +56,8 @@ class FdWriterCommon : public BufferedWriter {
   // Unchanged by Close().
   int error_code() const { return error_code_; }
 
+  TypeId GetTypeId() const override;
+
  protected:
   FdWriterCommon() noexcept {}
 
@@ -63,6 +70,33 @@ class FdWriterCommon : public BufferedWriter {
   int OpenFd(absl::string_view filename, int flags, mode_t permissions);
   ABSL_ATTRIBUTE_COLD bool FailOperation(absl::string_view operation);
 
+  // If writing src through the buffer would need multiple WriteInternal()
+  // calls (using the same threshold as BufferedWriter::WriteSlow()), writes
+  // buffered data together with fragments of src directly with
+  // WriteVInternal(), avoiding copying src to the buffer.
+  bool WriteSlow(const Chain& src) override;
+  bool WriteSlow(Chain&& src) override;
+  using BufferedWriter::WriteSlow;
+
+  // Writes data from the iovcnt elements of iov to the destination, to the
+  // physical destination position which is start_pos_. The contents of iov may
+  // be changed.
+  //
+  // Increments start_pos_ by the length written.
+  //
+  // Preconditions:
+  //   iovcnt > 0
+  //   0 < length <= numeric_limits<off_t>::max() - start_pos_, where length is
+  //       the total length of data in iov
+  //   healthy()
+  //   written_to_buffer() == 0
+  virtual bool WriteVInternal(struct iovec* iov, int iovcnt) = 0;
+
+  // Called before data up to end are written other than by WriteInternal() or
+  // WriteVInternal(), e.g. by copying between fds in the kernel, so that file
+  // space can be allocated for them. Does nothing by default.
+  virtual void Preallocate(Position end) {}
+
   std::string filename_;
   // errno value of the last fd operation, or 0 if none.
   //
@@ -72,6 +106,27 @@ class FdWriterCommon : public BufferedWriter {
   // Invariants:
   //   start_pos_ <= numeric_limits<off_t>::max()
   //   buffer_size_ <= numeric_limits<off_t>::max()
+
+ private:
+  friend class FdReaderCommon;
+
+  // Writes buffered data, then writes up to length bytes read from src directly
+  // to the destination, without passing them through user space, using
+  // copy_file_range(), splice(), or sendfile().
+  //
+  // src is read from *src_pos if src_pos != nullptr, or from its current
+  // position otherwise.
+  //
+  // Sets *length_copied to the length copied. This can be less than length if
+  // src ended, or if copying directly between these fds is not supported or
+  // failed. The remaining data should then be copied through user space, which
+  // also reports any failure.
+  //
+  // Return values:
+  //  * true  - success (*length_copied is set)
+  //  * false - failure (!healthy())
+  bool CopyFromFd(int src, const Position* src_pos, Position length,
+                  Position* length_copied);
 };
 
 }  // namespace internal
@@ -119,6 +174,25 @@ class FdWriterBase : public internal::FdWriterCommon {
       return std::move(set_sync_pos(sync_pos));
     }
 
+    // If positive, file space is allocated with fallocate() ahead of the write
+    // position, at least this length at a time, without changing the file
+    // size. This reduces fragmentation of files which grow concurrently, and
+    // time spent in block allocation. This applies also to data copied from an
+    // fd in the kernel by Reader::CopyTo(). Allocated space after the end of
+    // file is released by Close().
+    //
+    // Preallocation is skipped if the platform or filesystem does not support
+    // it.
+    //
+    // Default: 0 (no preallocation).
+    Options& set_preallocate(Position preallocate) & {
+      preallocate_ = preallocate;
+      return *this;
+    }
+    Options&& set_preallocate(Position preallocate) && {
+      return std::move(set_preallocate(preallocate));
+    }
+
    private:
     template <typename Dest>
     friend class FdWriter;
@@ -126,6 +200,7 @@ class FdWriterBase : public internal::FdWriterCommon {
     mode_t permissions_ = 0666;
     size_t buffer_size_ = kDefaultBufferSize();
     bool sync_pos_ = false;
+    Position preallocate_ = 0;
   };
 
   bool Flush(FlushType flush_type) override;
@@ -137,18 +212,33 @@ class FdWriterBase : public internal::FdWriterCommon {
  protected:
   FdWriterBase() noexcept {}
 
-  explicit FdWriterBase(size_t buffer_size, bool sync_pos)
-      : FdWriterCommon(buffer_size), sync_pos_(sync_pos) {}
+  explicit FdWriterBase(size_t buffer_size, bool sync_pos,
+                        Position preallocate)
+      : FdWriterCommon(buffer_size),
+        sync_pos_(sync_pos),
+        preallocate_(preallocate) {}
 
   FdWriterBase(FdWriterBase&& that) noexcept;
   FdWriterBase& operator=(FdWriterBase&& that) noexcept;
 
+  void Done() override;
   void Initialize(int flags, int dest);
   bool SyncPos(int dest);
   bool WriteInternal(absl::string_view src) override;
+  bool WriteVInternal(struct iovec* iov, int iovcnt) override;
   bool SeekSlow(Position new_pos) override;
 
   bool sync_pos_ = false;
+
+ private:
+  // If preallocation is enabled and end is after preallocated space, allocates
+  // space up to end + preallocate_. Failures are ignored, except that
+  // preallocation is disabled if it is not supported.
+  void Preallocate(Position end) override;
+
+  Position preallocate_ = 0;
+  // File space is preallocated before this position.
+  Position preallocated_end_ = 0;
 };
 
 // Template parameter invariant part of FdStreamWriter.
@@ -216,6 +306,109 @@ class FdStreamWriterBase : public internal::FdWriterCommon {
 
   void Initialize(int flags, int dest);
   bool WriteInternal(absl::string_view src) override;
+  bool WriteVInternal(struct iovec* iov, int iovcnt) override;
+};
+
+// Template parameter invariant part of FdMMapWriter.
+class FdMMapWriterBase : public Writer {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Permissions to use in case a new file is created (9 bits). The effective
+    // permissions are modified by the process's umask.
+    Options& set_permissions(mode_t permissions) & {
+      permissions_ = permissions;
+      return *this;
+    }
+    Options&& set_permissions(mode_t permissions) && {
+      return std::move(set_permissions(permissions));
+    }
+
+    // Minimal length by which the file is extended when more space is needed.
+    // The file is also extended at least by the length it has grown since it
+    // was opened or truncated by Flush(), so that the number of remappings is
+    // logarithmic in that length.
+    //
+    // Default: 1M
+    Options& set_min_growth(size_t min_growth) & {
+      RIEGELI_ASSERT_GT(min_growth, 0u)
+          << "Failed precondition of "
+             "FdMMapWriterBase::Options::set_min_growth(): "
+             "zero growth";
+      min_growth_ = min_growth;
+      return *this;
+    }
+    Options&& set_min_growth(size_t min_growth) && {
+      return std::move(set_min_growth(min_growth));
+    }
+
+   private:
+    template <typename Dest>
+    friend class FdMMapWriter;
+
+    mode_t permissions_ = 0666;
+    size_t min_growth_ = size_t{1} << 20;
+  };
+
+  // Returns the fd being written to. If the fd is owned then changed to -1 by
+  // Close(), otherwise unchanged.
+  virtual int dest_fd() const = 0;
+
+  // Returns the original name of the file being written to (or
+  // /proc/self/fd/<fd> if fd was given). Unchanged by Close().
+  const std::string& filename() const { return filename_; }
+
+  // Returns the errno value of the last fd operation, or 0 if none.
+  // Unchanged by Close().
+  int error_code() const { return error_code_; }
+
+  bool Flush(FlushType flush_type) override;
+  bool SupportsTruncate() const override { return true; }
+  bool Truncate(Position new_size) override;
+
+ protected:
+  FdMMapWriterBase() noexcept : Writer(State::kClosed) {}
+
+  explicit FdMMapWriterBase(size_t min_growth)
+      : Writer(State::kOpen), min_growth_(min_growth) {}
+
+  FdMMapWriterBase(FdMMapWriterBase&& that) noexcept;
+  FdMMapWriterBase& operator=(FdMMapWriterBase&& that) noexcept;
+
+  void SetFilename(int dest);
+  int OpenFd(absl::string_view filename, int flags, mode_t permissions);
+  ABSL_ATTRIBUTE_COLD bool FailOperation(absl::string_view operation);
+  void Initialize(int dest);
+  void Done() override;
+  bool PushSlow() override;
+
+ private:
+  // Sets the file size and the size of the mapping to new_size, keeping the
+  // position. Sets buffer pointers to the new mapping.
+  //
+  // Precondition: new_size >= written_to_buffer()
+  bool Resize(size_t new_size);
+
+  std::string filename_;
+  // errno value of the last fd operation, or 0 if none.
+  //
+  // Invariant: if healthy() then error_code_ == 0
+  int error_code_ = 0;
+  size_t min_growth_ = 0;
+  // Size of the mapping starting at start_ (0 if there is no mapping).
+  size_t mapping_size_ = 0;
+  // File size when the file was opened or last truncated by Flush(). Growth is
+  // relative to it, so that flushing regularly does not extend the file by its
+  // whole size each time.
+  size_t growth_base_ = 0;
+
+  // Invariants if healthy():
+  //   start_pos_ == 0
+  //   buffer_size() == mapping_size_ == file size
+  //   mapping_size_ <= numeric_limits<off_t>::max()
+  //   growth_base_ <= mapping_size_
 };
 
 // A Writer which writes to a file descriptor. It supports random access; the
@@ -321,6 +514,68 @@ class FdStreamWriter : public FdStreamWriterBase {
   Dependency<int, Dest> dest_;
 };
 
+// A Writer which writes to a file descriptor by mapping the file to memory.
+// The buffer is the mapping itself, so writing does not involve write()
+// syscalls nor copying from a separate buffer; instead the kernel handles a
+// page fault for each page written, so whether this is faster than FdWriter
+// depends on the platform. The fd must support mmap(), fstat(), and
+// ftruncate(), e.g. a regular file on a local filesystem or tmpfs, and must be
+// opened for reading and writing, not for appending.
+//
+// The file is extended in large steps as more space is needed, and is
+// truncated to the current position by Close(), and by Flush() with
+// FlushType::kFromProcess or FlushType::kFromMachine. Like for
+// StringWriter, the destination ends at the current position: seeking
+// backwards with Seek() or Truncate() discards the data after the new
+// position.
+//
+// The Dest template parameter specifies the type of the object providing and
+// possibly owning the fd being written to. Dest must support
+// Dependency<int, Dest>, e.g. OwnedFd (owned, default), int (not owned).
+//
+// The fd must not be closed, and the file must not be accessed by other means
+// except for reading after Flush(FlushType::kFromProcess) or
+// Flush(FlushType::kFromMachine), until the FdMMapWriter is closed or no longer
+// used.
+template <typename Dest = OwnedFd>
+class FdMMapWriter : public FdMMapWriterBase {
+ public:
+  // Creates a closed FdMMapWriter.
+  FdMMapWriter() noexcept {}
+
+  // Will write to the fd provided by dest, starting at the end of file.
+  //
+  // type_identity_t<Dest> disables template parameter deduction (C++17),
+  // letting FdMMapWriter(fd) mean FdMMapWriter<OwnedFd>(fd) rather than
+  // FdMMapWriter<int>(fd).
+  explicit FdMMapWriter(type_identity_t<Dest> dest,
+                        Options options = Options());
+
+  // Opens a file for writing, starting at the end of file.
+  //
+  // flags is the second argument of open, typically O_RDWR | O_CREAT | O_TRUNC.
+  //
+  // flags must include O_RDWR and must not include O_APPEND.
+  explicit FdMMapWriter(absl::string_view filename, int flags,
+                        Options options = Options());
+
+  FdMMapWriter(FdMMapWriter&& that) noexcept;
+  FdMMapWriter& operator=(FdMMapWriter&& that) noexcept;
+
+  // Returns the object providing and possibly owning the fd being written to.
+  // If the fd is owned then changed to -1 by Close(), otherwise unchanged.
+  Dest& dest() { return dest_.manager(); }
+  const Dest& dest() const { return dest_.manager(); }
+  int dest_fd() const override { return dest_.ptr(); }
+
+ protected:
+  void Done() override;
+
+ private:
+  // The object providing and possibly owning the fd being written to.
+  Dependency<int, Dest> dest_;
+};
+
 // Implementation details follow.
 
 namespace internal {
@@ -342,11 +597,15 @@ inline FdWriterCommon& FdWriterCommon::operator=(
 
 inline FdWriterBase::FdWriterBase(FdWriterBase&& that) noexcept
     : FdWriterCommon(std::move(that)),
-      sync_pos_(absl::exchange(that.sync_pos_, false)) {}
+      sync_pos_(absl::exchange(that.sync_pos_, false)),
+      preallocate_(absl::exchange(that.preallocate_, 0)),
+      preallocated_end_(absl::exchange(that.preallocated_end_, 0)) {}
 
 inline FdWriterBase& FdWriterBase::operator=(FdWriterBase&& that) noexcept {
   FdWriterCommon::operator=(std::move(that));
   sync_pos_ = absl::exchange(that.sync_pos_, false);
+  preallocate_ = absl::exchange(that.preallocate_, 0);
+  preallocated_end_ = absl::exchange(that.preallocated_end_, 0);
   return *this;
 }
 
@@ -360,9 +619,29 @@ inline FdStreamWriterBase& FdStreamWriterBase::operator=(
   return *this;
 }
 
+inline FdMMapWriterBase::FdMMapWriterBase(FdMMapWriterBase&& that) noexcept
+    : Writer(std::move(that)),
+      filename_(absl::exchange(that.filename_, std::string())),
+      error_code_(absl::exchange(that.error_code_, 0)),
+      min_growth_(absl::exchange(that.min_growth_, 0)),
+      mapping_size_(absl::exchange(that.mapping_size_, 0)),
+      growth_base_(absl::exchange(that.growth_base_, 0)) {}
+
+inline FdMMapWriterBase& FdMMapWriterBase::operator=(
+    FdMMapWriterBase&& that) noexcept {
+  Writer::operator=(std::move(that));
+  filename_ = absl::exchange(that.filename_, std::string());
+  error_code_ = absl::exchange(that.error_code_, 0);
+  min_growth_ = absl::exchange(that.min_growth_, 0);
+  mapping_size_ = absl::exchange(that.mapping_size_, 0);
+  growth_base_ = absl::exchange(that.growth_base_, 0);
+  return *this;
+}
+
 template <typename Dest>
 FdWriter<Dest>::FdWriter(type_identity_t<Dest> dest, Options options)
-    : FdWriterBase(options.buffer_size_, options.sync_pos_),
+    : FdWriterBase(options.buffer_size_, options.sync_pos_,
+                   options.preallocate_),
       dest_(std::move(dest)) {
   RIEGELI_ASSERT_GE(dest_.ptr(), 0)
       << "Failed precondition of FdWriter<Dest>::FdWriter(Dest): "
@@ -373,7 +652,8 @@ FdWriter<Dest>::FdWriter(type_identity_t<Dest> dest, Options options)
 
 template <typename Dest>
 FdWriter<Dest>::FdWriter(absl::string_view filename, int flags, Options options)
-    : FdWriterBase(options.buffer_size_, options.sync_pos_) {
+    : FdWriterBase(options.buffer_size_, options.sync_pos_,
+                   options.preallocate_) {
   RIEGELI_ASSERT((flags & O_ACCMODE) == O_WRONLY ||
                  (flags & O_ACCMODE) == O_RDWR)
       << "Failed precondition of FdWriter::FdWriter(string_view): "
@@ -468,10 +748,63 @@ void FdStreamWriter<Dest>::Done() {
   }
 }
 
+template <typename Dest>
+FdMMapWriter<Dest>::FdMMapWriter(type_identity_t<Dest> dest, Options options)
+    : FdMMapWriterBase(options.min_growth_), dest_(std::move(dest)) {
+  RIEGELI_ASSERT_GE(dest_.ptr(), 0)
+      << "Failed precondition of FdMMapWriter<Dest>::FdMMapWriter(Dest): "
+         "negative file descriptor";
+  SetFilename(dest_.ptr());
+  Initialize(dest_.ptr());
+}
+
+template <typename Dest>
+FdMMapWriter<Dest>::FdMMapWriter(absl::string_view filename, int flags,
+                                 Options options)
+    : FdMMapWriterBase(options.min_growth_) {
+  RIEGELI_ASSERT((flags & O_ACCMODE) == O_RDWR)
+      << "Failed precondition of FdMMapWriter::FdMMapWriter(string_view): "
+         "flags must include O_RDWR";
+  RIEGELI_ASSERT((flags & O_APPEND) == 0)
+      << "Failed precondition of FdMMapWriter::FdMMapWriter(string_view): "
+         "flags must not include O_APPEND";
+  const int dest = OpenFd(filename, flags, options.permissions_);
+  if (ABSL_PREDICT_TRUE(dest >= 0)) {
+    dest_ = Dependency<int, Dest>(Dest(dest));
+    Initialize(dest_.ptr());
+  }
+}
+
+template <typename Dest>
+inline FdMMapWriter<Dest>::FdMMapWriter(FdMMapWriter&& that) noexcept
+    : FdMMapWriterBase(std::move(that)), dest_(std::move(that.dest_)) {}
+
+template <typename Dest>
+inline FdMMapWriter<Dest>& FdMMapWriter<Dest>::operator=(
+    FdMMapWriter&& that) noexcept {
+  FdMMapWriterBase::operator=(std::move(that));
+  dest_ = std::move(that.dest_);
+  return *this;
+}
+
+template <typename Dest>
+void FdMMapWriter<Dest>::Done() {
+  FdMMapWriterBase::Done();
+  if (dest_.kIsOwning() && dest_.ptr() >= 0) {
+    const int dest = dest_.Release();
+    if (ABSL_PREDICT_FALSE(internal::CloseFd(dest) < 0) &&
+        ABSL_PREDICT_TRUE(healthy())) {
+      FailOperation(internal::CloseFunctionName());
+    }
+  }
+}
+
 extern template class FdWriter<OwnedFd>;
 extern template class FdWriter<int>;
 extern template class FdStreamWriter<OwnedFd>;
 extern template class FdStreamWriter<int>;
+extern template class FdMMapWriter<OwnedFd>;
+extern template class FdMMapWriter<int>;
 
 }  // namespace riegeli
 
@@ -0,0 +1,119 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/lz4_reader.h"
+
+#include <stddef.h>
+#include <limits>
+#include <memory>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/str_cat.h"
+#include "lz4frame.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/buffered_reader.h"
+#include "riegeli/bytes/reader.h"
+
+namespace riegeli {
+
+void Lz4ReaderBase::Initialize() {
+  // A LZ4F_dctx used earlier is reused if possible.
+  decompressor_ = DctxPool::global().Get(
+      []() -> std::unique_ptr<LZ4F_dctx, LZ4F_dctxDeleter> {
+        LZ4F_dctx* decompressor;
+        if (ABSL_PREDICT_FALSE(LZ4F_isError(LZ4F_createDecompressionContext(
+                &decompressor, LZ4F_VERSION)))) {
+          return nullptr;
+        }
+        return std::unique_ptr<LZ4F_dctx, LZ4F_dctxDeleter>(decompressor);
+      });
+  if (ABSL_PREDICT_FALSE(decompressor_ == nullptr)) {
+    Fail("LZ4F_createDecompressionContext() failed");
+    return;
+  }
+  // A reused LZ4F_dctx may have been abandoned in the middle of a frame.
+  LZ4F_resetDecompressionContext(decompressor_.get());
+}
+
+void Lz4ReaderBase::Done() {
+  if (ABSL_PREDICT_FALSE(truncated_)) Fail("Truncated LZ4-compressed stream");
+  decompressor_.reset();
+  BufferedReader::Done();
+}
+
+bool Lz4ReaderBase::PullSlow() {
+  RIEGELI_ASSERT_EQ(available(), 0u)
+      << "Failed precondition of Reader::PullSlow(): "
+         "data available, use Pull() instead";
+  // After all data have been decompressed, skip BufferedReader::PullSlow()
+  // to avoid allocating the buffer in case it was not allocated yet.
+  if (ABSL_PREDICT_FALSE(decompressor_ == nullptr)) return false;
+  return BufferedReader::PullSlow();
+}
+
+bool Lz4ReaderBase::ReadInternal(char* dest, size_t min_length,
+                                 size_t max_length) {
+  RIEGELI_ASSERT_GT(min_length, 0u)
+      << "Failed precondition of BufferedReader::ReadInternal(): "
+         "nothing to read";
+  RIEGELI_ASSERT_GE(max_length, min_length)
+      << "Failed precondition of BufferedReader::ReadInternal(): "
+         "max_length < min_length";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of BufferedReader::ReadInternal(): " << message();
+  if (ABSL_PREDICT_FALSE(decompressor_ == nullptr)) return false;
+  Reader* const src = src_reader();
+  truncated_ = false;
+  if (ABSL_PREDICT_FALSE(max_length >
+                         std::numeric_limits<Position>::max() - limit_pos_)) {
+    return FailOverflow();
+  }
+  size_t length_read = 0;
+  for (;;) {
+    size_t output_length = max_length - length_read;
+    size_t input_length = src->available();
+    const size_t result =
+        LZ4F_decompress(decompressor_.get(), dest + length_read,
+                        &output_length, src->cursor(), &input_length, nullptr);
+    src->set_cursor(src->cursor() + input_length);
+    length_read += output_length;
+    if (ABSL_PREDICT_FALSE(result == 0)) {
+      decompressor_.reset();
+      limit_pos_ += length_read;
+      return length_read >= min_length;
+    }
+    if (ABSL_PREDICT_FALSE(LZ4F_isError(result))) {
+      Fail(absl::StrCat("LZ4F_decompress() failed: ",
+                        LZ4F_getErrorName(result)));
+      limit_pos_ += length_read;
+      return length_read >= min_length;
+    }
+    if (length_read >= min_length) {
+      limit_pos_ += length_read;
+      return true;
+    }
+    if (src->available() > 0) continue;
+    if (ABSL_PREDICT_FALSE(!src->Pull())) {
+      limit_pos_ += length_read;
+      if (ABSL_PREDICT_FALSE(!src->healthy())) return Fail(*src);
+      truncated_ = true;
+      return false;
+    }
+  }
+}
+
+template class Lz4Reader<Reader*>;
+template class Lz4Reader<std::unique_ptr<Reader>>;
+
+}  // namespace riegeli
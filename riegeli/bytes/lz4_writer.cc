@@ -0,0 +1,199 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/lz4_writer.h"
+
+#include <stddef.h>
+#include <limits>
+#include <memory>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "lz4frame.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/buffer.h"
+#include "riegeli/bytes/buffered_writer.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+namespace {
+
+// The size of LZ4 blocks, and the maximum length of data passed to a single
+// LZ4F_compressUpdate() call, which bounds the size of compressed_buffer_.
+//
+// LZ4 looks back at most 64KB, and consecutive blocks are linked, so larger
+// blocks would not improve compression density.
+constexpr LZ4F_blockSizeID_t kBlockSizeId = LZ4F_max64KB;
+constexpr size_t kMaxUpdateLength = size_t{64} << 10;
+
+}  // namespace
+
+Lz4WriterBase::Lz4WriterBase(int compression_level,
+                             size_t buffer_size) noexcept
+    : BufferedWriter(buffer_size) {
+  preferences_.frameInfo.blockSizeID = kBlockSizeId;
+  preferences_.frameInfo.blockMode = LZ4F_blockLinked;
+  preferences_.compressionLevel = compression_level;
+  compressed_buffer_ = internal::Buffer(
+      LZ4F_compressBound(kMaxUpdateLength, &preferences_));
+  RIEGELI_ASSERT_GE(compressed_buffer_.size(), size_t{LZ4F_HEADER_SIZE_MAX})
+      << "LZ4F_compressBound() smaller than the frame header";
+}
+
+void Lz4WriterBase::Done() {
+  if (ABSL_PREDICT_TRUE(PushInternal())) {
+    Writer* const dest = dest_writer();
+    RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+        << "BufferedWriter::PushInternal() did not empty the buffer";
+    if (ABSL_PREDICT_TRUE(EnsureFrameStarted())) {
+      CompressToDest(
+          LZ4F_compressBound(0, &preferences_),
+          [&](char* dest_buffer, size_t dest_size) {
+            return LZ4F_compressEnd(compressor_.get(), dest_buffer, dest_size,
+                                    nullptr);
+          },
+          "LZ4F_compressEnd()", dest);
+    }
+  }
+  // Return compressor_ to the pool, where another Lz4Writer can reuse it.
+  compressor_.reset();
+  compressed_buffer_ = internal::Buffer();
+  BufferedWriter::Done();
+}
+
+inline bool Lz4WriterBase::EnsureFrameStarted() {
+  if (ABSL_PREDICT_FALSE(compressor_ == nullptr)) {
+    // Creating a LZ4F_cctx allocates large tables, so a LZ4F_cctx used earlier
+    // is reused if possible. LZ4F_compressBegin() resets its state.
+    compressor_ = CctxPool::global().Get(
+        []() -> std::unique_ptr<LZ4F_cctx, LZ4F_cctxDeleter> {
+          LZ4F_cctx* compressor;
+          if (ABSL_PREDICT_FALSE(LZ4F_isError(LZ4F_createCompressionContext(
+                  &compressor, LZ4F_VERSION)))) {
+            return nullptr;
+          }
+          return std::unique_ptr<LZ4F_cctx, LZ4F_cctxDeleter>(compressor);
+        });
+    if (ABSL_PREDICT_FALSE(compressor_ == nullptr)) {
+      return Fail("LZ4F_createCompressionContext() failed");
+    }
+    return CompressToDest(
+        LZ4F_HEADER_SIZE_MAX,
+        [&](char* dest_buffer, size_t dest_size) {
+          return LZ4F_compressBegin(compressor_.get(), dest_buffer, dest_size,
+                                    &preferences_);
+        },
+        "LZ4F_compressBegin()", dest_writer());
+  }
+  return true;
+}
+
+bool Lz4WriterBase::WriteInternal(absl::string_view src) {
+  RIEGELI_ASSERT(!src.empty())
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+         "nothing to write";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+      << message();
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+         "buffer not empty";
+  Writer* const dest = dest_writer();
+  if (ABSL_PREDICT_FALSE(src.size() >
+                         std::numeric_limits<Position>::max() - limit_pos())) {
+    limit_ = start_;
+    return FailOverflow();
+  }
+  if (ABSL_PREDICT_FALSE(!EnsureFrameStarted())) return false;
+  do {
+    const absl::string_view fragment =
+        src.substr(0, UnsignedMin(src.size(), kMaxUpdateLength));
+    if (ABSL_PREDICT_FALSE(!CompressToDest(
+            LZ4F_compressBound(fragment.size(), &preferences_),
+            [&](char* dest_buffer, size_t dest_size) {
+              return LZ4F_compressUpdate(compressor_.get(), dest_buffer,
+                                         dest_size, fragment.data(),
+                                         fragment.size(), nullptr);
+            },
+            "LZ4F_compressUpdate()", dest))) {
+      return false;
+    }
+    start_pos_ += fragment.size();
+    src.remove_prefix(fragment.size());
+  } while (!src.empty());
+  return true;
+}
+
+bool Lz4WriterBase::Flush(FlushType flush_type) {
+  if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
+  Writer* const dest = dest_writer();
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "BufferedWriter::PushInternal() did not empty the buffer";
+  if (ABSL_PREDICT_FALSE(!EnsureFrameStarted())) return false;
+  if (ABSL_PREDICT_FALSE(!CompressToDest(
+          LZ4F_compressBound(0, &preferences_),
+          [&](char* dest_buffer, size_t dest_size) {
+            return LZ4F_flush(compressor_.get(), dest_buffer, dest_size,
+                              nullptr);
+          },
+          "LZ4F_flush()", dest))) {
+    return false;
+  }
+  if (ABSL_PREDICT_FALSE(!dest->Flush(flush_type))) {
+    if (ABSL_PREDICT_FALSE(!dest->healthy())) {
+      limit_ = start_;
+      return Fail(*dest);
+    }
+    return false;
+  }
+  return true;
+}
+
+template <typename Function>
+bool Lz4WriterBase::CompressToDest(size_t max_length, Function function,
+                                   absl::string_view function_name,
+                                   Writer* dest) {
+  RIEGELI_ASSERT_LE(max_length, compressed_buffer_.size())
+      << "Failed precondition of Lz4WriterBase::CompressToDest(): "
+         "compressed length not bounded by compressed_buffer_";
+  if (dest->available() >= max_length) {
+    const size_t result = function(dest->cursor(), dest->available());
+    if (ABSL_PREDICT_FALSE(LZ4F_isError(result))) {
+      limit_ = start_;
+      return Fail(absl::StrCat(function_name,
+                               " failed: ", LZ4F_getErrorName(result)));
+    }
+    dest->set_cursor(dest->cursor() + result);
+    return true;
+  }
+  char* const buffer = compressed_buffer_.GetData();
+  const size_t result = function(buffer, compressed_buffer_.size());
+  if (ABSL_PREDICT_FALSE(LZ4F_isError(result))) {
+    limit_ = start_;
+    return Fail(
+        absl::StrCat(function_name, " failed: ", LZ4F_getErrorName(result)));
+  }
+  if (ABSL_PREDICT_FALSE(!dest->Write(absl::string_view(buffer, result)))) {
+    limit_ = start_;
+    return Fail(*dest);
+  }
+  return true;
+}
+
+template class Lz4Writer<Writer*>;
+template class Lz4Writer<std::unique_ptr<Writer>>;
+
+}  // namespace riegeli
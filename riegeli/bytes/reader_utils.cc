@@ -16,6 +16,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <cstring>
 #include <string>
 #include <utility>
 
@@ -23,6 +24,7 @@
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/endian.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/writer.h"
@@ -169,6 +171,50 @@ char* CopyVarint64Slow(Reader* src, char* dest) {
 
 }  // namespace internal
 
+size_t ReadVarints64(const char** src, const char* limit, size_t n,
+                     uint64_t* data) {
+  // Bit 7 of every byte, i.e. continuation bits if bytes belong to varints.
+  constexpr uint64_t kHighBits = 0x8080808080808080;
+  const char* cursor = *src;
+  size_t num_read = 0;
+  while (num_read < n &&
+         PtrDistance(cursor, limit) >= size_t{kMaxLengthVarint64()}) {
+    uint64_t word;
+    std::memcpy(&word, cursor, sizeof(word));
+    word = ReadLittleEndian64(word);
+    if ((word & kHighBits) == 0 && n - num_read >= 8) {
+      // Eight single-byte varints.
+      for (int i = 0; i < 8; ++i) {
+        data[num_read + i] = (word >> (i * 8)) & 0xff;
+      }
+      cursor += 8;
+      num_read += 8;
+      continue;
+    }
+    const char* next = cursor;
+    if (ABSL_PREDICT_FALSE(!ReadVarint64(&next, &data[num_read]))) break;
+    cursor = next;
+    ++num_read;
+  }
+  *src = cursor;
+  return num_read;
+}
+
+bool ReadVarints64(Reader* src, size_t n, uint64_t* data) {
+  for (;;) {
+    const char* cursor = src->cursor();
+    const size_t num_read = ReadVarints64(&cursor, src->limit(), n, data);
+    src->set_cursor(cursor);
+    data += num_read;
+    n -= num_read;
+    if (n == 0) return true;
+    // The next varint is near the end of the buffer or invalid.
+    if (ABSL_PREDICT_FALSE(!ReadVarint64(src, data))) return false;
+    ++data;
+    --n;
+  }
+}
+
 bool ReadAll(Reader* src, absl::string_view* dest, std::string* scratch) {
   if (src->SupportsRandomAccess()) {
     Position size;
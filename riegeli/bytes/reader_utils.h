@@ -15,6 +15,7 @@
 #ifndef RIEGELI_BYTES_READER_UTILS_H_
 #define RIEGELI_BYTES_READER_UTILS_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <string>
 
@@ -46,6 +47,23 @@ bool ReadVarint64(const char** src, uint64_t* data);
 bool ReadVarint32(Reader* src, uint32_t* data);
 bool ReadVarint64(Reader* src, uint64_t* data);
 
+// Reads up to n varints from src[] to data[], stopping early at a varint which
+// is invalid or which could extend to less than kMaxLengthVarint64() bytes
+// before limit. Returns the number of varints read, with *src pointing after
+// them.
+//
+// This is faster than calling ReadVarint64() for each varint: runs of
+// single-byte varints are decoded 8 bytes at a time.
+size_t ReadVarints64(const char** src, const char* limit, size_t n,
+                     uint64_t* data);
+
+// Reads n varints to data[].
+//
+// Return values:
+//  * true  - success
+//  * false - failure (an unspecified number of varints were read)
+bool ReadVarints64(Reader* src, size_t n, uint64_t* data);
+
 // Returns the updated dest after the copied value, or nullptr on failure.
 // At least kMaxLengthVarint32() bytes of space at dest[] must be available.
 char* CopyVarint32(Reader* src, char* dest);
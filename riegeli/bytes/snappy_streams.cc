@@ -0,0 +1,164 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/snappy_streams.h"
+
+#include <stddef.h>
+#include <limits>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/writer.h"
+#include "snappy-sinksource.h"
+
+namespace riegeli {
+namespace internal {
+
+ChainSnappySource::ChainSnappySource(const Chain* src)
+    : iter_(RIEGELI_ASSERT_NOTNULL(src)->blocks().cbegin()),
+      end_(src->blocks().cend()),
+      available_(src->size()) {}
+
+size_t ChainSnappySource::Available() const { return available_; }
+
+const char* ChainSnappySource::Peek(size_t* length) {
+  if (ABSL_PREDICT_FALSE(iter_ == end_)) {
+    *length = 0;
+    return nullptr;
+  }
+  *length = iter_->size() - block_pos_;
+  return iter_->data() + block_pos_;
+}
+
+void ChainSnappySource::Skip(size_t length) {
+  RIEGELI_ASSERT_LE(length, available_)
+      << "Failed precondition of snappy::Source::Skip(): "
+         "length out of range";
+  available_ -= length;
+  while (length > 0) {
+    RIEGELI_ASSERT(iter_ != end_)
+        << "Failed invariant of ChainSnappySource: "
+           "Chain ended before available_";
+    const size_t length_in_block =
+        UnsignedMin(length, iter_->size() - block_pos_);
+    block_pos_ += length_in_block;
+    length -= length_in_block;
+    if (block_pos_ == iter_->size()) {
+      ++iter_;
+      block_pos_ = 0;
+    }
+  }
+}
+
+ReaderSnappySource::ReaderSnappySource(Reader* src, Position size)
+    : src_(RIEGELI_ASSERT_NOTNULL(src)), size_(size) {}
+
+size_t ReaderSnappySource::Available() const {
+  return UnsignedMin(size_, std::numeric_limits<size_t>::max());
+}
+
+const char* ReaderSnappySource::Peek(size_t* length) {
+  if (ABSL_PREDICT_FALSE(!src_->Pull())) {
+    *length = 0;
+    return nullptr;
+  }
+  *length = src_->available();
+  return src_->cursor();
+}
+
+void ReaderSnappySource::Skip(size_t length) {
+  RIEGELI_ASSERT_LE(length, src_->available())
+      << "Failed precondition of snappy::Source::Skip(): "
+         "length out of range";
+  src_->set_cursor(src_->cursor() + length);
+  size_ -= UnsignedMin(length, size_);
+}
+
+ChainSnappySink::ChainSnappySink(Chain* dest, size_t size_hint)
+    : dest_(RIEGELI_ASSERT_NOTNULL(dest)), size_hint_(size_hint) {}
+
+void ChainSnappySink::Append(const char* src, size_t length) {
+  if (buffer_ != nullptr) {
+    if (src == buffer_) {
+      // The data were written to the buffer in place. Trim what was unused.
+      RIEGELI_ASSERT_LE(length, buffer_size_)
+          << "Failed precondition of snappy::Sink::Append(): "
+             "length exceeds the buffer";
+      dest_->RemoveSuffix(buffer_size_ - length);
+      buffer_ = nullptr;
+      return;
+    }
+    // The buffer was not used after all.
+    dest_->RemoveSuffix(buffer_size_);
+    buffer_ = nullptr;
+  }
+  dest_->Append(absl::string_view(src, length), size_hint_);
+}
+
+char* ChainSnappySink::GetAppendBuffer(size_t length, char* scratch) {
+  size_t allocated_length;
+  return GetAppendBufferVariable(length, length, scratch, length,
+                                 &allocated_length);
+}
+
+char* ChainSnappySink::GetAppendBufferVariable(size_t min_length,
+                                               size_t recommended_length,
+                                               char* scratch,
+                                               size_t scratch_length,
+                                               size_t* allocated_length) {
+  if (buffer_ != nullptr) {
+    dest_->RemoveSuffix(buffer_size_);
+    buffer_ = nullptr;
+  }
+  // When decompressing, Snappy asks for the whole decompressed data at once.
+  // If they fit in size_hint_, require a single block for them, so that they
+  // are decompressed in place instead of through Snappy's scattered writer.
+  if (recommended_length <=
+      size_hint_ - UnsignedMin(dest_->size(), size_hint_)) {
+    min_length = UnsignedMax(min_length, recommended_length);
+  }
+  const absl::Span<char> buffer =
+      dest_->AppendBuffer(min_length, recommended_length, size_hint_);
+  buffer_ = buffer.data();
+  buffer_size_ = buffer.size();
+  *allocated_length = buffer.size();
+  return buffer.data();
+}
+
+void WriterSnappySink::Append(const char* src, size_t length) {
+  if (src == dest_->cursor()) {
+    // The data were written to the buffer in place.
+    RIEGELI_ASSERT_LE(length, dest_->available())
+        << "Failed precondition of snappy::Sink::Append(): "
+           "length exceeds the buffer";
+    dest_->set_cursor(dest_->cursor() + length);
+    return;
+  }
+  dest_->Write(absl::string_view(src, length));
+}
+
+char* WriterSnappySink::GetAppendBuffer(size_t length, char* scratch) {
+  if (ABSL_PREDICT_TRUE(dest_->available() >= length) ||
+      (dest_->Push() && dest_->available() >= length)) {
+    return dest_->cursor();
+  }
+  return scratch;
+}
+
+}  // namespace internal
+}  // namespace riegeli
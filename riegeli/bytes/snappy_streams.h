@@ -0,0 +1,129 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_SNAPPY_STREAMS_H_
+#define RIEGELI_BYTES_SNAPPY_STREAMS_H_
+
+#include <stddef.h>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/writer.h"
+#include "snappy-sinksource.h"
+
+namespace riegeli {
+namespace internal {
+
+// Adapters between Riegeli byte containers and Snappy streams.
+//
+// Snappy compresses and decompresses a whole stream at once, reading it from a
+// snappy::Source and writing it to a snappy::Sink. These adapters let Snappy
+// read and write Riegeli data in place, without an intermediate flat copy.
+
+// A snappy::Source which reads from a Chain.
+//
+// The Chain must not be changed while the ChainSnappySource is used.
+class ChainSnappySource : public snappy::Source {
+ public:
+  explicit ChainSnappySource(const Chain* src);
+
+  ChainSnappySource(const ChainSnappySource&) = delete;
+  ChainSnappySource& operator=(const ChainSnappySource&) = delete;
+
+  size_t Available() const override;
+  const char* Peek(size_t* length) override;
+  void Skip(size_t length) override;
+
+ private:
+  Chain::BlockIterator iter_;
+  Chain::BlockIterator end_;
+  // Position in *iter_.
+  size_t block_pos_ = 0;
+  size_t available_;
+};
+
+// A snappy::Source which reads from a Reader until its end.
+//
+// size must be the number of bytes remaining in *src. Snappy uses it only as
+// an estimate when decompressing, but it must be exact when compressing.
+//
+// Check src->healthy() afterwards to distinguish the end of data from failure.
+class ReaderSnappySource : public snappy::Source {
+ public:
+  explicit ReaderSnappySource(Reader* src, Position size);
+
+  ReaderSnappySource(const ReaderSnappySource&) = delete;
+  ReaderSnappySource& operator=(const ReaderSnappySource&) = delete;
+
+  size_t Available() const override;
+  const char* Peek(size_t* length) override;
+  void Skip(size_t length) override;
+
+ private:
+  Reader* src_;
+  Position size_;
+};
+
+// A snappy::Sink which appends to a Chain.
+//
+// size_hint announces the intended total size of the Chain, normally the
+// uncompressed size. If it is exact, the data are decompressed straight into a
+// single Chain block of that size. Larger sizes announced by Snappy are not
+// allocated upfront, which limits the damage of corrupted data.
+class ChainSnappySink : public snappy::Sink {
+ public:
+  explicit ChainSnappySink(Chain* dest, size_t size_hint = 0);
+
+  ChainSnappySink(const ChainSnappySink&) = delete;
+  ChainSnappySink& operator=(const ChainSnappySink&) = delete;
+
+  void Append(const char* src, size_t length) override;
+  char* GetAppendBuffer(size_t length, char* scratch) override;
+  char* GetAppendBufferVariable(size_t min_length, size_t recommended_length,
+                                char* scratch, size_t scratch_length,
+                                size_t* allocated_length) override;
+
+ private:
+  Chain* dest_;
+  size_t size_hint_;
+  // If not nullptr, the buffer last returned by GetAppendBuffer() or
+  // GetAppendBufferVariable(), of size buffer_size_. It has been appended to
+  // *dest_ and ends at the end of *dest_. Append() trims its unused suffix.
+  char* buffer_ = nullptr;
+  size_t buffer_size_ = 0;
+};
+
+// A snappy::Sink which writes to a Writer.
+//
+// Check dest->healthy() afterwards to detect failure.
+class WriterSnappySink : public snappy::Sink {
+ public:
+  explicit WriterSnappySink(Writer* dest)
+      : dest_(RIEGELI_ASSERT_NOTNULL(dest)) {}
+
+  WriterSnappySink(const WriterSnappySink&) = delete;
+  WriterSnappySink& operator=(const WriterSnappySink&) = delete;
+
+  void Append(const char* src, size_t length) override;
+  char* GetAppendBuffer(size_t length, char* scratch) override;
+
+ private:
+  Writer* dest_;
+};
+
+}  // namespace internal
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_SNAPPY_STREAMS_H_
@@ -21,6 +21,7 @@
 #include "absl/base/optimization.h"
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/endian.h"
 #include "riegeli/bytes/writer.h"
 
 namespace riegeli {
@@ -61,4 +62,47 @@ bool WriteZerosSlow(Writer* dest, Position length) {
 }
 
 }  // namespace internal
+
+bool WriteVarints64(Writer* dest, const uint64_t* data, size_t n) {
+  for (;;) {
+    char* cursor = dest->cursor();
+    size_t num_written = 0;
+    // Values are written in groups of 8 while there is space for the longest
+    // varints, then one by one.
+    while (n - num_written >= 8 && PtrDistance(cursor, dest->limit()) >=
+                                       8 * size_t{kMaxLengthVarint64()}) {
+      uint64_t any_bits = 0;
+      for (int i = 0; i < 8; ++i) any_bits |= data[num_written + i];
+      if (any_bits < 0x80) {
+        // Eight single-byte varints.
+        uint64_t word = 0;
+        for (int i = 0; i < 8; ++i) {
+          word |= data[num_written + i] << (i * 8);
+        }
+        word = WriteLittleEndian64(word);
+        std::memcpy(cursor, &word, sizeof(word));
+        cursor += 8;
+      } else {
+        for (int i = 0; i < 8; ++i) {
+          cursor = WriteVarint64(cursor, data[num_written + i]);
+        }
+      }
+      num_written += 8;
+    }
+    while (num_written < n &&
+           PtrDistance(cursor, dest->limit()) >= size_t{kMaxLengthVarint64()}) {
+      cursor = WriteVarint64(cursor, data[num_written]);
+      ++num_written;
+    }
+    dest->set_cursor(cursor);
+    data += num_written;
+    n -= num_written;
+    if (n == 0) return true;
+    // The next varint might not fit in the buffer.
+    if (ABSL_PREDICT_FALSE(!WriteVarint64(dest, *data))) return false;
+    ++data;
+    --n;
+  }
+}
+
 }  // namespace riegeli
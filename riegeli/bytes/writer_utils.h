@@ -40,6 +40,12 @@ char* WriteVarint64(char* dest, uint64_t data);
 bool WriteVarint32(Writer* dest, uint32_t data);
 bool WriteVarint64(Writer* dest, uint64_t data);
 
+// Writes n varints from data[].
+//
+// This is faster than calling WriteVarint64() for each value: runs of values
+// smaller than 0x80 are written 8 bytes at a time.
+bool WriteVarints64(Writer* dest, const uint64_t* data, size_t n);
+
 bool WriteZeros(Writer* dest, Position length);
 
 // Implementation details follow.
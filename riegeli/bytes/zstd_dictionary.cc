@@ -0,0 +1,102 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Make ZSTD_createCDict_advanced(), ZSTD_createDDict_byReference(), and
+// ZSTD_getCParams() available.
+#define ZSTD_STATIC_LINKING_ONLY
+
+#include "riegeli/bytes/zstd_dictionary.h"
+
+#include <stddef.h>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/call_once.h"
+#include "absl/base/optimization.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
+#include "zdict.h"
+#include "zstd.h"
+
+namespace riegeli {
+
+const ZSTD_CDict* ZstdDictionary::PrepareCompressionDictionary(
+    int compression_level, int window_log) const {
+  absl::MutexLock lock(&mutex_);
+  for (const CompressionDictionary& dictionary : compression_dictionaries_) {
+    if (dictionary.compression_level == compression_level &&
+        dictionary.window_log == window_log) {
+      return dictionary.cdict.get();
+    }
+  }
+  ZSTD_compressionParameters params =
+      ZSTD_getCParams(compression_level, 0, data_.size());
+  if (window_log >= 0) params.windowLog = IntCast<unsigned>(window_log);
+  // data_ is never modified and outlives the ZSTD_CDict, so it is not copied.
+  std::unique_ptr<ZSTD_CDict, ZSTD_CDictDeleter> cdict(
+      ZSTD_createCDict_advanced(data_.data(), data_.size(), ZSTD_dlm_byRef,
+                                ZSTD_dct_auto, params, ZSTD_defaultCMem));
+  if (ABSL_PREDICT_FALSE(cdict == nullptr)) return nullptr;
+  compression_dictionaries_.push_back(
+      CompressionDictionary{compression_level, window_log, std::move(cdict)});
+  return compression_dictionaries_.back().cdict.get();
+}
+
+const ZSTD_DDict* ZstdDictionary::PrepareDecompressionDictionary() const {
+  absl::call_once(decompression_dictionary_once_,
+                  &ZstdDictionary::CreateDecompressionDictionary, this);
+  return decompression_dictionary_.get();
+}
+
+void ZstdDictionary::CreateDecompressionDictionary() const {
+  // data_ is never modified and outlives the ZSTD_DDict, so it is not copied.
+  decompression_dictionary_.reset(
+      ZSTD_createDDict_byReference(data_.data(), data_.size()));
+}
+
+bool TrainZstdDictionary(absl::Span<const std::string> samples, size_t max_size,
+                         std::string* dictionary, std::string* error_message) {
+  if (ABSL_PREDICT_FALSE(samples.size() >
+                         std::numeric_limits<unsigned>::max())) {
+    if (error_message != nullptr) *error_message = "Too many samples";
+    return false;
+  }
+  std::string concatenated_samples;
+  std::vector<size_t> sample_sizes;
+  sample_sizes.reserve(samples.size());
+  for (const std::string& sample : samples) {
+    concatenated_samples.append(sample);
+    sample_sizes.push_back(sample.size());
+  }
+  dictionary->resize(max_size);
+  const size_t result = ZDICT_trainFromBuffer(
+      &(*dictionary)[0], dictionary->size(), concatenated_samples.data(),
+      sample_sizes.data(), IntCast<unsigned>(sample_sizes.size()));
+  if (ABSL_PREDICT_FALSE(ZDICT_isError(result))) {
+    dictionary->clear();
+    if (error_message != nullptr) {
+      *error_message = absl::StrCat("ZDICT_trainFromBuffer() failed: ",
+                                    ZDICT_getErrorName(result));
+    }
+    return false;
+  }
+  dictionary->resize(result);
+  return true;
+}
+
+}  // namespace riegeli
@@ -0,0 +1,114 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_ZSTD_DICTIONARY_H_
+#define RIEGELI_BYTES_ZSTD_DICTIONARY_H_
+
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/call_once.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "zstd.h"
+
+namespace riegeli {
+
+// A Zstd dictionary: data shared by the compressor and the decompressor, which
+// improves compression density of small streams resembling it, e.g. of many
+// small records of the same type.
+//
+// The data are either a dictionary in the Zstd format, e.g. produced by
+// TrainZstdDictionary(), or raw content to be used as a prefix.
+//
+// Structures prepared from the data for compression and decompression are
+// expensive to create, so they are created lazily and kept in the
+// ZstdDictionary. A ZstdDictionary should thus be shared, with std::shared_ptr,
+// by all ZstdWriters and ZstdReaders using the same dictionary.
+//
+// ZstdDictionary is thread-safe.
+class ZstdDictionary {
+ public:
+  explicit ZstdDictionary(std::string data) noexcept : data_(std::move(data)) {}
+
+  ZstdDictionary(const ZstdDictionary&) = delete;
+  ZstdDictionary& operator=(const ZstdDictionary&) = delete;
+
+  // Returns the dictionary data.
+  absl::string_view data() const { return data_; }
+
+  // Returns the dictionary prepared for compression with the given parameters,
+  // or nullptr on failure. It is valid as long as the ZstdDictionary.
+  //
+  // window_log is ZstdWriterBase::Options::kDefaultWindowLog() (-1) to derive
+  // it from compression_level.
+  const ZSTD_CDict* PrepareCompressionDictionary(int compression_level,
+                                                 int window_log) const;
+
+  // Returns the dictionary prepared for decompression, or nullptr on failure.
+  // It is valid as long as the ZstdDictionary.
+  const ZSTD_DDict* PrepareDecompressionDictionary() const;
+
+ private:
+  struct ZSTD_CDictDeleter {
+    void operator()(ZSTD_CDict* ptr) const { ZSTD_freeCDict(ptr); }
+  };
+
+  struct ZSTD_DDictDeleter {
+    void operator()(ZSTD_DDict* ptr) const { ZSTD_freeDDict(ptr); }
+  };
+
+  struct CompressionDictionary {
+    int compression_level;
+    int window_log;
+    std::unique_ptr<ZSTD_CDict, ZSTD_CDictDeleter> cdict;
+  };
+
+  void CreateDecompressionDictionary() const;
+
+  std::string data_;
+
+  mutable absl::Mutex mutex_;
+  // A ZstdDictionary is typically used with a single compression level, so
+  // this is searched linearly.
+  mutable std::vector<CompressionDictionary> compression_dictionaries_
+      GUARDED_BY(mutex_);
+
+  mutable absl::once_flag decompression_dictionary_once_;
+  mutable std::unique_ptr<ZSTD_DDict, ZSTD_DDictDeleter>
+      decompression_dictionary_;
+};
+
+// Trains a Zstd dictionary of at most max_size bytes from samples, which should
+// be representative of the data to be compressed, e.g. the first few thousand
+// records to be written.
+//
+// The size of the dictionary is usually chosen to be around 100 KB, and the
+// total size of samples should be around 100 times larger.
+//
+// Return values:
+//  * true  - success (*dictionary is set)
+//  * false - failure (*error_message is set)
+bool TrainZstdDictionary(absl::Span<const std::string> samples, size_t max_size,
+                         std::string* dictionary,
+                         std::string* error_message = nullptr);
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_ZSTD_DICTIONARY_H_
@@ -12,13 +12,15 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-// Make ZSTD_DCtx_setMaxWindowSize() and ZSTD_WINDOWLOG_MAX available.
+// Make ZSTD_DCtx_setMaxWindowSize(), ZSTD_initDStream_usingDDict(),
+// ZSTD_WINDOWLOG_MIN, and ZSTD_WINDOWLOG_MAX available.
 #define ZSTD_STATIC_LINKING_ONLY
 
 #include "riegeli/bytes/zstd_reader.h"
 
 #include <stddef.h>
 #include <limits>
+#include <memory>
 
 #include "absl/base/optimization.h"
 #include "absl/strings/str_cat.h"
@@ -29,13 +31,37 @@
 
 namespace riegeli {
 
+// These methods are defined here instead of in zstd_reader.h because
+// ZSTD_WINDOWLOG_{MIN,MAX} require ZSTD_STATIC_LINKING_ONLY.
+int ZstdReaderBase::Options::kMinWindowLog() { return ZSTD_WINDOWLOG_MIN; }
+int ZstdReaderBase::Options::kMaxWindowLog() { return ZSTD_WINDOWLOG_MAX; }
+
 void ZstdReaderBase::Initialize() {
-  decompressor_.reset(ZSTD_createDStream());
+  // A ZSTD_DStream used earlier is reused if possible. ZSTD_initDStream() or
+  // ZSTD_initDStream_usingDDict() resets its state.
+  decompressor_ = DStreamPool::global().Get([] {
+    return std::unique_ptr<ZSTD_DStream, ZSTD_DStreamDeleter>(
+        ZSTD_createDStream());
+  });
   if (ABSL_PREDICT_FALSE(decompressor_ == nullptr)) {
     Fail("ZSTD_createDStream() failed");
     return;
   }
-  {
+  if (dictionary_ != nullptr) {
+    const ZSTD_DDict* const ddict =
+        dictionary_->PrepareDecompressionDictionary();
+    if (ABSL_PREDICT_FALSE(ddict == nullptr)) {
+      Fail("ZSTD_createDDict_byReference() failed");
+      return;
+    }
+    const size_t result =
+        ZSTD_initDStream_usingDDict(decompressor_.get(), ddict);
+    if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
+      Fail(absl::StrCat("ZSTD_initDStream_usingDDict() failed: ",
+                        ZSTD_getErrorName(result)));
+      return;
+    }
+  } else {
     const size_t result = ZSTD_initDStream(decompressor_.get());
     if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
       Fail(absl::StrCat("ZSTD_initDStream() failed: ",
@@ -45,7 +71,7 @@ void ZstdReaderBase::Initialize() {
   }
   {
     const size_t result = ZSTD_DCtx_setMaxWindowSize(
-        decompressor_.get(), size_t{1} << ZSTD_WINDOWLOG_MAX);
+        decompressor_.get(), size_t{1} << max_window_log_);
     if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
       Fail(absl::StrCat("ZSTD_DCtx_setMaxWindowSize() failed: ",
                         ZSTD_getErrorName(result)));
@@ -23,8 +23,10 @@
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/recycling_pool.h"
 #include "riegeli/bytes/buffered_reader.h"
 #include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "zstd.h"
 
 namespace riegeli {
@@ -36,6 +38,51 @@ class ZstdReaderBase : public BufferedReader {
    public:
     Options() noexcept {}
 
+    // Zstd dictionary. It must be the same as the dictionary used for
+    // compression.
+    //
+    // A dictionary should be shared by all ZstdReaders using it, because
+    // structures prepared from it for decompression are kept in it.
+    //
+    // If nullptr, no dictionary is used.
+    //
+    // Default: nullptr
+    Options& set_dictionary(
+        std::shared_ptr<const ZstdDictionary> dictionary) & {
+      dictionary_ = std::move(dictionary);
+      return *this;
+    }
+    Options&& set_dictionary(
+        std::shared_ptr<const ZstdDictionary> dictionary) && {
+      return std::move(set_dictionary(std::move(dictionary)));
+    }
+
+    // Logarithm of the largest window size accepted in the compressed stream.
+    // Decompression needs memory proportional to the window size, so lowering
+    // this protects memory-constrained readers from streams compressed with a
+    // large window, which then fail to decompress instead.
+    //
+    // max_window_log must be between kMinWindowLog() (10) and kMaxWindowLog()
+    // (30 in 32-bit build, 31 in 64-bit build).
+    // Default: kMaxWindowLog().
+    static int kMinWindowLog();
+    static int kMaxWindowLog();
+    Options& set_max_window_log(int max_window_log) & {
+      RIEGELI_ASSERT_GE(max_window_log, kMinWindowLog())
+          << "Failed precondition of "
+             "ZstdReaderBase::Options::set_max_window_log(): "
+             "window log out of range";
+      RIEGELI_ASSERT_LE(max_window_log, kMaxWindowLog())
+          << "Failed precondition of "
+             "ZstdReaderBase::Options::set_max_window_log(): "
+             "window log out of range";
+      max_window_log_ = max_window_log;
+      return *this;
+    }
+    Options&& set_max_window_log(int max_window_log) && {
+      return std::move(set_max_window_log(max_window_log));
+    }
+
     static size_t kDefaultBufferSize() { return ZSTD_DStreamOutSize(); }
     Options& set_buffer_size(size_t buffer_size) & {
       RIEGELI_ASSERT_GT(buffer_size, 0u)
@@ -53,6 +100,8 @@ class ZstdReaderBase : public BufferedReader {
     template <typename Src>
     friend class ZstdReader;
 
+    std::shared_ptr<const ZstdDictionary> dictionary_;
+    int max_window_log_ = kMaxWindowLog();
     size_t buffer_size_ = kDefaultBufferSize();
   };
 
@@ -63,8 +112,11 @@ class ZstdReaderBase : public BufferedReader {
  protected:
   ZstdReaderBase() noexcept {}
 
-  explicit ZstdReaderBase(size_t buffer_size) noexcept
-      : BufferedReader(buffer_size) {}
+  explicit ZstdReaderBase(std::shared_ptr<const ZstdDictionary> dictionary,
+                          int max_window_log, size_t buffer_size) noexcept
+      : BufferedReader(buffer_size),
+        dictionary_(std::move(dictionary)),
+        max_window_log_(max_window_log) {}
 
   ZstdReaderBase(ZstdReaderBase&& that) noexcept;
   ZstdReaderBase& operator=(ZstdReaderBase&& that) noexcept;
@@ -79,14 +131,19 @@ class ZstdReaderBase : public BufferedReader {
     void operator()(ZSTD_DStream* ptr) const { ZSTD_freeDStream(ptr); }
   };
 
+  using DStreamPool =
+      internal::RecyclingPool<ZSTD_DStream, ZSTD_DStreamDeleter>;
+
   // If true, the source is truncated (without a clean end of the compressed
   // stream) at the current position. If the source does not grow, Close() will
   // fail.
   bool truncated_ = false;
+  std::shared_ptr<const ZstdDictionary> dictionary_;
+  int max_window_log_ = 0;
   // If healthy() but decompressor_ == nullptr then all data have been
   // decompressed. In this case ZSTD_decompressStream() must not be called
-  // again.
-  std::unique_ptr<ZSTD_DStream, ZSTD_DStreamDeleter> decompressor_;
+  // again. It is returned to the pool as soon as it is no longer needed.
+  DStreamPool::Handle decompressor_;
 };
 
 // A Reader which decompresses data with Zstd after getting it from another
@@ -132,19 +189,25 @@ class ZstdReader : public ZstdReaderBase {
 inline ZstdReaderBase::ZstdReaderBase(ZstdReaderBase&& that) noexcept
     : BufferedReader(std::move(that)),
       truncated_(absl::exchange(that.truncated_, false)),
+      dictionary_(std::move(that.dictionary_)),
+      max_window_log_(absl::exchange(that.max_window_log_, 0)),
       decompressor_(std::move(that.decompressor_)) {}
 
 inline ZstdReaderBase& ZstdReaderBase::operator=(
     ZstdReaderBase&& that) noexcept {
   BufferedReader::operator=(std::move(that));
   truncated_ = absl::exchange(that.truncated_, false);
+  dictionary_ = std::move(that.dictionary_);
+  max_window_log_ = absl::exchange(that.max_window_log_, 0);
   decompressor_ = std::move(that.decompressor_);
   return *this;
 }
 
 template <typename Src>
 ZstdReader<Src>::ZstdReader(Src src, Options options)
-    : ZstdReaderBase(options.buffer_size_), src_(std::move(src)) {
+    : ZstdReaderBase(std::move(options.dictionary_), options.max_window_log_,
+                     options.buffer_size_),
+      src_(std::move(src)) {
   RIEGELI_ASSERT(src_.ptr() != nullptr)
       << "Failed precondition of ZstdReader<Src>::ZstdReader(Src): "
          "null Reader pointer";
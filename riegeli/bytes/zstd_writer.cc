@@ -12,14 +12,17 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-// Make ZSTD_WINDOWLOG_MIN, ZSTD_WINDOWLOG_MAX, ZSTD_getParams(), and
-// ZSTD_initCStream_advanced() available.
+// Make ZSTD_WINDOWLOG_MIN, ZSTD_WINDOWLOG_MAX, ZSTD_HASHLOG_MIN,
+// ZSTD_HASHLOG_MAX, ZSTD_getParams(), ZSTD_initCStream_advanced(),
+// ZSTD_initCStream_usingCDict_advanced(), and the advanced API used with worker
+// threads and long distance matching available.
 #define ZSTD_STATIC_LINKING_ONLY
 
 #include "riegeli/bytes/zstd_writer.h"
 
 #include <stddef.h>
 #include <limits>
+#include <memory>
 
 #include "absl/base/optimization.h"
 #include "absl/strings/str_cat.h"
@@ -32,29 +35,61 @@
 namespace riegeli {
 
 // These methods are defined here instead of in zstd_writer.h because
-// ZSTD_WINDOWLOG_{MIN,MAX} require ZSTD_STATIC_LINKING_ONLY.
+// ZSTD_WINDOWLOG_{MIN,MAX} and ZSTD_HASHLOG_{MIN,MAX} require
+// ZSTD_STATIC_LINKING_ONLY.
 int ZstdWriterBase::Options::kMinWindowLog() { return ZSTD_WINDOWLOG_MIN; }
 int ZstdWriterBase::Options::kMaxWindowLog() { return ZSTD_WINDOWLOG_MAX; }
+int ZstdWriterBase::Options::kMinLdmHashLog() { return ZSTD_HASHLOG_MIN; }
+int ZstdWriterBase::Options::kMaxLdmHashLog() { return ZSTD_HASHLOG_MAX; }
+
+namespace {
+
+struct ZSTD_CCtx_paramsDeleter {
+  void operator()(ZSTD_CCtx_params* ptr) const { ZSTD_freeCCtxParams(ptr); }
+};
+
+// ZSTD_compress_generic() with no input, for flushing.
+template <ZSTD_EndDirective end_op>
+size_t CompressGenericFlush(ZSTD_CStream* cstream, ZSTD_outBuffer* output) {
+  ZSTD_inBuffer input = {nullptr, 0, 0};
+  return ZSTD_compress_generic(cstream, output, &input, end_op);
+}
+
+}  // namespace
 
 void ZstdWriterBase::Done() {
   if (ABSL_PREDICT_TRUE(PushInternal())) {
     Writer* const dest = dest_writer();
     RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
         << "BufferedWriter::PushInternal() did not empty the buffer";
-    FlushInternal(ZSTD_endStream, "ZSTD_endStream()", dest);
+    if (UseAdvancedApi()) {
+      FlushInternal(CompressGenericFlush<ZSTD_e_end>,
+                    "ZSTD_compress_generic(ZSTD_e_end)", dest);
+    } else {
+      FlushInternal(ZSTD_endStream, "ZSTD_endStream()", dest);
+    }
   }
-  // Do not reset compressor_. It might be reused if a fresh ZstdWriter is
-  // assigned to *this.
+  // Return compressor_ to the pool, where another ZstdWriter can reuse it.
+  compressor_.reset();
   BufferedWriter::Done();
 }
 
 inline bool ZstdWriterBase::EnsureCStreamCreated() {
   if (ABSL_PREDICT_FALSE(compressor_ == nullptr)) {
-    compressor_.reset(ZSTD_createCStream());
+    // Creating a ZSTD_CStream is expensive, especially for high compression
+    // levels, so a ZSTD_CStream used earlier with the same parameters is
+    // reused if possible. InitializeCStream() resets its state.
+    compressor_ = CStreamPool::global().Get(
+        ZSTD_CStreamKey{compression_level_, window_log_,
+                        long_distance_matching_, ldm_hash_log_, workers_},
+        [] {
+          return std::unique_ptr<ZSTD_CStream, ZSTD_CStreamDeleter>(
+              ZSTD_createCStream());
+        });
     if (ABSL_PREDICT_FALSE(compressor_ == nullptr)) {
       return Fail("ZSTD_createCStream() failed");
     }
-    return InitializeCStream();
+    return UseAdvancedApi() ? InitializeCStreamAdvanced() : InitializeCStream();
   }
   return true;
 }
@@ -65,6 +100,23 @@ bool ZstdWriterBase::InitializeCStream() {
   if (window_log_ >= 0) {
     params.cParams.windowLog = IntCast<unsigned>(window_log_);
   }
+  if (dictionary_ != nullptr) {
+    // Compression parameters are taken from the prepared dictionary.
+    const ZSTD_CDict* const cdict =
+        dictionary_->PrepareCompressionDictionary(compression_level_,
+                                                  window_log_);
+    if (ABSL_PREDICT_FALSE(cdict == nullptr)) {
+      return Fail("ZSTD_createCDict_advanced() failed");
+    }
+    const size_t result = ZSTD_initCStream_usingCDict_advanced(
+        compressor_.get(), cdict, params.fParams, ZSTD_CONTENTSIZE_UNKNOWN);
+    if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
+      return Fail(
+          absl::StrCat("ZSTD_initCStream_usingCDict_advanced() failed: ",
+                       ZSTD_getErrorName(result)));
+    }
+    return true;
+  }
   const size_t result = ZSTD_initCStream_advanced(
       compressor_.get(), nullptr, 0, params, ZSTD_CONTENTSIZE_UNKNOWN);
   if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
@@ -74,6 +126,107 @@ bool ZstdWriterBase::InitializeCStream() {
   return true;
 }
 
+bool ZstdWriterBase::InitializeCStreamAdvanced() {
+  // Abandon any frame left unfinished by the previous user of compressor_,
+  // and detach its dictionary, which would take precedence over parameters.
+  ZSTD_CCtx_reset(compressor_.get());
+  size_t result = ZSTD_CCtx_refCDict(compressor_.get(), nullptr);
+  if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
+    return Fail(absl::StrCat("ZSTD_CCtx_refCDict() failed: ",
+                             ZSTD_getErrorName(result)));
+  }
+  const std::unique_ptr<ZSTD_CCtx_params, ZSTD_CCtx_paramsDeleter> cctx_params(
+      ZSTD_createCCtxParams());
+  if (ABSL_PREDICT_FALSE(cctx_params == nullptr)) {
+    return Fail("ZSTD_createCCtxParams() failed");
+  }
+  ZSTD_parameters params = ZSTD_getParams(
+      compression_level_, IntCast<unsigned long long>(size_hint_), 0);
+  if (window_log_ >= 0) {
+    params.cParams.windowLog = IntCast<unsigned>(window_log_);
+  } else if (long_distance_matching_) {
+    // Long distance matching is useless if the window does not reach far, so
+    // let the window cover the whole stream, within reason.
+    unsigned window_log = IntCast<unsigned>(
+        Options::kLongDistanceMatchingWindowLog());
+    if (size_hint_ > 0) {
+      unsigned size_log = ZSTD_WINDOWLOG_MIN;
+      while (size_log < window_log && (Position{1} << size_log) < size_hint_) {
+        ++size_log;
+      }
+      window_log = size_log;
+    }
+    params.cParams.windowLog =
+        UnsignedMax(params.cParams.windowLog, window_log);
+  }
+  result = ZSTD_CCtxParams_init_advanced(cctx_params.get(), params);
+  if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
+    return Fail(absl::StrCat("ZSTD_CCtxParams_init_advanced() failed: ",
+                             ZSTD_getErrorName(result)));
+  }
+  if (long_distance_matching_) {
+    result = ZSTD_CCtxParam_setParameter(
+        cctx_params.get(), ZSTD_p_enableLongDistanceMatching, 1);
+    if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
+      return Fail(absl::StrCat(
+          "ZSTD_CCtxParam_setParameter(ZSTD_p_enableLongDistanceMatching) "
+          "failed: ",
+          ZSTD_getErrorName(result)));
+    }
+    if (ldm_hash_log_ >= 0) {
+      result = ZSTD_CCtxParam_setParameter(cctx_params.get(), ZSTD_p_ldmHashLog,
+                                           IntCast<unsigned>(ldm_hash_log_));
+      if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
+        return Fail(
+            absl::StrCat("ZSTD_CCtxParam_setParameter(ZSTD_p_ldmHashLog) "
+                         "failed: ",
+                         ZSTD_getErrorName(result)));
+      }
+    }
+  }
+  if (workers_ > 0) {
+    result = ZSTD_CCtxParam_setParameter(cctx_params.get(), ZSTD_p_nbWorkers,
+                                         IntCast<unsigned>(workers_));
+    if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
+      return Fail(absl::StrCat("ZSTD_CCtxParam_setParameter(ZSTD_p_nbWorkers) "
+                               "failed: ",
+                               ZSTD_getErrorName(result)));
+    }
+  }
+  if (workers_ > 0 && job_size_ > 0) {
+    result = ZSTD_CCtxParam_setParameter(
+        cctx_params.get(), ZSTD_p_jobSize,
+        IntCast<unsigned>(
+            UnsignedMin(job_size_, std::numeric_limits<unsigned>::max())));
+    if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
+      return Fail(absl::StrCat("ZSTD_CCtxParam_setParameter(ZSTD_p_jobSize) "
+                               "failed: ",
+                               ZSTD_getErrorName(result)));
+    }
+  }
+  result = ZSTD_CCtx_setParametersUsingCCtxParams(compressor_.get(),
+                                                  cctx_params.get());
+  if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
+    return Fail(
+        absl::StrCat("ZSTD_CCtx_setParametersUsingCCtxParams() failed: ",
+                     ZSTD_getErrorName(result)));
+  }
+  if (dictionary_ != nullptr) {
+    const ZSTD_CDict* const cdict =
+        dictionary_->PrepareCompressionDictionary(compression_level_,
+                                                  window_log_);
+    if (ABSL_PREDICT_FALSE(cdict == nullptr)) {
+      return Fail("ZSTD_createCDict_advanced() failed");
+    }
+    result = ZSTD_CCtx_refCDict(compressor_.get(), cdict);
+    if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
+      return Fail(absl::StrCat("ZSTD_CCtx_refCDict() failed: ",
+                               ZSTD_getErrorName(result)));
+    }
+  }
+  return true;
+}
+
 bool ZstdWriterBase::WriteInternal(absl::string_view src) {
   RIEGELI_ASSERT(!src.empty())
       << "Failed precondition of BufferedWriter::WriteInternal(): "
@@ -95,19 +248,28 @@ bool ZstdWriterBase::WriteInternal(absl::string_view src) {
   for (;;) {
     ZSTD_outBuffer output = {dest->cursor(), dest->available(), 0};
     const size_t result =
-        ZSTD_compressStream(compressor_.get(), &output, &input);
+        UseAdvancedApi()
+            ? ZSTD_compress_generic(compressor_.get(), &output, &input,
+                                    ZSTD_e_continue)
+            : ZSTD_compressStream(compressor_.get(), &output, &input);
     dest->set_cursor(static_cast<char*>(output.dst) + output.pos);
     if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
       limit_ = start_;
-      return Fail(absl::StrCat("ZSTD_compressStream() failed: ",
-                               ZSTD_getErrorName(result)));
+      return Fail(absl::StrCat(UseAdvancedApi() ? "ZSTD_compress_generic()"
+                                                : "ZSTD_compressStream()",
+                               " failed: ", ZSTD_getErrorName(result)));
+    }
+    if (input.pos == input.size) {
+      start_pos_ += input.pos;
+      return true;
     }
+    // With worker threads, ZSTD_compress_generic() can return before consuming
+    // all input even if there is output space, when workers are busy.
     if (output.pos < output.size) {
-      RIEGELI_ASSERT_EQ(input.pos, input.size)
+      RIEGELI_ASSERT_GT(workers_, 0)
           << "ZSTD_compressStream() returned but there are still input data "
              "and output space";
-      start_pos_ += input.pos;
-      return true;
+      continue;
     }
     if (ABSL_PREDICT_FALSE(!dest->Push())) {
       limit_ = start_;
@@ -121,9 +283,17 @@ bool ZstdWriterBase::Flush(FlushType flush_type) {
   Writer* const dest = dest_writer();
   RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
       << "BufferedWriter::PushInternal() did not empty the buffer";
-  if (ABSL_PREDICT_FALSE(
-          !FlushInternal(ZSTD_flushStream, "ZSTD_flushStream()", dest))) {
-    return false;
+  if (UseAdvancedApi()) {
+    if (ABSL_PREDICT_FALSE(
+            !FlushInternal(CompressGenericFlush<ZSTD_e_flush>,
+                           "ZSTD_compress_generic(ZSTD_e_flush)", dest))) {
+      return false;
+    }
+  } else {
+    if (ABSL_PREDICT_FALSE(
+            !FlushInternal(ZSTD_flushStream, "ZSTD_flushStream()", dest))) {
+      return false;
+    }
   }
   if (ABSL_PREDICT_FALSE(!dest->Flush(flush_type))) {
     if (ABSL_PREDICT_FALSE(!dest->healthy())) {
@@ -156,8 +326,13 @@ bool ZstdWriterBase::FlushInternal(Function function,
       return Fail(
           absl::StrCat(function_name, " failed: ", ZSTD_getErrorName(result)));
     }
-    RIEGELI_ASSERT_EQ(output.pos, output.size)
-        << function_name << " returned but there is still output space";
+    // With worker threads, Zstd returns after flushing the output of one job
+    // even if there is output space and more jobs remain.
+    if (output.pos < output.size) {
+      RIEGELI_ASSERT_GT(workers_, 0)
+          << function_name << " returned but there is still output space";
+      continue;
+    }
     if (ABSL_PREDICT_FALSE(!dest->Push())) {
       limit_ = start_;
       return Fail(*dest);
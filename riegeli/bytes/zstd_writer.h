@@ -24,8 +24,10 @@
 #include "absl/utility/utility.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/recycling_pool.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/writer.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "zstd.h"
 
 namespace riegeli {
@@ -106,6 +108,116 @@ class ZstdWriterBase : public BufferedWriter {
       return std::move(set_size_hint(size_hint));
     }
 
+    // Zstd dictionary. The same dictionary must be used for decompression.
+    //
+    // A dictionary improves compression density of small streams resembling
+    // it. It should be shared by all ZstdWriters using it, because structures
+    // prepared from it for compression are kept in it.
+    //
+    // If nullptr, no dictionary is used.
+    //
+    // Default: nullptr
+    Options& set_dictionary(
+        std::shared_ptr<const ZstdDictionary> dictionary) & {
+      dictionary_ = std::move(dictionary);
+      return *this;
+    }
+    Options&& set_dictionary(
+        std::shared_ptr<const ZstdDictionary> dictionary) && {
+      return std::move(set_dictionary(std::move(dictionary)));
+    }
+
+    // If true, enables long distance matching, which finds long matches far
+    // back in the stream. This improves compression density of large streams
+    // repeating long data far apart, at the cost of memory and compression
+    // speed.
+    //
+    // If window_log is kDefaultWindowLog(), long distance matching also
+    // increases the window to cover the whole stream (according to size_hint)
+    // up to kLongDistanceMatchingWindowLog() (27), or 128 MB. Decompression
+    // needs memory proportional to the window size.
+    //
+    // Default: false.
+    static constexpr int kLongDistanceMatchingWindowLog() { return 27; }
+    Options& set_long_distance_matching(bool long_distance_matching) & {
+      long_distance_matching_ = long_distance_matching;
+      return *this;
+    }
+    Options&& set_long_distance_matching(bool long_distance_matching) && {
+      return std::move(set_long_distance_matching(long_distance_matching));
+    }
+
+    // Logarithm of the size of the table used by long distance matching. This
+    // tunes the tradeoff between compression density and memory usage (higher
+    // = better density but more memory). This is used only if
+    // long_distance_matching is true.
+    //
+    // Special value kDefaultLdmHashLog() (-1) means to derive ldm_hash_log
+    // from window_log.
+    //
+    // ldm_hash_log must be kDefaultLdmHashLog() (-1) or between
+    // kMinLdmHashLog() (6) and kMaxLdmHashLog() (30).
+    // Default: kDefaultLdmHashLog() (-1).
+    static int kMinLdmHashLog();
+    static int kMaxLdmHashLog();
+    static constexpr int kDefaultLdmHashLog() { return -1; }
+    Options& set_ldm_hash_log(int ldm_hash_log) & {
+      if (ldm_hash_log != kDefaultLdmHashLog()) {
+        RIEGELI_ASSERT_GE(ldm_hash_log, kMinLdmHashLog())
+            << "Failed precondition of "
+               "ZstdWriterBase::Options::set_ldm_hash_log(): "
+               "LDM hash log out of range";
+        RIEGELI_ASSERT_LE(ldm_hash_log, kMaxLdmHashLog())
+            << "Failed precondition of "
+               "ZstdWriterBase::Options::set_ldm_hash_log(): "
+               "LDM hash log out of range";
+      }
+      ldm_hash_log_ = ldm_hash_log;
+      return *this;
+    }
+    Options&& set_ldm_hash_log(int ldm_hash_log) && {
+      return std::move(set_ldm_hash_log(ldm_hash_log));
+    }
+
+    // Number of worker threads compressing in parallel with the thread writing
+    // uncompressed data. This speeds up compression of large streams, at the
+    // cost of slightly lower compression density. The output is still a single
+    // Zstd frame, so decompression is not affected.
+    //
+    // Special value 0 means to compress in the writing thread.
+    //
+    // workers must be between 0 and kMaxWorkers() (200). Values which exceed
+    // the limit of the Zstd library are reduced. Default: 0.
+    static constexpr int kMaxWorkers() { return 200; }
+    Options& set_workers(int workers) & {
+      RIEGELI_ASSERT_GE(workers, 0)
+          << "Failed precondition of ZstdWriterBase::Options::set_workers(): "
+             "negative number of workers";
+      RIEGELI_ASSERT_LE(workers, kMaxWorkers())
+          << "Failed precondition of ZstdWriterBase::Options::set_workers(): "
+             "number of workers out of range";
+      workers_ = workers;
+      return *this;
+    }
+    Options&& set_workers(int workers) && {
+      return std::move(set_workers(workers));
+    }
+
+    // Size of a part of the stream compressed by a single worker. This is used
+    // only if workers > 0.
+    //
+    // Special value 0 means to derive job_size from compression parameters
+    // (four times the window size). Values below 1 MB are increased to 1 MB.
+    //
+    // Default: 0.
+    Options& set_job_size(size_t job_size) & {
+      job_size_ = job_size;
+      return *this;
+    }
+    Options&& set_job_size(size_t job_size) && {
+      return std::move(set_job_size(job_size));
+    }
+
     static size_t kDefaultBufferSize() { return ZSTD_CStreamInSize(); }
     Options& set_buffer_size(size_t buffer_size) & {
       RIEGELI_ASSERT_GT(buffer_size, 0u)
@@ -126,6 +238,11 @@ class ZstdWriterBase : public BufferedWriter {
     int compression_level_ = kDefaultCompressionLevel();
     int window_log_ = kDefaultWindowLog();
     Position size_hint_ = 0;
+    std::shared_ptr<const ZstdDictionary> dictionary_;
+    bool long_distance_matching_ = false;
+    int ldm_hash_log_ = kDefaultLdmHashLog();
+    int workers_ = 0;
+    size_t job_size_ = 0;
     size_t buffer_size_ = kDefaultBufferSize();
   };
 
@@ -139,7 +256,11 @@ class ZstdWriterBase : public BufferedWriter {
   ZstdWriterBase() noexcept {}
 
   explicit ZstdWriterBase(int compression_level, int window_log,
-                          Position size_hint, size_t buffer_size) noexcept;
+                          Position size_hint,
+                          std::shared_ptr<const ZstdDictionary> dictionary,
+                          bool long_distance_matching, int ldm_hash_log,
+                          int workers, size_t job_size,
+                          size_t buffer_size) noexcept;
 
   ZstdWriterBase(ZstdWriterBase&& that) noexcept;
   ZstdWriterBase& operator=(ZstdWriterBase&& that) noexcept;
@@ -152,8 +273,33 @@ class ZstdWriterBase : public BufferedWriter {
     void operator()(ZSTD_CStream* ptr) const { ZSTD_freeCStream(ptr); }
   };
 
+  // Parameters which determine the size of resources held by ZSTD_CStream,
+  // for reusing it by another ZstdWriter with the same parameters.
+  struct ZSTD_CStreamKey {
+    friend bool operator==(ZSTD_CStreamKey a, ZSTD_CStreamKey b) {
+      return a.compression_level == b.compression_level &&
+             a.window_log == b.window_log &&
+             a.long_distance_matching == b.long_distance_matching &&
+             a.ldm_hash_log == b.ldm_hash_log && a.workers == b.workers;
+    }
+
+    int compression_level;
+    int window_log;
+    bool long_distance_matching;
+    int ldm_hash_log;
+    int workers;
+  };
+
+  using CStreamPool =
+      internal::KeyedRecyclingPool<ZSTD_CStream, ZSTD_CStreamKey,
+                                   ZSTD_CStreamDeleter>;
+
   bool EnsureCStreamCreated();
   bool InitializeCStream();
+  // Used instead of InitializeCStream() if UseAdvancedApi(), because only the
+  // advanced Zstd API supports worker threads and long distance matching.
+  bool InitializeCStreamAdvanced();
+  bool UseAdvancedApi() const;
 
   template <typename Function>
   bool FlushInternal(Function function, absl::string_view function_name,
@@ -162,9 +308,14 @@ class ZstdWriterBase : public BufferedWriter {
   int compression_level_ = 0;
   int window_log_ = 0;
   Position size_hint_ = 0;
-  // If healthy() but compressor_ == nullptr then compressor_ was not created
+  std::shared_ptr<const ZstdDictionary> dictionary_;
+  bool long_distance_matching_ = false;
+  int ldm_hash_log_ = 0;
+  int workers_ = 0;
+  size_t job_size_ = 0;
+  // If healthy() but compressor_ == nullptr then compressor_ was not obtained
   // yet.
-  std::unique_ptr<ZSTD_CStream, ZSTD_CStreamDeleter> compressor_;
+  CStreamPool::Handle compressor_;
 };
 
 // A Writer which compresses data with Zstd before passing it to another Writer.
@@ -205,19 +356,32 @@ class ZstdWriter : public ZstdWriterBase {
 
 // Implementation details follow.
 
-inline ZstdWriterBase::ZstdWriterBase(int compression_level, int window_log,
-                                      Position size_hint,
-                                      size_t buffer_size) noexcept
+inline ZstdWriterBase::ZstdWriterBase(
+    int compression_level, int window_log, Position size_hint,
+    std::shared_ptr<const ZstdDictionary> dictionary,
+    bool long_distance_matching, int ldm_hash_log, int workers,
+    size_t job_size, size_t buffer_size) noexcept
     : BufferedWriter(buffer_size),
       compression_level_(compression_level),
       window_log_(window_log),
-      size_hint_(size_hint) {}
+      size_hint_(size_hint),
+      dictionary_(std::move(dictionary)),
+      long_distance_matching_(long_distance_matching),
+      ldm_hash_log_(ldm_hash_log),
+      workers_(workers),
+      job_size_(job_size) {}
 
 inline ZstdWriterBase::ZstdWriterBase(ZstdWriterBase&& that) noexcept
     : BufferedWriter(std::move(that)),
       compression_level_(absl::exchange(that.compression_level_, 0)),
       window_log_(absl::exchange(that.window_log_, 0)),
       size_hint_(absl::exchange(that.size_hint_, 0)),
+      dictionary_(std::move(that.dictionary_)),
+      long_distance_matching_(
+          absl::exchange(that.long_distance_matching_, false)),
+      ldm_hash_log_(absl::exchange(that.ldm_hash_log_, 0)),
+      workers_(absl::exchange(that.workers_, 0)),
+      job_size_(absl::exchange(that.job_size_, 0)),
       compressor_(std::move(that.compressor_)) {}
 
 inline ZstdWriterBase& ZstdWriterBase::operator=(
@@ -226,20 +390,26 @@ inline ZstdWriterBase& ZstdWriterBase::operator=(
   compression_level_ = absl::exchange(that.compression_level_, 0);
   window_log_ = absl::exchange(that.window_log_, 0),
   size_hint_ = absl::exchange(that.size_hint_, 0);
-  if (that.compressor_ != nullptr || ABSL_PREDICT_FALSE(!healthy())) {
-    compressor_ = std::move(that.compressor_);
-  } else if (compressor_ != nullptr) {
-    // Reuse this ZSTD_CStream because if options are the same then reusing it
-    // is faster than creating it again.
-    InitializeCStream();
-  }
+  dictionary_ = std::move(that.dictionary_);
+  long_distance_matching_ = absl::exchange(that.long_distance_matching_, false);
+  ldm_hash_log_ = absl::exchange(that.ldm_hash_log_, 0);
+  workers_ = absl::exchange(that.workers_, 0);
+  job_size_ = absl::exchange(that.job_size_, 0);
+  compressor_ = std::move(that.compressor_);
   return *this;
 }
 
+inline bool ZstdWriterBase::UseAdvancedApi() const {
+  return workers_ > 0 || long_distance_matching_;
+}
+
 template <typename Dest>
 inline ZstdWriter<Dest>::ZstdWriter(Dest dest, Options options)
     : ZstdWriterBase(options.compression_level_, options.window_log_,
-                     options.size_hint_, options.buffer_size_),
+                     options.size_hint_, std::move(options.dictionary_),
+                     options.long_distance_matching_, options.ldm_hash_log_,
+                     options.workers_, options.job_size_,
+                     options.buffer_size_),
       dest_(std::move(dest)) {
   RIEGELI_ASSERT(dest_.ptr() != nullptr)
       << "Failed precondition of ZstdWriter<Dest>::ZstdWriter(Dest): "
@@ -125,9 +125,9 @@ bool ChunkDecoder::Parse(const ChunkHeader& header, Reader* src, Chain* dest) {
       return true;
     case ChunkType::kSimple: {
       SimpleDecoder simple_decoder;
-      if (ABSL_PREDICT_FALSE(!simple_decoder.Reset(src, header.num_records(),
-                                                   header.decoded_data_size(),
-                                                   &limits_))) {
+      if (ABSL_PREDICT_FALSE(!simple_decoder.Reset(
+              src, header.num_records(), header.decoded_data_size(),
+              zstd_dictionary_, &limits_))) {
         return Fail("Invalid simple chunk", simple_decoder);
       }
       dest->Clear();
@@ -153,7 +153,7 @@ bool ChunkDecoder::Parse(const ChunkHeader& header, Reader* src, Chain* dest) {
                                                : uint64_t{0}));
       const bool ok = transpose_decoder.Reset(
           src, header.num_records(), header.decoded_data_size(),
-          field_projection_, &dest_writer, &limits_);
+          field_projection_, zstd_dictionary_, &dest_writer, &limits_);
       if (ABSL_PREDICT_FALSE(!dest_writer.Close())) return Fail(dest_writer);
       if (ABSL_PREDICT_FALSE(!ok)) {
         return Fail("Invalid transposed chunk", transpose_decoder);
@@ -17,6 +17,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -30,6 +31,7 @@
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/field_projection.h"
 
@@ -52,10 +54,25 @@ class ChunkDecoder : public Object {
       return std::move(set_field_projection(std::move(field_projection)));
     }
 
+    // Specifies the Zstd dictionary used for compressing chunks, or nullptr if
+    // none was used. It can also be changed later by SetZstdDictionary().
+    //
+    // Default: nullptr
+    Options& set_zstd_dictionary(
+        std::shared_ptr<const ZstdDictionary> zstd_dictionary) & {
+      zstd_dictionary_ = std::move(zstd_dictionary);
+      return *this;
+    }
+    Options&& set_zstd_dictionary(
+        std::shared_ptr<const ZstdDictionary> zstd_dictionary) && {
+      return std::move(set_zstd_dictionary(std::move(zstd_dictionary)));
+    }
+
    private:
     friend class ChunkDecoder;
 
     FieldProjection field_projection_ = FieldProjection::All();
+    std::shared_ptr<const ZstdDictionary> zstd_dictionary_;
   };
 
   // Creates an empty ChunkDecoder.
@@ -116,6 +133,13 @@ class ChunkDecoder : public Object {
   // Returns the number of records. Unchanged by Close().
   uint64_t num_records() const { return IntCast<uint64_t>(limits_.size()); }
 
+  // Changes the Zstd dictionary used for decoding chunks passed to subsequent
+  // Reset(const Chunk&) calls, e.g. after reading it from file metadata.
+  void SetZstdDictionary(
+      std::shared_ptr<const ZstdDictionary> zstd_dictionary) {
+    zstd_dictionary_ = std::move(zstd_dictionary);
+  }
+
  protected:
   void Done() override;
 
@@ -123,6 +147,7 @@ class ChunkDecoder : public Object {
   bool Parse(const ChunkHeader& header, Reader* src, Chain* dest);
 
   FieldProjection field_projection_;
+  std::shared_ptr<const ZstdDictionary> zstd_dictionary_;
   // Invariants if healthy():
   //   limits_ are sorted
   //   (limits_.empty() ? 0 : limits_.back()) == size of values_reader_
@@ -143,11 +168,13 @@ class ChunkDecoder : public Object {
 inline ChunkDecoder::ChunkDecoder(Options options)
     : Object(State::kOpen),
       field_projection_(std::move(options.field_projection_)),
+      zstd_dictionary_(std::move(options.zstd_dictionary_)),
       values_reader_(Chain()) {}
 
 inline ChunkDecoder::ChunkDecoder(ChunkDecoder&& that) noexcept
     : Object(std::move(that)),
       field_projection_(std::move(that.field_projection_)),
+      zstd_dictionary_(std::move(that.zstd_dictionary_)),
       limits_(std::move(that.limits_)),
       values_reader_(
           absl::exchange(that.values_reader_, ChainReader<Chain>(Chain()))),
@@ -158,6 +185,7 @@ inline ChunkDecoder::ChunkDecoder(ChunkDecoder&& that) noexcept
 inline ChunkDecoder& ChunkDecoder::operator=(ChunkDecoder&& that) noexcept {
   Object::operator=(std::move(that));
   field_projection_ = std::move(that.field_projection_);
+  zstd_dictionary_ = std::move(that.zstd_dictionary_);
   limits_ = std::move(that.limits_);
   values_reader_ =
       absl::exchange(that.values_reader_, ChainReader<Chain>(Chain()));
@@ -15,6 +15,7 @@
 #include "riegeli/chunk_encoding/compressor.h"
 
 #include <stdint.h>
+#include <limits>
 #include <utility>
 
 #include "absl/base/optimization.h"
@@ -24,11 +25,14 @@
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/brotli_writer.h"
 #include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/lz4_writer.h"
+#include "riegeli/bytes/snappy_streams.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/bytes/writer_utils.h"
 #include "riegeli/bytes/zstd_writer.h"
 #include "riegeli/chunk_encoding/compressor_options.h"
 #include "riegeli/chunk_encoding/constants.h"
+#include "snappy.h"
 
 namespace riegeli {
 namespace internal {
@@ -46,10 +50,13 @@ void Compressor::Reset() {
   ChainWriter<> compressed_writer(
       &compressed_,
       ChainWriterBase::Options().set_size_hint(
-          options_.compression_type() == CompressionType::kNone ? size_hint_
-                                                                : uint64_t{0}));
+          options_.compression_type() == CompressionType::kNone ||
+                  options_.compression_type() == CompressionType::kSnappy
+              ? size_hint_
+              : uint64_t{0}));
   switch (options_.compression_type()) {
     case CompressionType::kNone:
+    case CompressionType::kSnappy:
       writer_ = std::move(compressed_writer);
       return;
     case CompressionType::kBrotli:
@@ -66,7 +73,19 @@ void Compressor::Reset() {
           ZstdWriterBase::Options()
               .set_compression_level(options_.compression_level())
               .set_window_log(options_.window_log())
-              .set_size_hint(size_hint_));
+              .set_size_hint(size_hint_)
+              .set_dictionary(options_.zstd_dictionary())
+              .set_long_distance_matching(
+                  options_.zstd_long_distance_matching())
+              .set_ldm_hash_log(options_.zstd_ldm_hash_log())
+              .set_workers(options_.zstd_workers())
+              .set_job_size(options_.zstd_job_size()));
+      return;
+    case CompressionType::kLz4:
+      writer_ = Lz4Writer<ChainWriter<>>(
+          std::move(compressed_writer),
+          Lz4WriterBase::Options().set_compression_level(
+              options_.compression_level()));
       return;
   }
   RIEGELI_ASSERT_UNREACHABLE()
@@ -89,6 +108,18 @@ bool Compressor::EncodeAndClose(Writer* dest) {
       return Fail(*dest);
     }
   }
+  if (options_.compression_type() == CompressionType::kSnappy) {
+    // Snappy stores the uncompressed size as varint32.
+    if (ABSL_PREDICT_FALSE(uncompressed_size >
+                           std::numeric_limits<uint32_t>::max())) {
+      return Fail("Uncompressed size too large for Snappy");
+    }
+    ChainSnappySource source(&compressed_);
+    WriterSnappySink sink(dest);
+    snappy::Compress(&source, &sink);
+    if (ABSL_PREDICT_FALSE(!dest->healthy())) return Fail(*dest);
+    return Close();
+  }
   if (ABSL_PREDICT_FALSE(!dest->Write(std::move(compressed_)))) {
     return Fail(*dest);
   }
@@ -23,6 +23,7 @@
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/brotli_writer.h"
 #include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/lz4_writer.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/bytes/zstd_writer.h"
 #include "riegeli/chunk_encoding/compressor_options.h"
@@ -54,6 +55,9 @@ class Compressor : public Object {
   // If options.compression_type() is not kNone, writes uncompressed size as a
   // varint before the data.
   //
+  // For kSnappy, this is where the data are compressed, because Snappy
+  // compresses the whole stream at once.
+  //
   // Return values:
   //  * true  - success (healthy())
   //  * false - failure (!healthy())
@@ -65,12 +69,13 @@ class Compressor : public Object {
  private:
   CompressorOptions options_;
   uint64_t size_hint_ = 0;
+  // For kSnappy, uncompressed data, which are compressed by EncodeAndClose().
   Chain compressed_;
   // Invariant:
   //   options_.compression_type() is consistent with
   //       the active member of writer_
   absl::variant<ChainWriter<>, BrotliWriter<ChainWriter<>>,
-                ZstdWriter<ChainWriter<>>>
+                ZstdWriter<ChainWriter<>>, Lz4Writer<ChainWriter<>>>
       writer_;
 };
 
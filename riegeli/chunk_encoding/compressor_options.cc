@@ -21,6 +21,7 @@
 #include "riegeli/base/base.h"
 #include "riegeli/base/options_parser.h"
 #include "riegeli/bytes/brotli_writer.h"
+#include "riegeli/bytes/lz4_writer.h"
 #include "riegeli/bytes/zstd_writer.h"
 #include "riegeli/chunk_encoding/constants.h"
 
@@ -34,27 +35,52 @@ bool CompressorOptions::Parse(absl::string_view text,
     OptionsParser options_parser;
     options_parser.AddOption(
         "uncompressed",
-        ValueParser::And(ValueParser::FailIfSeen("brotli", "zstd"),
-                         [this](ValueParser* value_parser) {
-                           compression_type_ = CompressionType::kNone;
-                           return true;
-                         }));
+        ValueParser::And(
+            ValueParser::FailIfSeen("brotli", "zstd", "lz4", "snappy"),
+            [this](ValueParser* value_parser) {
+              compression_type_ = CompressionType::kNone;
+              return true;
+            }));
     options_parser.AddOption(
         "brotli",
-        ValueParser::And(ValueParser::FailIfSeen("uncompressed", "zstd"),
-                         [this](ValueParser* value_parser) {
-                           compression_type_ = CompressionType::kBrotli;
-                           return true;
-                         }));
+        ValueParser::And(
+            ValueParser::FailIfSeen("uncompressed", "zstd", "lz4", "snappy"),
+            [this](ValueParser* value_parser) {
+              compression_type_ = CompressionType::kBrotli;
+              return true;
+            }));
     options_parser.AddOption(
         "zstd",
-        ValueParser::And(ValueParser::FailIfSeen("uncompressed", "brotli"),
-                         [this](ValueParser* value_parser) {
-                           compression_type_ = CompressionType::kZstd;
-                           return true;
-                         }));
+        ValueParser::And(
+            ValueParser::FailIfSeen("uncompressed", "brotli", "lz4", "snappy"),
+            [this](ValueParser* value_parser) {
+              compression_type_ = CompressionType::kZstd;
+              return true;
+            }));
+    options_parser.AddOption(
+        "lz4",
+        ValueParser::And(
+            ValueParser::FailIfSeen("uncompressed", "brotli", "zstd", "snappy"),
+            [this](ValueParser* value_parser) {
+              compression_type_ = CompressionType::kLz4;
+              return true;
+            }));
+    options_parser.AddOption(
+        "snappy",
+        ValueParser::And(
+            ValueParser::FailIfSeen("uncompressed", "brotli", "zstd", "lz4"),
+            [this](ValueParser* value_parser) {
+              compression_type_ = CompressionType::kSnappy;
+              return true;
+            }));
     options_parser.AddOption("window_log",
                              [](ValueParser* value_parser) { return true; });
+    options_parser.AddOption("zstd_long_distance_matching",
+                             [](ValueParser* value_parser) { return true; });
+    options_parser.AddOption("zstd_ldm_hash_log",
+                             [](ValueParser* value_parser) { return true; });
+    options_parser.AddOption("zstd_workers",
+                             [](ValueParser* value_parser) { return true; });
     if (ABSL_PREDICT_FALSE(!options_parser.Parse(text))) {
       if (error_message != nullptr) {
         *error_message = std::string(options_parser.message());
@@ -85,6 +111,17 @@ bool CompressorOptions::Parse(absl::string_view text,
           ValueParser::Int(&compression_level_,
                            ZstdWriterBase::Options::kMinCompressionLevel(),
                            ZstdWriterBase::Options::kMaxCompressionLevel())));
+  options_parser.AddOption(
+      "lz4",
+      ValueParser::Or(
+          ValueParser::Empty(
+              &compression_level_,
+              Lz4WriterBase::Options::kDefaultCompressionLevel()),
+          ValueParser::Int(&compression_level_,
+                           Lz4WriterBase::Options::kMinCompressionLevel(),
+                           Lz4WriterBase::Options::kMaxCompressionLevel())));
+  options_parser.AddOption("snappy",
+                           ValueParser::Empty(&compression_level_, 0));
   options_parser.AddOption("window_log", [&] {
     switch (compression_type_) {
       case CompressionType::kNone:
@@ -101,10 +138,35 @@ bool CompressorOptions::Parse(absl::string_view text,
             ValueParser::Int(&window_log_,
                              ZstdWriterBase::Options::kMinWindowLog(),
                              ZstdWriterBase::Options::kMaxWindowLog()));
+      case CompressionType::kLz4:
+        return ValueParser::FailIfSeen("lz4");
+      case CompressionType::kSnappy:
+        return ValueParser::FailIfSeen("snappy");
     }
     RIEGELI_ASSERT_UNREACHABLE() << "Unknown compression type: "
                                  << static_cast<unsigned>(compression_type_);
   }());
+  options_parser.AddOption(
+      "zstd_long_distance_matching",
+      compression_type_ == CompressionType::kZstd
+          ? ValueParser::Enum(&zstd_long_distance_matching_,
+                              {{"", true}, {"true", true}, {"false", false}})
+          : ValueParser::FailMissing("zstd"));
+  options_parser.AddOption(
+      "zstd_ldm_hash_log",
+      compression_type_ == CompressionType::kZstd
+          ? ValueParser::Or(
+                ValueParser::Enum(&zstd_ldm_hash_log_,
+                                  {{"auto", kDefaultZstdLdmHashLog()}}),
+                ValueParser::Int(&zstd_ldm_hash_log_, kMinZstdLdmHashLog(),
+                                 kMaxZstdLdmHashLog()))
+          : ValueParser::FailMissing("zstd"));
+  options_parser.AddOption(
+      "zstd_workers",
+      compression_type_ == CompressionType::kZstd
+          ? ValueParser::Int(&zstd_workers_, 0,
+                             ZstdWriterBase::Options::kMaxWorkers())
+          : ValueParser::FailMissing("zstd"));
   if (ABSL_PREDICT_FALSE(!options_parser.Parse(text))) {
     if (error_message != nullptr) {
       *error_message = std::string(options_parser.message());
@@ -146,6 +208,12 @@ int CompressorOptions::window_log() const {
                "window log out of range for zstd";
         return window_log_;
       }
+    case CompressionType::kLz4:
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Failed precondition of CompressorOptions::window_log(): lz4";
+    case CompressionType::kSnappy:
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Failed precondition of CompressorOptions::window_log(): snappy";
   }
   RIEGELI_ASSERT_UNREACHABLE() << "Unknown compression type: "
                                << static_cast<unsigned>(compression_type_);
@@ -15,12 +15,16 @@
 #ifndef RIEGELI_CHUNK_ENCODING_COMPRESSOR_OPTIONS_H_
 #define RIEGELI_CHUNK_ENCODING_COMPRESSOR_OPTIONS_H_
 
+#include <stddef.h>
+#include <memory>
 #include <string>
 #include <utility>
 
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
 #include "riegeli/bytes/brotli_writer.h"
+#include "riegeli/bytes/lz4_writer.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "riegeli/bytes/zstd_writer.h"
 #include "riegeli/chunk_encoding/constants.h"
 
@@ -37,10 +41,18 @@ class CompressorOptions {
   //     "uncompressed" |
   //     "brotli" (":" brotli_level)? |
   //     "zstd" (":" zstd_level)? |
-  //     "window_log" ":" window_log
+  //     "lz4" (":" lz4_level)? |
+  //     "snappy" |
+  //     "window_log" ":" window_log |
+  //     "zstd_long_distance_matching" (":" ("true" | "false"))? |
+  //     "zstd_ldm_hash_log" ":" zstd_ldm_hash_log |
+  //     "zstd_workers" ":" zstd_workers
   //   brotli_level ::= integer 0..11 (default 9)
   //   zstd_level ::= integer -32..22 (default 9)
+  //   lz4_level ::= integer -32..12 (default 0)
   //   window_log ::= "auto" or integer 10..31
+  //   zstd_ldm_hash_log ::= "auto" or integer 6..30
+  //   zstd_workers ::= integer 0..200
   //
   // Return values:
   //  * true  - success
@@ -119,6 +131,54 @@ class CompressorOptions {
     return std::move(set_zstd(compression_level));
   }
 
+  // Changes compression algorithm to LZ4. Sets compression level which tunes
+  // the tradeoff between compression density and compression speed (higher =
+  // better density but slower).
+  //
+  // LZ4 compresses less densely than Brotli and Zstd, but decompresses much
+  // faster, and at low levels also compresses much faster.
+  //
+  // compression_level must be between kMinLz4() (-32) and kMaxLz4() (12).
+  // Levels 3 and higher use LZ4-HC. Default: kDefaultLz4() (0).
+  static constexpr int kMinLz4() {
+    return Lz4WriterBase::Options::kMinCompressionLevel();
+  }
+  static constexpr int kMaxLz4() {
+    return Lz4WriterBase::Options::kMaxCompressionLevel();
+  }
+  static constexpr int kDefaultLz4() {
+    return Lz4WriterBase::Options::kDefaultCompressionLevel();
+  }
+  CompressorOptions& set_lz4(int compression_level = kDefaultLz4()) & {
+    RIEGELI_ASSERT_GE(compression_level, kMinLz4())
+        << "Failed precondition of CompressorOptions::set_lz4(): "
+           "compression level out of range";
+    RIEGELI_ASSERT_LE(compression_level, kMaxLz4())
+        << "Failed precondition of CompressorOptions::set_lz4(): "
+           "compression level out of range";
+    compression_type_ = CompressionType::kLz4;
+    compression_level_ = compression_level;
+    return *this;
+  }
+  CompressorOptions&& set_lz4(int compression_level = kDefaultLz4()) && {
+    return std::move(set_lz4(compression_level));
+  }
+
+  // Changes compression algorithm to Snappy.
+  //
+  // Snappy has no compression levels. Like LZ4, it compresses less densely than
+  // Brotli and Zstd, but decompresses much faster. Data are decompressed
+  // straight into their final buffer, using the decompressed size stored in the
+  // chunk.
+  //
+  // Snappy requires that uncompressed data of each chunk do not exceed 4 GB.
+  CompressorOptions& set_snappy() & {
+    compression_type_ = CompressionType::kSnappy;
+    compression_level_ = 0;
+    return *this;
+  }
+  CompressorOptions&& set_snappy() && { return std::move(set_snappy()); }
+
   CompressionType compression_type() const { return compression_type_; }
 
   int compression_level() const { return compression_level_; }
@@ -130,7 +190,8 @@ class CompressorOptions {
   // Special value kDefaultWindowLog() (-1) means to keep the default
   // (brotli: 22, zstd: derived from compression level and chunk size).
   //
-  // For uncompressed, window_log must be kDefaultWindowLog() (-1).
+  // For uncompressed, lz4, and snappy, window_log must be kDefaultWindowLog()
+  // (-1).
   //
   // For brotli, window_log must be kDefaultWindowLog() (-1) or between
   // BrotliWriterBase::Options::kMinWindowLog() (10) and
@@ -169,13 +230,148 @@ class CompressorOptions {
 
   // Returns window_log translated for BrotliWriter or ZstdWriter.
   //
-  // Precondition: compression_type_ != CompressionType::kNone
+  // Precondition:
+  //   compression_type_ == CompressionType::kBrotli ||
+  //   compression_type_ == CompressionType::kZstd
   int window_log() const;
 
+  // Zstd dictionary. The same dictionary must be used for decompression.
+  //
+  // This is used only for zstd.
+  //
+  // If nullptr, no dictionary is used.
+  //
+  // Default: nullptr
+  CompressorOptions& set_zstd_dictionary(
+      std::shared_ptr<const ZstdDictionary> zstd_dictionary) & {
+    zstd_dictionary_ = std::move(zstd_dictionary);
+    return *this;
+  }
+  CompressorOptions&& set_zstd_dictionary(
+      std::shared_ptr<const ZstdDictionary> zstd_dictionary) && {
+    return std::move(set_zstd_dictionary(std::move(zstd_dictionary)));
+  }
+  const std::shared_ptr<const ZstdDictionary>& zstd_dictionary() const {
+    return zstd_dictionary_;
+  }
+
+  // If true, enables long distance matching, which finds long matches far
+  // back in a chunk. This improves compression density of chunks repeating
+  // long data far apart, at the cost of memory and compression speed.
+  //
+  // This is used only for zstd.
+  //
+  // If window_log is kDefaultWindowLog(), long distance matching also
+  // increases the window to cover the whole chunk, up to 128 MB. Decompression
+  // needs memory proportional to the window size.
+  //
+  // Default: false.
+  CompressorOptions& set_zstd_long_distance_matching(
+      bool zstd_long_distance_matching) & {
+    zstd_long_distance_matching_ = zstd_long_distance_matching;
+    return *this;
+  }
+  CompressorOptions&& set_zstd_long_distance_matching(
+      bool zstd_long_distance_matching) && {
+    return std::move(
+        set_zstd_long_distance_matching(zstd_long_distance_matching));
+  }
+  bool zstd_long_distance_matching() const {
+    return zstd_long_distance_matching_;
+  }
+
+  // Logarithm of the size of the table used by zstd long distance matching.
+  // This tunes the tradeoff between compression density and memory usage
+  // (higher = better density but more memory).
+  //
+  // This is used only for zstd with zstd_long_distance_matching.
+  //
+  // Special value kDefaultZstdLdmHashLog() (-1) means to derive it from
+  // window_log.
+  //
+  // zstd_ldm_hash_log must be kDefaultZstdLdmHashLog() (-1) or between
+  // kMinZstdLdmHashLog() (6) and kMaxZstdLdmHashLog() (30).
+  // Default: kDefaultZstdLdmHashLog() (-1).
+  static int kMinZstdLdmHashLog() {
+    return ZstdWriterBase::Options::kMinLdmHashLog();
+  }
+  static int kMaxZstdLdmHashLog() {
+    return ZstdWriterBase::Options::kMaxLdmHashLog();
+  }
+  static constexpr int kDefaultZstdLdmHashLog() {
+    return ZstdWriterBase::Options::kDefaultLdmHashLog();
+  }
+  CompressorOptions& set_zstd_ldm_hash_log(int zstd_ldm_hash_log) & {
+    if (zstd_ldm_hash_log != kDefaultZstdLdmHashLog()) {
+      RIEGELI_ASSERT_GE(zstd_ldm_hash_log, kMinZstdLdmHashLog())
+          << "Failed precondition of "
+             "CompressorOptions::set_zstd_ldm_hash_log(): "
+             "LDM hash log out of range";
+      RIEGELI_ASSERT_LE(zstd_ldm_hash_log, kMaxZstdLdmHashLog())
+          << "Failed precondition of "
+             "CompressorOptions::set_zstd_ldm_hash_log(): "
+             "LDM hash log out of range";
+    }
+    zstd_ldm_hash_log_ = zstd_ldm_hash_log;
+    return *this;
+  }
+  CompressorOptions&& set_zstd_ldm_hash_log(int zstd_ldm_hash_log) && {
+    return std::move(set_zstd_ldm_hash_log(zstd_ldm_hash_log));
+  }
+  int zstd_ldm_hash_log() const { return zstd_ldm_hash_log_; }
+
+  // Number of worker threads compressing a chunk in parallel. This speeds up
+  // compression of large chunks, e.g. with high compression levels, at the
+  // cost of slightly lower compression density. Decompression is not affected.
+  //
+  // This is used only for zstd.
+  //
+  // Special value 0 means to compress in the thread encoding the chunk.
+  //
+  // zstd_workers must be between 0 and kMaxZstdWorkers() (200).
+  // Default: 0.
+  static constexpr int kMaxZstdWorkers() {
+    return ZstdWriterBase::Options::kMaxWorkers();
+  }
+  CompressorOptions& set_zstd_workers(int zstd_workers) & {
+    RIEGELI_ASSERT_GE(zstd_workers, 0)
+        << "Failed precondition of CompressorOptions::set_zstd_workers(): "
+           "negative number of workers";
+    RIEGELI_ASSERT_LE(zstd_workers, kMaxZstdWorkers())
+        << "Failed precondition of CompressorOptions::set_zstd_workers(): "
+           "number of workers out of range";
+    zstd_workers_ = zstd_workers;
+    return *this;
+  }
+  CompressorOptions&& set_zstd_workers(int zstd_workers) && {
+    return std::move(set_zstd_workers(zstd_workers));
+  }
+  int zstd_workers() const { return zstd_workers_; }
+
+  // Size of a part of a chunk compressed by a single worker. This is used only
+  // for zstd with zstd_workers > 0.
+  //
+  // Special value 0 means to derive it from compression parameters.
+  //
+  // Default: 0.
+  CompressorOptions& set_zstd_job_size(size_t zstd_job_size) & {
+    zstd_job_size_ = zstd_job_size;
+    return *this;
+  }
+  CompressorOptions&& set_zstd_job_size(size_t zstd_job_size) && {
+    return std::move(set_zstd_job_size(zstd_job_size));
+  }
+  size_t zstd_job_size() const { return zstd_job_size_; }
+
  private:
   CompressionType compression_type_ = CompressionType::kBrotli;
   int compression_level_ = kDefaultBrotli();
   int window_log_ = kDefaultWindowLog();
+  std::shared_ptr<const ZstdDictionary> zstd_dictionary_;
+  bool zstd_long_distance_matching_ = false;
+  int zstd_ldm_hash_log_ = kDefaultZstdLdmHashLog();
+  int zstd_workers_ = 0;
+  size_t zstd_job_size_ = 0;
 };
 
 }  // namespace riegeli
@@ -34,6 +34,8 @@ enum class CompressionType : uint8_t {
   kNone = 0,
   kBrotli = 'b',
   kZstd = 'z',
+  kLz4 = '4',
+  kSnappy = 's',
 };
 
 constexpr uint64_t kMaxNumRecords() {
@@ -14,17 +14,48 @@
 
 #include "riegeli/chunk_encoding/decompressor.h"
 
+#include <stddef.h>
 #include <stdint.h>
+#include <limits>
+#include <memory>
+#include <string>
 
+#include "absl/base/optimization.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "brotli/decode.h"
+#include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/recycling_pool.h"
 #include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/reader_utils.h"
+#include "riegeli/bytes/snappy_streams.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "riegeli/chunk_encoding/constants.h"
+#include "snappy.h"
+#include "zstd.h"
 
 namespace riegeli {
 namespace internal {
 
+namespace {
+
+struct BrotliDecoderStateDeleter {
+  void operator()(BrotliDecoderState* ptr) const {
+    BrotliDecoderDestroyInstance(ptr);
+  }
+};
+
+struct ZSTD_DCtxDeleter {
+  void operator()(ZSTD_DCtx* ptr) const { ZSTD_freeDCtx(ptr); }
+};
+
+using DCtxPool = RecyclingPool<ZSTD_DCtx, ZSTD_DCtxDeleter>;
+
+}  // namespace
+
 bool UncompressedSize(const Chain& compressed_data,
                       CompressionType compression_type,
                       uint64_t* uncompressed_size) {
@@ -36,6 +67,218 @@ bool UncompressedSize(const Chain& compressed_data,
   return ReadVarint64(&compressed_data_reader, uncompressed_size);
 }
 
+bool BrotliDecompress(Reader* src, uint64_t decompressed_size, Chain* dest,
+                      std::string* error_message) {
+  dest->Clear();
+  if (ABSL_PREDICT_FALSE(decompressed_size >
+                         std::numeric_limits<size_t>::max())) {
+    *error_message =
+        absl::StrCat("Decompressed size too large: ", decompressed_size);
+    return false;
+  }
+  const std::unique_ptr<BrotliDecoderState, BrotliDecoderStateDeleter>
+      decompressor(BrotliDecoderCreateInstance(nullptr, nullptr, nullptr));
+  if (ABSL_PREDICT_FALSE(decompressor == nullptr)) {
+    *error_message = "BrotliDecoderCreateInstance() failed";
+    return false;
+  }
+  // BrotliDecoderDecompress() does not support large windows, so the streaming
+  // API is used instead, with the whole output buffer available at once.
+  if (ABSL_PREDICT_FALSE(!BrotliDecoderSetParameter(
+          decompressor.get(), BROTLI_DECODER_PARAM_LARGE_WINDOW,
+          uint32_t{true}))) {
+    *error_message =
+        "BrotliDecoderSetParameter(BROTLI_DECODER_PARAM_LARGE_WINDOW) failed";
+    return false;
+  }
+  const absl::Span<char> buffer =
+      dest->AppendBuffer(IntCast<size_t>(decompressed_size),
+                         IntCast<size_t>(decompressed_size),
+                         IntCast<size_t>(decompressed_size));
+  size_t available_out = buffer.size();
+  uint8_t* next_out = reinterpret_cast<uint8_t*>(buffer.data());
+  for (;;) {
+    size_t available_in = src->available();
+    const uint8_t* next_in = reinterpret_cast<const uint8_t*>(src->cursor());
+    const BrotliDecoderResult result =
+        BrotliDecoderDecompressStream(decompressor.get(), &available_in,
+                                      &next_in, &available_out, &next_out,
+                                      nullptr);
+    src->set_cursor(reinterpret_cast<const char*>(next_in));
+    switch (result) {
+      case BROTLI_DECODER_RESULT_ERROR:
+        *error_message = absl::StrCat(
+            "BrotliDecoderDecompressStream() failed: ",
+            BrotliDecoderErrorString(
+                BrotliDecoderGetErrorCode(decompressor.get())));
+        return false;
+      case BROTLI_DECODER_RESULT_SUCCESS:
+        dest->RemoveSuffix(available_out);
+        if (ABSL_PREDICT_FALSE(dest->size() != decompressed_size)) {
+          *error_message = absl::StrCat(
+              "Decompressed size mismatch: expected ", decompressed_size,
+              ", Brotli-compressed stream has ", dest->size());
+          return false;
+        }
+        return true;
+      case BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT:
+        if (ABSL_PREDICT_FALSE(!src->Pull())) {
+          if (ABSL_PREDICT_FALSE(!src->healthy())) {
+            *error_message = std::string(src->message());
+          } else {
+            *error_message = "Truncated Brotli-compressed stream";
+          }
+          return false;
+        }
+        continue;
+      case BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT:
+        *error_message = absl::StrCat(
+            "Decompressed size mismatch: expected ", decompressed_size,
+            ", Brotli-compressed stream has more");
+        return false;
+    }
+    RIEGELI_ASSERT_UNREACHABLE()
+        << "Unknown BrotliDecoderResult: " << static_cast<int>(result);
+  }
+}
+
+bool ZstdDecompress(
+    Reader* src, uint64_t decompressed_size,
+    const std::shared_ptr<const ZstdDictionary>& zstd_dictionary, Chain* dest,
+    std::string* error_message) {
+  dest->Clear();
+  if (ABSL_PREDICT_FALSE(decompressed_size >
+                         std::numeric_limits<size_t>::max())) {
+    *error_message =
+        absl::StrCat("Decompressed size too large: ", decompressed_size);
+    return false;
+  }
+  RIEGELI_ASSERT(src->SupportsRandomAccess())
+      << "Failed precondition of ZstdDecompress(): "
+         "source does not support random access";
+  Position src_size;
+  if (ABSL_PREDICT_FALSE(!src->Size(&src_size))) {
+    *error_message = std::string(src->message());
+    return false;
+  }
+  RIEGELI_ASSERT_GE(src_size, src->pos())
+      << "Current position after the end of source";
+  if (ABSL_PREDICT_FALSE(src_size - src->pos() >
+                         std::numeric_limits<size_t>::max())) {
+    *error_message = absl::StrCat("Compressed size too large: ",
+                                  src_size - src->pos());
+    return false;
+  }
+  // ZSTD_decompressDCtx() needs the whole compressed stream as a flat array.
+  // Compressed data are usually smaller, so copying them if they are
+  // fragmented is cheaper than copying decompressed data.
+  absl::string_view compressed;
+  std::string compressed_scratch;
+  if (ABSL_PREDICT_FALSE(!src->Read(&compressed, &compressed_scratch,
+                                    IntCast<size_t>(src_size - src->pos())))) {
+    if (ABSL_PREDICT_FALSE(!src->healthy())) {
+      *error_message = std::string(src->message());
+    } else {
+      *error_message = "Truncated Zstd-compressed stream";
+    }
+    return false;
+  }
+  // A ZSTD_DCtx used earlier is reused if possible. Decompressing a whole
+  // frame resets its state.
+  const DCtxPool::Handle decompressor = DCtxPool::global().Get([] {
+    return std::unique_ptr<ZSTD_DCtx, ZSTD_DCtxDeleter>(ZSTD_createDCtx());
+  });
+  if (ABSL_PREDICT_FALSE(decompressor == nullptr)) {
+    *error_message = "ZSTD_createDCtx() failed";
+    return false;
+  }
+  const absl::Span<char> buffer =
+      dest->AppendBuffer(IntCast<size_t>(decompressed_size),
+                         IntCast<size_t>(decompressed_size),
+                         IntCast<size_t>(decompressed_size));
+  size_t result;
+  if (zstd_dictionary != nullptr) {
+    const ZSTD_DDict* const ddict =
+        zstd_dictionary->PrepareDecompressionDictionary();
+    if (ABSL_PREDICT_FALSE(ddict == nullptr)) {
+      *error_message = "ZSTD_createDDict_byReference() failed";
+      return false;
+    }
+    result = ZSTD_decompress_usingDDict(decompressor.get(), buffer.data(),
+                                        buffer.size(), compressed.data(),
+                                        compressed.size(), ddict);
+    if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
+      *error_message = absl::StrCat("ZSTD_decompress_usingDDict() failed: ",
+                                    ZSTD_getErrorName(result));
+      return false;
+    }
+  } else {
+    result = ZSTD_decompressDCtx(decompressor.get(), buffer.data(),
+                                 buffer.size(), compressed.data(),
+                                 compressed.size());
+    if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
+      *error_message = absl::StrCat("ZSTD_decompressDCtx() failed: ",
+                                    ZSTD_getErrorName(result));
+      return false;
+    }
+  }
+  dest->RemoveSuffix(buffer.size() - result);
+  if (ABSL_PREDICT_FALSE(result != decompressed_size)) {
+    *error_message =
+        absl::StrCat("Decompressed size mismatch: expected ",
+                     decompressed_size, ", Zstd-compressed stream has ",
+                     result);
+    return false;
+  }
+  return true;
+}
+
+bool SnappyDecompress(Reader* src, uint64_t decompressed_size, Chain* dest,
+                      std::string* error_message) {
+  dest->Clear();
+  // Snappy stores the decompressed size as varint32.
+  if (ABSL_PREDICT_FALSE(decompressed_size >
+                         std::numeric_limits<uint32_t>::max())) {
+    *error_message =
+        absl::StrCat("Decompressed size too large for Snappy: ",
+                     decompressed_size);
+    return false;
+  }
+  // Snappy uses the compressed size only as an estimate when decompressing, so
+  // without random access what is buffered suffices.
+  Position compressed_size = src->available();
+  if (src->SupportsRandomAccess()) {
+    Position src_size;
+    if (ABSL_PREDICT_FALSE(!src->Size(&src_size))) {
+      *error_message = std::string(src->message());
+      return false;
+    }
+    RIEGELI_ASSERT_GE(src_size, src->pos())
+        << "Current position after the end of source";
+    compressed_size = src_size - src->pos();
+  }
+  ReaderSnappySource source(src, compressed_size);
+  // The sink appends the first buffer requested by Snappy, which is as large
+  // as the whole decompressed data, as a single block of decompressed_size.
+  ChainSnappySink sink(dest, IntCast<size_t>(decompressed_size));
+  const bool ok = snappy::Uncompress(&source, &sink);
+  if (ABSL_PREDICT_FALSE(!src->healthy())) {
+    *error_message = std::string(src->message());
+    return false;
+  }
+  if (ABSL_PREDICT_FALSE(!ok)) {
+    *error_message = "Invalid Snappy-compressed stream";
+    return false;
+  }
+  if (ABSL_PREDICT_FALSE(dest->size() != decompressed_size)) {
+    *error_message = absl::StrCat(
+        "Decompressed size mismatch: expected ", decompressed_size,
+        ", Snappy-compressed stream has ", dest->size());
+    return false;
+  }
+  return true;
+}
+
 template class Decompressor<Reader*>;
 template class Decompressor<std::unique_ptr<Reader>>;
 
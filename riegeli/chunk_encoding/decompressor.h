@@ -17,6 +17,7 @@
 
 #include <stdint.h>
 #include <memory>
+#include <string>
 #include <utility>
 
 #include "absl/base/optimization.h"
@@ -27,8 +28,11 @@
 #include "riegeli/base/dependency.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/brotli_reader.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/lz4_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/reader_utils.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "riegeli/bytes/zstd_reader.h"
 #include "riegeli/chunk_encoding/constants.h"
 
@@ -48,6 +52,67 @@ bool UncompressedSize(const Chain& compressed_data,
                       CompressionType compression_type,
                       uint64_t* uncompressed_size);
 
+// Brotli-compressed and Zstd-compressed streams with the stored decompressed
+// size up to this are decompressed in one shot into a single Chain block,
+// avoiding copying decompressed data. Larger streams are decompressed
+// incrementally: a large block would usually be fresh memory from the operating
+// system, and faulting it in costs more than the copy being avoided.
+constexpr uint64_t kMaxOneShotDecompressedSize = uint64_t{4} << 20;
+
+// Whether Decompressor may decompress the whole stream up front.
+enum class DecompressionMode {
+  // Decompress in one shot when this is expected to be faster: Snappy always,
+  // Brotli and Zstd up to kMaxOneShotDecompressedSize. Suitable when all
+  // decompressed data will be read.
+  kAuto,
+  // Decompress Brotli and Zstd incrementally, as data are read, so that
+  // stopping early skips the work for the rest of the stream. Snappy is still
+  // decompressed in one shot, as there is no incremental Snappy reader.
+  kIncremental,
+};
+
+// Decompresses Brotli-compressed data from *src until its end, replacing *dest.
+//
+// decompressed_size must be the decompressed size stored before compressed
+// data. The data are decompressed straight into a Chain block of that size.
+//
+// Return values:
+//  * true  - success (*dest is set)
+//  * false - failure (*error_message is set)
+bool BrotliDecompress(Reader* src, uint64_t decompressed_size, Chain* dest,
+                      std::string* error_message);
+
+// Decompresses Zstd-compressed data from *src until its end, replacing *dest.
+//
+// decompressed_size must be the decompressed size stored before compressed
+// data. The data are decompressed in one shot straight into a Chain block of
+// that size. Compressed data are copied to a flat array first only if *src
+// does not have them contiguous.
+//
+// zstd_dictionary must be the same as the dictionary used for compression, or
+// nullptr if none was used.
+//
+// Precondition: src->SupportsRandomAccess()
+//
+// Return values:
+//  * true  - success (*dest is set)
+//  * false - failure (*error_message is set)
+bool ZstdDecompress(
+    Reader* src, uint64_t decompressed_size,
+    const std::shared_ptr<const ZstdDictionary>& zstd_dictionary, Chain* dest,
+    std::string* error_message);
+
+// Decompresses Snappy-compressed data from *src until its end, replacing *dest.
+//
+// decompressed_size must be the decompressed size stored before compressed
+// data. The data are decompressed straight into a Chain block of that size.
+//
+// Return values:
+//  * true  - success (*dest is set)
+//  * false - failure (*error_message is set)
+bool SnappyDecompress(Reader* src, uint64_t decompressed_size, Chain* dest,
+                      std::string* error_message);
+
 template <typename Src = Reader*>
 class Decompressor : public Object {
  public:
@@ -58,7 +123,20 @@ class Decompressor : public Object {
   //
   // If compression_type is not kNone, reads uncompressed size as a varint from
   // the beginning of compressed data.
-  explicit Decompressor(Src src, CompressionType compression_type);
+  //
+  // If compression_type is kSnappy, or mode is kAuto and compression_type is
+  // kBrotli with uncompressed size up to kMaxOneShotDecompressedSize, or kZstd
+  // with uncompressed size up to kMaxOneShotDecompressedSize and src supporting
+  // random access, the whole compressed stream is decompressed by the
+  // constructor, straight into a single Chain block of the uncompressed size,
+  // and src is closed if owned.
+  //
+  // zstd_dictionary is used if compression_type is kZstd. It must be the same
+  // as the dictionary used for compression, or nullptr if none was used.
+  explicit Decompressor(
+      Src src, CompressionType compression_type,
+      std::shared_ptr<const ZstdDictionary> zstd_dictionary = nullptr,
+      DecompressionMode mode = DecompressionMode::kAuto);
 
   Decompressor(Decompressor&& that) noexcept;
   Decompressor& operator=(Decompressor&& that) noexcept;
@@ -87,14 +165,25 @@ class Decompressor : public Object {
   void Done() override;
 
  private:
-  absl::variant<Dependency<Reader*, Src>, BrotliReader<Src>, ZstdReader<Src>>
+  // Makes decompressed data available for reading, closing compressed_reader
+  // if it is owned.
+  void SetDecompressed(Dependency<Reader*, Src>* compressed_reader,
+                       Chain decompressed);
+
+  // ChainReader<Chain> reads data which were already decompressed by the
+  // constructor.
+  absl::variant<Dependency<Reader*, Src>, BrotliReader<Src>, ZstdReader<Src>,
+                Lz4Reader<Src>, ChainReader<Chain>>
       reader_;
 };
 
 // Implementation details follow.
 
 template <typename Src>
-Decompressor<Src>::Decompressor(Src src, CompressionType compression_type)
+Decompressor<Src>::Decompressor(
+    Src src, CompressionType compression_type,
+    std::shared_ptr<const ZstdDictionary> zstd_dictionary,
+    DecompressionMode mode)
     : Object(State::kOpen) {
   Dependency<Reader*, Src> compressed_reader(std::move(src));
   if (compression_type == CompressionType::kNone) {
@@ -110,17 +199,77 @@ Decompressor<Src>::Decompressor(Src src, CompressionType compression_type)
   switch (compression_type) {
     case CompressionType::kNone:
       RIEGELI_ASSERT_UNREACHABLE() << "kNone handled above";
-    case CompressionType::kBrotli:
-      reader_ = BrotliReader<Src>(std::move(compressed_reader.manager()));
+    case CompressionType::kBrotli: {
+      if (mode == DecompressionMode::kIncremental ||
+          decompressed_size > kMaxOneShotDecompressedSize) {
+        reader_ = BrotliReader<Src>(std::move(compressed_reader.manager()));
+        return;
+      }
+      Chain decompressed;
+      std::string error_message;
+      if (ABSL_PREDICT_FALSE(!BrotliDecompress(compressed_reader.ptr(),
+                                               decompressed_size, &decompressed,
+                                               &error_message))) {
+        Fail(error_message);
+        return;
+      }
+      SetDecompressed(&compressed_reader, std::move(decompressed));
+      return;
+    }
+    case CompressionType::kZstd: {
+      if (mode == DecompressionMode::kIncremental ||
+          decompressed_size > kMaxOneShotDecompressedSize ||
+          !compressed_reader->SupportsRandomAccess()) {
+        reader_ = ZstdReader<Src>(
+            std::move(compressed_reader.manager()),
+            ZstdReaderBase::Options().set_dictionary(
+                std::move(zstd_dictionary)));
+        return;
+      }
+      Chain decompressed;
+      std::string error_message;
+      if (ABSL_PREDICT_FALSE(!ZstdDecompress(
+              compressed_reader.ptr(), decompressed_size, zstd_dictionary,
+              &decompressed, &error_message))) {
+        Fail(error_message);
+        return;
+      }
+      SetDecompressed(&compressed_reader, std::move(decompressed));
+      return;
+    }
+    case CompressionType::kLz4:
+      reader_ = Lz4Reader<Src>(std::move(compressed_reader.manager()));
       return;
-    case CompressionType::kZstd:
-      reader_ = ZstdReader<Src>(std::move(compressed_reader.manager()));
+    case CompressionType::kSnappy: {
+      Chain decompressed;
+      std::string error_message;
+      if (ABSL_PREDICT_FALSE(!SnappyDecompress(compressed_reader.ptr(),
+                                               decompressed_size, &decompressed,
+                                               &error_message))) {
+        Fail(error_message);
+        return;
+      }
+      SetDecompressed(&compressed_reader, std::move(decompressed));
       return;
+    }
   }
   Fail(absl::StrCat("Unknown compression type: ",
                     static_cast<unsigned>(compression_type)));
 }
 
+template <typename Src>
+void Decompressor<Src>::SetDecompressed(
+    Dependency<Reader*, Src>* compressed_reader, Chain decompressed) {
+  if (compressed_reader->kIsOwning()) {
+    Reader* const src = compressed_reader->ptr();
+    if (ABSL_PREDICT_FALSE(!src->Close())) {
+      Fail(*src);
+      return;
+    }
+  }
+  reader_ = ChainReader<Chain>(std::move(decompressed));
+}
+
 template <typename Src>
 inline Decompressor<Src>::Decompressor(Decompressor&& that) noexcept
     : Object(std::move(that)), reader_(std::move(that.reader_)) {}
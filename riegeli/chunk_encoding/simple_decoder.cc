@@ -17,6 +17,8 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <limits>
+#include <memory>
+#include <vector>
 
 #include "absl/base/optimization.h"
 #include "riegeli/base/base.h"
@@ -24,6 +26,7 @@
 #include "riegeli/bytes/limiting_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/reader_utils.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "riegeli/chunk_encoding/constants.h"
 #include "riegeli/chunk_encoding/decompressor.h"
 
@@ -35,9 +38,10 @@ void SimpleDecoder::Done() {
   }
 }
 
-bool SimpleDecoder::Reset(Reader* src, uint64_t num_records,
-                          uint64_t decoded_data_size,
-                          std::vector<size_t>* limits) {
+bool SimpleDecoder::Reset(
+    Reader* src, uint64_t num_records, uint64_t decoded_data_size,
+    const std::shared_ptr<const ZstdDictionary>& zstd_dictionary,
+    std::vector<size_t>* limits) {
   MarkHealthy();
   if (ABSL_PREDICT_FALSE(num_records > limits->max_size())) {
     return Fail("Too many records");
@@ -64,22 +68,30 @@ bool SimpleDecoder::Reset(Reader* src, uint64_t num_records,
     return Fail("Size of sizes too large");
   }
   internal::Decompressor<LimitingReader> sizes_decompressor(
-      LimitingReader(src, src->pos() + sizes_size), compression_type);
+      LimitingReader(src, src->pos() + sizes_size), compression_type,
+      zstd_dictionary);
   if (ABSL_PREDICT_FALSE(!sizes_decompressor.healthy())) {
     return Fail(sizes_decompressor);
   }
   limits->clear();
   size_t limit = 0;
+  // Sizes are decoded in batches to benefit from ReadVarints64().
+  constexpr size_t kBatchSize = 256;
+  uint64_t sizes[kBatchSize];
   while (limits->size() != num_records) {
-    uint64_t size;
-    if (ABSL_PREDICT_FALSE(!ReadVarint64(sizes_decompressor.reader(), &size))) {
+    const size_t batch_size =
+        UnsignedMin(IntCast<size_t>(num_records) - limits->size(), kBatchSize);
+    if (ABSL_PREDICT_FALSE(
+            !ReadVarints64(sizes_decompressor.reader(), batch_size, sizes))) {
       return Fail("Reading record size failed", *sizes_decompressor.reader());
     }
-    if (ABSL_PREDICT_FALSE(size > decoded_data_size - limit)) {
-      return Fail("Decoded data size larger than expected");
+    for (size_t i = 0; i < batch_size; ++i) {
+      if (ABSL_PREDICT_FALSE(sizes[i] > decoded_data_size - limit)) {
+        return Fail("Decoded data size larger than expected");
+      }
+      limit += IntCast<size_t>(sizes[i]);
+      limits->push_back(limit);
     }
-    limit += IntCast<size_t>(size);
-    limits->push_back(limit);
   }
   if (ABSL_PREDICT_FALSE(!sizes_decompressor.VerifyEndAndClose())) {
     return Fail(sizes_decompressor);
@@ -88,7 +100,8 @@ bool SimpleDecoder::Reset(Reader* src, uint64_t num_records,
     return Fail("Decoded data size smaller than expected");
   }
 
-  values_decompressor_ = internal::Decompressor<>(src, compression_type);
+  values_decompressor_ =
+      internal::Decompressor<>(src, compression_type, zstd_dictionary);
   if (ABSL_PREDICT_FALSE(!values_decompressor_.healthy())) {
     return Fail(values_decompressor_);
   }
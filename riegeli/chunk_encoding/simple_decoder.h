@@ -17,11 +17,13 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <memory>
 #include <vector>
 
 #include "riegeli/base/base.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "riegeli/chunk_encoding/decompressor.h"
 
 namespace riegeli {
@@ -38,6 +40,9 @@ class SimpleDecoder : public Object {
   // Makes concatenated record values available for reading from reader().
   // Sets *limits to sorted record end positions.
   //
+  // zstd_dictionary is the dictionary used for compression with zstd, or
+  // nullptr if none was used.
+  //
   // src is not owned by this SimpleDecoder and must be kept alive but not
   // accessed until closing the SimpleDecoder.
   //
@@ -45,6 +50,7 @@ class SimpleDecoder : public Object {
   //  * true  - success (healthy())
   //  * false - failure (!healthy())
   bool Reset(Reader* src, uint64_t num_records, uint64_t decoded_data_size,
+             const std::shared_ptr<const ZstdDictionary>& zstd_dictionary,
              std::vector<size_t>* limits);
 
   // Returns the Reader from which concatenated record values should be read.
@@ -131,18 +131,26 @@ bool SimpleEncoder::AddRecords(Chain records, std::vector<size_t> limits) {
   num_records_ += IntCast<uint64_t>(limits.size());
   decoded_data_size_ += IntCast<uint64_t>(records.size());
   size_t start = 0;
-  for (const size_t limit : limits) {
-    RIEGELI_ASSERT_GE(limit, start)
-        << "Failed precondition of ChunkEncoder::AddRecords(): "
-           "record end positions not sorted";
-    RIEGELI_ASSERT_LE(limit, records.size())
-        << "Failed precondition of ChunkEncoder::AddRecords(): "
-           "record end positions do not match concatenated record values";
-    if (ABSL_PREDICT_FALSE(!WriteVarint64(sizes_compressor_.writer(),
-                                          IntCast<uint64_t>(limit - start)))) {
+  // Sizes are encoded in batches to benefit from WriteVarints64().
+  constexpr size_t kBatchSize = 256;
+  uint64_t sizes[kBatchSize];
+  for (size_t index = 0; index < limits.size(); index += kBatchSize) {
+    const size_t batch_size = UnsignedMin(limits.size() - index, kBatchSize);
+    for (size_t i = 0; i < batch_size; ++i) {
+      const size_t limit = limits[index + i];
+      RIEGELI_ASSERT_GE(limit, start)
+          << "Failed precondition of ChunkEncoder::AddRecords(): "
+             "record end positions not sorted";
+      RIEGELI_ASSERT_LE(limit, records.size())
+          << "Failed precondition of ChunkEncoder::AddRecords(): "
+             "record end positions do not match concatenated record values";
+      sizes[i] = IntCast<uint64_t>(limit - start);
+      start = limit;
+    }
+    if (ABSL_PREDICT_FALSE(
+            !WriteVarints64(sizes_compressor_.writer(), sizes, batch_size))) {
       return Fail(*sizes_compressor_.writer());
     }
-    start = limit;
   }
   if (ABSL_PREDICT_FALSE(
           !values_compressor_.writer()->Write(std::move(records)))) {
@@ -17,7 +17,10 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <cstring>
+#include <deque>
+#include <future>
 #include <limits>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -30,6 +33,7 @@
 #include "riegeli/base/chain.h"
 #include "riegeli/base/memory.h"
 #include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/backward_writer_utils.h"
 #include "riegeli/bytes/chain_reader.h"
@@ -38,10 +42,22 @@
 #include "riegeli/bytes/reader_utils.h"
 #include "riegeli/bytes/string_reader.h"
 #include "riegeli/bytes/writer_utils.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "riegeli/chunk_encoding/constants.h"
 #include "riegeli/chunk_encoding/decompressor.h"
 #include "riegeli/chunk_encoding/transpose_internal.h"
 
+// Decode() dispatches callbacks using computed goto, which is supported by GCC
+// and Clang, or using a switch statement otherwise. The switch can be forced by
+// defining RIEGELI_TRANSPOSE_DECODER_COMPUTED_GOTO to 0, e.g. for benchmarking.
+#ifndef RIEGELI_TRANSPOSE_DECODER_COMPUTED_GOTO
+#ifdef __GNUC__
+#define RIEGELI_TRANSPOSE_DECODER_COMPUTED_GOTO 1
+#else
+#define RIEGELI_TRANSPOSE_DECODER_COMPUTED_GOTO 0
+#endif
+#endif
+
 namespace riegeli {
 
 namespace {
@@ -56,17 +72,34 @@ Reader* kEmptyReader() {
 constexpr uint32_t kInvalidPos = std::numeric_limits<uint32_t>::max();
 
 // Information about one data bucket used in projection.
+//
+// A bucket is decompressed on demand, only up to the last buffer needed so far,
+// and released as soon as no state machine node can need more of its buffers.
 struct DataBucket {
-  // Contains sizes of data buffers in the bucket if "decompressed" is false.
+  // Sizes of data buffers in the bucket, until all of them are decompressed.
   std::vector<size_t> buffer_sizes;
-  // Decompressed data buffers if "decompressed" is true.
+  // Decompressed data buffers, a prefix of all buffers in the bucket. When
+  // decompression starts, capacity is reserved for all buffers, so that
+  // pointers to elements remain valid.
   std::vector<ChainReader<Chain>> buffers;
-  // Raw bucket data.
+  // Raw bucket data, until decompression starts.
   Chain compressed_data;
-  // True if the bucket was already decompressed.
-  bool decompressed = false;
+  // Decompressor of the remaining buffers, open after decompression starts and
+  // until all buffers are decompressed or the bucket is released.
+  internal::Decompressor<ChainReader<Chain>> decompressor;
+  // Number of state machine nodes reading from this bucket whose callback type
+  // is not set yet. When this drops to zero, no more buffers will be needed.
+  size_t num_unresolved_nodes = 0;
 };
 
+// Frees compressed data and decompression state of "bucket" when no more of its
+// buffers will be needed. Buffers decompressed so far are kept.
+void ReleaseBucket(DataBucket* bucket) {
+  bucket->buffer_sizes = std::vector<size_t>();
+  bucket->compressed_data = Chain();
+  bucket->decompressor = internal::Decompressor<ChainReader<Chain>>();
+}
+
 // Should the data content of the field be decoded?
 enum class FieldIncluded {
   kYes,
@@ -74,6 +107,44 @@ enum class FieldIncluded {
   kExistenceOnly,
 };
 
+// Buckets with at least this compressed size are decompressed in background if
+// a chunk has several of them. Decompressing a smaller bucket is not worth
+// the overhead of scheduling.
+constexpr size_t kMinBucketSizeForParallelism = size_t{64} << 10;
+
+// The maximum number of buckets of one chunk decompressed concurrently in
+// background.
+constexpr size_t kMaxBucketParallelism = 16;
+
+// The result of decompressing a bucket.
+struct DecompressedBucket {
+  bool ok = false;
+  Chain data;
+  std::string message;
+};
+
+DecompressedBucket DecompressBucket(
+    Chain compressed_data, CompressionType compression_type,
+    std::shared_ptr<const ZstdDictionary> zstd_dictionary) {
+  DecompressedBucket result;
+  internal::Decompressor<ChainReader<Chain>> decompressor(
+      ChainReader<Chain>(std::move(compressed_data)), compression_type,
+      std::move(zstd_dictionary));
+  if (ABSL_PREDICT_TRUE(decompressor.healthy())) {
+    Reader* const reader = decompressor.reader();
+    while (reader->Pull()) {
+      const size_t length = reader->available();
+      if (ABSL_PREDICT_FALSE(!reader->Read(&result.data, length))) break;
+    }
+    if (ABSL_PREDICT_TRUE(decompressor.VerifyEndAndClose())) {
+      result.ok = true;
+      return result;
+    }
+  }
+  result.message = std::string(decompressor.message());
+  return result;
+}
+
 // Return true if "tag" is a valid protocol buffer tag.
 bool ValidTag(uint32_t tag) {
   switch (static_cast<internal::WireType>(tag & 7)) {
@@ -94,9 +165,9 @@ bool ValidTag(uint32_t tag) {
 namespace internal {
 
 // The types of callbacks in state machine states.
-// NOTE: CallbackType is used to index labels array in DecodeToBuffer method so
-// the ordering of CallbackType must not change without a corresponding change
-// in DecodeToBuffer.
+// NOTE: CallbackType is used to index labels array in Decode() method so the
+// ordering of CallbackType must not change without a corresponding change in
+// Decode().
 enum class CallbackType : uint8_t {
   kNoOp,
   kMessageStart,
@@ -344,6 +415,8 @@ inline bool IsImplicit(CallbackType callback_type) {
 struct TransposeDecoder::Context {
   // Compression type of the input.
   CompressionType compression_type = CompressionType::kNone;
+  // Zstd dictionary used for compression, or nullptr if none.
+  std::shared_ptr<const ZstdDictionary> zstd_dictionary;
   // Buffer containing all the data.
   // Note: Used only when projection is disabled.
   std::vector<ChainReader<Chain>> buffers;
@@ -371,11 +444,11 @@ struct TransposeDecoder::Context {
   std::vector<StateMachineNodeTemplate> node_templates;
 };
 
-bool TransposeDecoder::Reset(Reader* src, uint64_t num_records,
-                             uint64_t decoded_data_size,
-                             const FieldProjection& field_projection,
-                             BackwardWriter* dest,
-                             std::vector<size_t>* limits) {
+bool TransposeDecoder::Reset(
+    Reader* src, uint64_t num_records, uint64_t decoded_data_size,
+    const FieldProjection& field_projection,
+    const std::shared_ptr<const ZstdDictionary>& zstd_dictionary,
+    BackwardWriter* dest, std::vector<size_t>* limits) {
   RIEGELI_ASSERT_EQ(dest->pos(), 0u)
       << "Failed precondition of TransposeDecoder::Reset(): "
          "non-zero destination position";
@@ -389,7 +462,10 @@ bool TransposeDecoder::Reset(Reader* src, uint64_t num_records,
   }
 
   Context context;
-  if (ABSL_PREDICT_FALSE(!Parse(&context, src, field_projection))) return false;
+  if (ABSL_PREDICT_FALSE(
+          !Parse(&context, src, field_projection, zstd_dictionary))) {
+    return false;
+  }
   LimitingBackwardWriter limiting_dest(dest, decoded_data_size);
   if (ABSL_PREDICT_FALSE(
           !Decode(&context, num_records, &limiting_dest, limits))) {
@@ -406,8 +482,9 @@ bool TransposeDecoder::Reset(Reader* src, uint64_t num_records,
   return true;
 }
 
-inline bool TransposeDecoder::Parse(Context* context, Reader* src,
-                                    const FieldProjection& field_projection) {
+inline bool TransposeDecoder::Parse(
+    Context* context, Reader* src, const FieldProjection& field_projection,
+    const std::shared_ptr<const ZstdDictionary>& zstd_dictionary) {
   const bool projection_enabled = !field_projection.includes_all();
   if (projection_enabled) {
     for (const Field& include_field : field_projection.fields()) {
@@ -432,6 +509,7 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
   }
   context->compression_type =
       static_cast<CompressionType>(compression_type_byte);
+  context->zstd_dictionary = zstd_dictionary;
 
   uint64_t header_size;
   if (ABSL_PREDICT_FALSE(!ReadVarint64(src, &header_size))) {
@@ -442,7 +520,8 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
     return Fail("Reading header failed", *src);
   }
   internal::Decompressor<ChainReader<>> header_decompressor(
-      (ChainReader<>(&header)), context->compression_type);
+      (ChainReader<>(&header)), context->compression_type,
+      context->zstd_dictionary);
   if (ABSL_PREDICT_FALSE(!header_decompressor.healthy())) {
     return Fail(header_decompressor);
   }
@@ -586,6 +665,7 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
               return Fail("Buffer index too large");
             }
             const uint32_t bucket = bucket_indices[buffer_index];
+            ++context->buckets[bucket].num_unresolved_nodes;
             context->node_templates[i].bucket_index = bucket;
             context->node_templates[i].buffer_within_bucket_index =
                 buffer_index - first_buffer_indices[bucket];
@@ -663,6 +743,12 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
     }
   }
 
+  if (projection_enabled) {
+    for (DataBucket& bucket : context->buckets) {
+      if (bucket.num_unresolved_nodes == 0) ReleaseBucket(&bucket);
+    }
+  }
+
   if (ABSL_PREDICT_FALSE(
           !ReadVarint32(header_decompressor.reader(), &context->first_node))) {
     return Fail("Reading first node index failed",
@@ -684,8 +770,8 @@ inline bool TransposeDecoder::Parse(Context* context, Reader* src,
   if (ABSL_PREDICT_FALSE(!header_decompressor.VerifyEndAndClose())) {
     return Fail(header_decompressor);
   }
-  context->transitions =
-      internal::Decompressor<>(src, context->compression_type);
+  context->transitions = internal::Decompressor<>(
+      src, context->compression_type, context->zstd_dictionary);
   if (ABSL_PREDICT_FALSE(!context->transitions.healthy())) {
     return Fail(context->transitions);
   }
@@ -710,11 +796,11 @@ inline bool TransposeDecoder::ParseBuffers(Context* context,
     return true;
   }
   context->buffers.reserve(num_buffers);
-  std::vector<internal::Decompressor<ChainReader<Chain>>> bucket_decompressors;
-  if (ABSL_PREDICT_FALSE(num_buckets > bucket_decompressors.max_size())) {
+  std::vector<Chain> buckets;
+  if (ABSL_PREDICT_FALSE(num_buckets > buckets.max_size())) {
     return Fail("Too many buckets");
   }
-  bucket_decompressors.reserve(num_buckets);
+  buckets.reserve(num_buckets);
   for (uint32_t bucket_index = 0; bucket_index < num_buckets; ++bucket_index) {
     uint64_t bucket_length;
     if (ABSL_PREDICT_FALSE(!ReadVarint64(header_reader, &bucket_length))) {
@@ -724,19 +810,20 @@ inline bool TransposeDecoder::ParseBuffers(Context* context,
                            std::numeric_limits<size_t>::max())) {
       return Fail("Bucket too large");
     }
-    Chain bucket;
+    buckets.emplace_back();
     if (ABSL_PREDICT_FALSE(
-            !src->Read(&bucket, IntCast<size_t>(bucket_length)))) {
+            !src->Read(&buckets.back(), IntCast<size_t>(bucket_length)))) {
       return Fail("Reading bucket failed", *src);
     }
-    bucket_decompressors.emplace_back(ChainReader<Chain>(std::move(bucket)),
-                                      context->compression_type);
-    if (ABSL_PREDICT_FALSE(!bucket_decompressors.back().healthy())) {
-      return Fail(bucket_decompressors.back());
-    }
+  }
+  if (ABSL_PREDICT_FALSE(
+          !DecompressBuckets(context->compression_type,
+                             context->zstd_dictionary, &buckets))) {
+    return false;
   }
 
   uint32_t bucket_index = 0;
+  ChainReader<> bucket_reader(&buckets[bucket_index]);
   for (size_t buffer_index = 0; buffer_index < num_buffers; ++buffer_index) {
     uint64_t buffer_length;
     if (ABSL_PREDICT_FALSE(!ReadVarint64(header_reader, &buffer_length))) {
@@ -747,27 +834,90 @@ inline bool TransposeDecoder::ParseBuffers(Context* context,
       return Fail("Buffer too large");
     }
     Chain buffer;
-    if (ABSL_PREDICT_FALSE(!bucket_decompressors[bucket_index].reader()->Read(
-            &buffer, IntCast<size_t>(buffer_length)))) {
-      return Fail("Reading buffer failed",
-                  *bucket_decompressors[bucket_index].reader());
+    if (ABSL_PREDICT_FALSE(
+            !bucket_reader.Read(&buffer, IntCast<size_t>(buffer_length)))) {
+      return Fail("Reading buffer failed", bucket_reader);
     }
     context->buffers.emplace_back(std::move(buffer));
-    while (!bucket_decompressors[bucket_index].reader()->Pull() &&
-           bucket_index + 1 < num_buckets) {
-      if (ABSL_PREDICT_FALSE(
-              !bucket_decompressors[bucket_index].VerifyEndAndClose())) {
-        return Fail(bucket_decompressors[bucket_index]);
+    while (!bucket_reader.Pull() && bucket_index + 1 < num_buckets) {
+      if (ABSL_PREDICT_FALSE(!bucket_reader.VerifyEndAndClose())) {
+        return Fail(bucket_reader);
       }
       ++bucket_index;
+      bucket_reader = ChainReader<>(&buckets[bucket_index]);
     }
   }
   if (ABSL_PREDICT_FALSE(bucket_index + 1 < num_buckets)) {
     return Fail("Too few buckets");
   }
-  if (ABSL_PREDICT_FALSE(
-          !bucket_decompressors[bucket_index].VerifyEndAndClose())) {
-    return Fail(bucket_decompressors[bucket_index]);
+  if (ABSL_PREDICT_FALSE(!bucket_reader.VerifyEndAndClose())) {
+    return Fail(bucket_reader);
+  }
+  return true;
+}
+
+inline bool TransposeDecoder::DecompressBuckets(
+    CompressionType compression_type,
+    const std::shared_ptr<const ZstdDictionary>& zstd_dictionary,
+    std::vector<Chain>* buckets) {
+  if (compression_type == CompressionType::kNone) return true;
+  // Large buckets other than the first one are decompressed in background,
+  // the rest is decompressed here in the meantime.
+  std::vector<size_t> background_buckets;
+  bool first_large_bucket = true;
+  for (size_t bucket_index = 0; bucket_index < buckets->size();
+       ++bucket_index) {
+    if ((*buckets)[bucket_index].size() >= kMinBucketSizeForParallelism) {
+      if (first_large_bucket) {
+        first_large_bucket = false;
+      } else {
+        background_buckets.push_back(bucket_index);
+      }
+    }
+  }
+
+  // Background tasks own their data, so that pending tasks may outlive this
+  // TransposeDecoder if decompressing another bucket fails.
+  struct BucketTask {
+    CompressionType compression_type;
+    std::shared_ptr<const ZstdDictionary> zstd_dictionary;
+    Chain compressed_data;
+    std::promise<DecompressedBucket> decompressed;
+  };
+  std::deque<std::future<DecompressedBucket>> pending;
+  size_t next_background = 0;
+  size_t next_pending = 0;
+  for (size_t bucket_index = 0; bucket_index < buckets->size();
+       ++bucket_index) {
+    while (next_background < background_buckets.size() &&
+           pending.size() < kMaxBucketParallelism) {
+      BucketTask* const task = new BucketTask();
+      task->compression_type = compression_type;
+      task->zstd_dictionary = zstd_dictionary;
+      task->compressed_data =
+          std::move((*buckets)[background_buckets[next_background++]]);
+      pending.push_back(task->decompressed.get_future());
+      internal::DefaultThreadPool().Schedule([task] {
+        task->decompressed.set_value(DecompressBucket(
+            std::move(task->compressed_data), task->compression_type,
+            std::move(task->zstd_dictionary)));
+        delete task;
+      });
+    }
+    DecompressedBucket decompressed;
+    if (next_pending < background_buckets.size() &&
+        background_buckets[next_pending] == bucket_index) {
+      ++next_pending;
+      decompressed = pending.front().get();
+      pending.pop_front();
+    } else {
+      decompressed = DecompressBucket(std::move((*buckets)[bucket_index]),
+                                      compression_type, zstd_dictionary);
+    }
+    if (ABSL_PREDICT_FALSE(!decompressed.ok)) {
+      return Fail(decompressed.message);
+    }
+    (*buckets)[bucket_index] = std::move(decompressed.data);
   }
   return true;
 }
@@ -862,36 +1012,40 @@ inline Reader* TransposeDecoder::GetBuffer(Context* context,
   RIEGELI_ASSERT_LT(bucket_index, context->buckets.size())
       << "Bucket index out of range";
   DataBucket& bucket = context->buckets[bucket_index];
-  if (bucket.decompressed) {
-    RIEGELI_ASSERT_LT(index_within_bucket, bucket.buffers.size())
-        << "Index within bucket out of range";
-  } else {
-    RIEGELI_ASSERT_LT(index_within_bucket, bucket.buffer_sizes.size())
-        << "Index within bucket out of range";
-    internal::Decompressor<ChainReader<>> decompressor(
-        (ChainReader<>(&bucket.compressed_data)), context->compression_type);
-    if (ABSL_PREDICT_FALSE(!decompressor.healthy())) {
-      Fail(decompressor);
+  if (index_within_bucket < bucket.buffers.size()) {
+    return &bucket.buffers[index_within_bucket];
+  }
+  RIEGELI_ASSERT_LT(index_within_bucket, bucket.buffer_sizes.size())
+      << "Index within bucket out of range";
+  if (bucket.buffers.empty()) {
+    // Decompress incrementally, so that buffers past the last one needed are
+    // not decompressed at all.
+    bucket.decompressor = internal::Decompressor<ChainReader<Chain>>(
+        ChainReader<Chain>(std::move(bucket.compressed_data)),
+        context->compression_type, context->zstd_dictionary,
+        internal::DecompressionMode::kIncremental);
+    if (ABSL_PREDICT_FALSE(!bucket.decompressor.healthy())) {
+      Fail(bucket.decompressor);
       return nullptr;
     }
     bucket.buffers.reserve(bucket.buffer_sizes.size());
-    for (const size_t buffer_size : bucket.buffer_sizes) {
-      Chain buffer;
-      if (ABSL_PREDICT_FALSE(
-              !decompressor.reader()->Read(&buffer, buffer_size))) {
-        Fail("Reading buffer failed", *decompressor.reader());
-        return nullptr;
-      }
-      bucket.buffers.emplace_back(std::move(buffer));
+  }
+  while (bucket.buffers.size() <= index_within_bucket) {
+    Chain buffer;
+    if (ABSL_PREDICT_FALSE(!bucket.decompressor.reader()->Read(
+            &buffer, bucket.buffer_sizes[bucket.buffers.size()]))) {
+      Fail("Reading buffer failed", *bucket.decompressor.reader());
+      return nullptr;
     }
-    if (ABSL_PREDICT_FALSE(!decompressor.VerifyEndAndClose())) {
-      Fail(decompressor);
+    bucket.buffers.emplace_back(std::move(buffer));
+  }
+  if (bucket.buffers.size() == bucket.buffer_sizes.size()) {
+    if (ABSL_PREDICT_FALSE(!bucket.decompressor.VerifyEndAndClose())) {
+      Fail(bucket.decompressor);
       return nullptr;
     }
     // Free memory of fields which are no longer needed.
     bucket.buffer_sizes = std::vector<size_t>();
-    bucket.compressed_data = Chain();
-    bucket.decompressed = true;
   }
   return &bucket.buffers[index_within_bucket];
 }
@@ -1039,6 +1193,9 @@ inline bool TransposeDecoder::Decode(Context* context, uint64_t num_records,
   // reading transition byte.
   int num_iters = 0;
 
+#if RIEGELI_TRANSPOSE_DECODER_COMPUTED_GOTO
+#define GOTO_CALLBACK() goto * node->callback
+
   // NOTE: CallbackType is used to index labels so the ordering of labels
   // must not change without a corresponding change in CallbackType enum.
   static constexpr void* labels[] = {
@@ -1078,19 +1235,98 @@ inline bool TransposeDecoder::Decode(Context* context, uint64_t num_records,
         labels[static_cast<uint8_t>(state.callback_type) &
                ~static_cast<uint8_t>(internal::CallbackType::kImplicit)];
   }
+#else
+#define GOTO_CALLBACK() goto dispatch
+#endif
 
   if (internal::IsImplicit(node->callback_type)) ++num_iters;
-  goto * node->callback;
+  GOTO_CALLBACK();
+
+#if !RIEGELI_TRANSPOSE_DECODER_COMPUTED_GOTO
+dispatch:
+  switch (static_cast<internal::CallbackType>(
+      static_cast<uint8_t>(node->callback_type) &
+      ~static_cast<uint8_t>(internal::CallbackType::kImplicit))) {
+    case internal::CallbackType::kNoOp:
+      goto do_transition;
+    case internal::CallbackType::kMessageStart:
+      goto message_start;
+    case internal::CallbackType::kSubmessageStart:
+      goto submessage_start;
+    case internal::CallbackType::kSubmessageEnd:
+      goto submessage_end;
+    case internal::CallbackType::kSelectCallback:
+      goto select_callback;
+    case internal::CallbackType::kSkippedSubmessageStart:
+      goto skipped_submessage_start;
+    case internal::CallbackType::kSkippedSubmessageEnd:
+      goto skipped_submessage_end;
+    case internal::CallbackType::kNonProto:
+      goto non_proto;
+    case internal::CallbackType::kFailure:
+      goto failure;
+
+#define CASES_FOR_TAG_LEN(tag_length)                                         \
+  case internal::CallbackType::kCopyTag_##tag_length:                         \
+    goto copy_tag_##tag_length;                                               \
+  case internal::CallbackType::kVarint_1_##tag_length:                        \
+    goto varint_1_##tag_length;                                               \
+  case internal::CallbackType::kVarint_2_##tag_length:                        \
+    goto varint_2_##tag_length;                                               \
+  case internal::CallbackType::kVarint_3_##tag_length:                        \
+    goto varint_3_##tag_length;                                               \
+  case internal::CallbackType::kVarint_4_##tag_length:                        \
+    goto varint_4_##tag_length;                                               \
+  case internal::CallbackType::kVarint_5_##tag_length:                        \
+    goto varint_5_##tag_length;                                               \
+  case internal::CallbackType::kVarint_6_##tag_length:                        \
+    goto varint_6_##tag_length;                                               \
+  case internal::CallbackType::kVarint_7_##tag_length:                        \
+    goto varint_7_##tag_length;                                               \
+  case internal::CallbackType::kVarint_8_##tag_length:                        \
+    goto varint_8_##tag_length;                                               \
+  case internal::CallbackType::kVarint_9_##tag_length:                        \
+    goto varint_9_##tag_length;                                               \
+  case internal::CallbackType::kVarint_10_##tag_length:                       \
+    goto varint_10_##tag_length;                                              \
+  case internal::CallbackType::kFixed32_##tag_length:                         \
+    goto fixed32_##tag_length;                                                \
+  case internal::CallbackType::kFixed64_##tag_length:                         \
+    goto fixed64_##tag_length;                                                \
+  case internal::CallbackType::kString_##tag_length:                          \
+    goto string_##tag_length;                                                 \
+  case internal::CallbackType::kStartProjectionGroup_##tag_length:            \
+    goto start_projection_group_##tag_length;                                 \
+  case internal::CallbackType::kEndProjectionGroup_##tag_length:              \
+    goto end_projection_group_##tag_length
+
+      CASES_FOR_TAG_LEN(1);
+      CASES_FOR_TAG_LEN(2);
+      CASES_FOR_TAG_LEN(3);
+      CASES_FOR_TAG_LEN(4);
+      CASES_FOR_TAG_LEN(5);
+#undef CASES_FOR_TAG_LEN
+
+    case internal::CallbackType::kCopyTag_6:
+      goto copy_tag_6;
+    case internal::CallbackType::kUnknown:
+    case internal::CallbackType::kImplicit:
+      goto failure;
+  }
+  goto failure;
+#endif
 
 select_callback:
   if (ABSL_PREDICT_FALSE(!SetCallbackType(context, skipped_submessage_level,
                                           submessage_stack, node))) {
     return false;
   }
+#if RIEGELI_TRANSPOSE_DECODER_COMPUTED_GOTO
   node->callback =
       labels[static_cast<uint8_t>(node->callback_type) &
              ~static_cast<uint8_t>(internal::CallbackType::kImplicit)];
-  goto * node->callback;
+#endif
+  GOTO_CALLBACK();
 
 skipped_submessage_end:
   ++skipped_submessage_level;
@@ -1218,11 +1454,12 @@ do_transition:
     node += (transition_byte >> 2);
     num_iters = transition_byte & 3;
     if (internal::IsImplicit(node->callback_type)) ++num_iters;
-    goto * node->callback;
+    GOTO_CALLBACK();
   } else {
     if (!internal::IsImplicit(node->callback_type)) --num_iters;
-    goto * node->callback;
+    GOTO_CALLBACK();
   }
+#undef GOTO_CALLBACK
 
 done:
   if (ABSL_PREDICT_FALSE(!context->transitions.VerifyEndAndClose())) {
@@ -1343,6 +1580,8 @@ ABSL_ATTRIBUTE_NOINLINE inline bool TransposeDecoder::SetCallbackType(
           node->buffer = kEmptyReader();
           break;
       }
+      DataBucket& bucket = context->buckets[node_template->bucket_index];
+      if (--bucket.num_unresolved_nodes == 0) ReleaseBucket(&bucket);
     } else {
       node->buffer = kEmptyReader();
     }
@@ -17,13 +17,17 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <memory>
 #include <vector>
 
+#include "riegeli/base/chain.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/reader_utils.h"
+#include "riegeli/bytes/zstd_dictionary.h"
+#include "riegeli/chunk_encoding/constants.h"
 #include "riegeli/chunk_encoding/field_projection.h"
 #include "riegeli/chunk_encoding/transpose_internal.h"
 
@@ -45,6 +49,9 @@ class TransposeDecoder : public Object {
   // Writes concatenated record values to *dest. Sets *limits to sorted record
   // end positions.
   //
+  // zstd_dictionary is the dictionary used for compression with zstd, or
+  // nullptr if none was used.
+  //
   // Precondition: dest->pos() == 0
   //
   // Return values:
@@ -52,8 +59,9 @@ class TransposeDecoder : public Object {
   //  * false - failure (!healthy());
   //            if !dest->healthy() then the problem was at dest
   bool Reset(Reader* src, uint64_t num_records, uint64_t decoded_data_size,
-             const FieldProjection& field_projection, BackwardWriter* dest,
-             std::vector<size_t>* limits);
+             const FieldProjection& field_projection,
+             const std::shared_ptr<const ZstdDictionary>& zstd_dictionary,
+             BackwardWriter* dest, std::vector<size_t>* limits);
 
  private:
   // Information about one proto tag.
@@ -94,8 +102,9 @@ class TransposeDecoder : public Object {
   struct StateMachineNode {
     union {
       // Every state has callback assigned to it that performs the state action.
-      // This is an address of a label in DecodeToBuffer method which is filled
-      // when DecodeToBuffer is called.
+      // This is an address of a label in Decode() method which is filled when
+      // Decode() is called. Unused if computed goto is not supported, then
+      // Decode() dispatches on callback_type instead.
       void* callback;
       // Used to verify there are no implicit loops in the state machine.
       size_t implicit_loop_id;
@@ -124,13 +133,21 @@ class TransposeDecoder : public Object {
   struct Context;
 
   bool Parse(Context* context, Reader* src,
-             const FieldProjection& field_projection);
+             const FieldProjection& field_projection,
+             const std::shared_ptr<const ZstdDictionary>& zstd_dictionary);
 
   // Parse data buffers in "header_reader" and "reader" into
   // "context_->buffers". This method is used when projection is disabled and
   // all buffers are initially decompressed.
   bool ParseBuffers(Context* context, Reader* header_reader, Reader* src);
 
+  // Decompress each of "buckets" in place. If there are several large buckets,
+  // they are decompressed in parallel.
+  bool DecompressBuckets(
+      CompressionType compression_type,
+      const std::shared_ptr<const ZstdDictionary>& zstd_dictionary,
+      std::vector<Chain>* buckets);
+
   // Parse data buffers in "header_reader" and "reader" into
   // "context_->data_buckets". When projection is enabled, buckets are
   // decompressed on demand. "bucket_indices" contains bucket index for each
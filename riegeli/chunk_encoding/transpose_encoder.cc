@@ -17,6 +17,8 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <algorithm>
+#include <deque>
+#include <future>
 #include <limits>
 #include <queue>
 #include <string>
@@ -25,11 +27,13 @@
 
 #include "absl/base/optimization.h"
 #include "absl/container/flat_hash_map.h"
+#include "absl/container/node_hash_map.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/backward_writer_utils.h"
 #include "riegeli/bytes/chain_backward_writer.h"
@@ -137,6 +141,23 @@ bool operator<(PriorityQueueEntry a, PriorityQueueEntry b) {
   return a.dest_index < b.dest_index;
 }
 
+// Returns the index of the first element of "field_groups" which includes the
+// field with "reversed_path" (field numbers from the field up to the root), or
+// field_groups.size() if none.
+size_t FindFieldGroup(const std::vector<FieldProjection>& field_groups,
+                      const std::vector<uint32_t>& reversed_path) {
+  for (size_t group = 0; group < field_groups.size(); ++group) {
+    for (const Field& field : field_groups[group].fields()) {
+      if (field.path().size() <= reversed_path.size() &&
+          std::equal(field.path().begin(), field.path().end(),
+                     reversed_path.rbegin())) {
+        return group;
+      }
+    }
+  }
+  return field_groups.size();
+}
+
 }  // namespace
 
 inline TransposeEncoder::MessageNode::MessageNode(
@@ -176,12 +197,16 @@ inline TransposeEncoder::BufferWithMetadata::BufferWithMetadata(
       field(field) {}
 
 TransposeEncoder::TransposeEncoder(CompressorOptions options,
-                                   uint64_t bucket_size)
+                                   uint64_t bucket_size, int parallelism,
+                                   std::vector<FieldProjection> field_groups)
     : compression_type_(options.compression_type()),
       bucket_size_(options.compression_type() == CompressionType::kNone
                        ? std::numeric_limits<uint64_t>::max()
                        : bucket_size),
-      compressor_(options),
+      compressor_options_(options),
+      parallelism_(parallelism),
+      field_groups_(std::move(field_groups)),
+      compressor_(std::move(options)),
       nonproto_lengths_writer_(Chain()) {}
 
 TransposeEncoder::~TransposeEncoder() {}
@@ -195,7 +220,8 @@ void TransposeEncoder::Done() {
     buffers = std::vector<BufferWithMetadata>();
   }
   group_stack_ = std::vector<internal::MessageId>();
-  message_nodes_ = absl::flat_hash_map<NodeId, MessageNode>();
+  message_nodes_ = absl::node_hash_map<NodeId, MessageNode>();
+  tag_cache_ = std::vector<std::vector<TagCacheEntry>>();
   if (ABSL_PREDICT_FALSE(!nonproto_lengths_writer_.Close())) {
     Fail(nonproto_lengths_writer_);
   }
@@ -212,6 +238,7 @@ void TransposeEncoder::Reset() {
   for (std::vector<BufferWithMetadata>& buffers : data_) buffers.clear();
   group_stack_.clear();
   message_nodes_.clear();
+  tag_cache_.clear();
   nonproto_lengths_writer_ = ChainBackwardWriter<Chain>(Chain());
   next_message_id_ = internal::MessageId::kRoot + 1;
 }
@@ -307,30 +334,66 @@ inline bool TransposeEncoder::AddRecordInternal(Reader* record) {
   }
 }
 
-inline BackwardWriter* TransposeEncoder::GetBuffer(
-    internal::MessageId parent_message_id, uint32_t field, BufferType type) {
-  const std::pair<absl::flat_hash_map<NodeId, MessageNode>::iterator, bool>
-      insert_result = message_nodes_.emplace(NodeId(parent_message_id, field),
-                                             MessageNode(next_message_id_));
+inline TransposeEncoder::TagCacheEntry* TransposeEncoder::GetTagCacheEntry(
+    internal::MessageId parent_message_id, uint32_t tag) {
+  if (ABSL_PREDICT_FALSE(tag >= kMaxCachedTag)) return nullptr;
+  const size_t message_index = static_cast<uint32_t>(parent_message_id);
+  if (ABSL_PREDICT_FALSE(message_index >= tag_cache_.size())) {
+    tag_cache_.resize(message_index + 1);
+  }
+  std::vector<TagCacheEntry>& entries = tag_cache_[message_index];
+  if (ABSL_PREDICT_FALSE(tag >= entries.size())) entries.resize(tag + 1);
+  return &entries[tag];
+}
+
+inline TransposeEncoder::MessageNode* TransposeEncoder::GetNode(
+    internal::MessageId parent_message_id, uint32_t tag) {
+  TagCacheEntry* const entry = GetTagCacheEntry(parent_message_id, tag);
+  if (entry != nullptr && ABSL_PREDICT_TRUE(entry->node != nullptr)) {
+    return entry->node;
+  }
+  const std::pair<absl::node_hash_map<NodeId, MessageNode>::iterator, bool>
+      insert_result =
+          message_nodes_.emplace(NodeId(parent_message_id, tag >> 3),
+                                 MessageNode(next_message_id_));
   if (insert_result.second) {
     // New node was added.
     ++next_message_id_;
   }
-  MessageNode& node = insert_result.first->second;
-  if (node.writer == nullptr) {
+  MessageNode* const node = &insert_result.first->second;
+  if (entry != nullptr) entry->node = node;
+  return node;
+}
+
+inline BackwardWriter* TransposeEncoder::GetBuffer(
+    internal::MessageId parent_message_id, uint32_t tag, BufferType type) {
+  MessageNode* const node = GetNode(parent_message_id, tag);
+  if (node->writer == nullptr) {
     std::vector<BufferWithMetadata>& buffers =
         data_[static_cast<uint32_t>(type)];
-    buffers.emplace_back(parent_message_id, field);
-    node.writer =
+    buffers.emplace_back(parent_message_id, tag >> 3);
+    node->writer =
         absl::make_unique<ChainBackwardWriter<>>(buffers.back().buffer.get());
   }
-  return node.writer.get();
+  return node->writer.get();
 }
 
 inline uint32_t TransposeEncoder::GetPosInTagsList(EncodedTag etag) {
+  TagCacheEntry* const entry = GetTagCacheEntry(etag.message_id, etag.tag);
+  const size_t subtype = static_cast<uint8_t>(etag.subtype);
+  if (entry != nullptr && subtype < entry->pos_in_tags_list.size() &&
+      ABSL_PREDICT_TRUE(entry->pos_in_tags_list[subtype] != kInvalidPos)) {
+    return entry->pos_in_tags_list[subtype];
+  }
   const std::pair<absl::flat_hash_map<EncodedTag, uint32_t>::iterator, bool>
       insert_result = encoded_tag_pos_.emplace(etag, tags_list_.size());
   if (insert_result.second) tags_list_.emplace_back(etag);
+  if (entry != nullptr) {
+    if (subtype >= entry->pos_in_tags_list.size()) {
+      entry->pos_in_tags_list.resize(subtype + 1, kInvalidPos);
+    }
+    entry->pos_in_tags_list[subtype] = insert_result.first->second;
+  }
   return insert_result.first->second;
 }
 
@@ -346,7 +409,6 @@ inline bool TransposeEncoder::AddMessage(Reader* record,
     if (!ReadVarint32(record, &tag)) {
       RIEGELI_ASSERT_UNREACHABLE() << "Invalid tag: " << record->message();
     }
-    const uint32_t field = tag >> 3;
     switch (static_cast<internal::WireType>(tag & 7)) {
       case internal::WireType::kVarint: {
         // Storing value as uint64_t[2] instead of uint8_t[10] lets Clang and
@@ -376,7 +438,7 @@ inline bool TransposeEncoder::AddMessage(Reader* record,
           // Clear high bit of each byte.
           for (uint64_t& word : value) word &= ~uint64_t{0x8080808080808080};
           BackwardWriter* const buffer =
-              GetBuffer(parent_message_id, field, BufferType::kVarint);
+              GetBuffer(parent_message_id, tag, BufferType::kVarint);
           if (ABSL_PREDICT_FALSE(!buffer->Write(absl::string_view(
                   reinterpret_cast<const char*>(value), value_length)))) {
             return Fail(*buffer);
@@ -387,7 +449,7 @@ inline bool TransposeEncoder::AddMessage(Reader* record,
         encoded_tags_.push_back(GetPosInTagsList(
             EncodedTag(parent_message_id, tag, internal::Subtype::kTrivial)));
         BackwardWriter* const buffer =
-            GetBuffer(parent_message_id, field, BufferType::kFixed32);
+            GetBuffer(parent_message_id, tag, BufferType::kFixed32);
         if (ABSL_PREDICT_FALSE(!record->CopyTo(buffer, sizeof(uint32_t)))) {
           return Fail(*buffer);
         }
@@ -396,7 +458,7 @@ inline bool TransposeEncoder::AddMessage(Reader* record,
         encoded_tags_.push_back(GetPosInTagsList(
             EncodedTag(parent_message_id, tag, internal::Subtype::kTrivial)));
         BackwardWriter* const buffer =
-            GetBuffer(parent_message_id, field, BufferType::kFixed64);
+            GetBuffer(parent_message_id, tag, BufferType::kFixed64);
         if (ABSL_PREDICT_FALSE(!record->CopyTo(buffer, sizeof(uint64_t)))) {
           return Fail(*buffer);
         }
@@ -417,21 +479,13 @@ inline bool TransposeEncoder::AddMessage(Reader* record,
           encoded_tags_.push_back(GetPosInTagsList(EncodedTag(
               parent_message_id, tag,
               internal::Subtype::kLengthDelimitedStartOfSubmessage)));
-          const std::pair<absl::flat_hash_map<NodeId, MessageNode>::iterator,
-                          bool>
-              insert_result =
-                  message_nodes_.emplace(NodeId(parent_message_id, field),
-                                         MessageNode(next_message_id_));
-          if (insert_result.second) {
-            // New node was added.
-            ++next_message_id_;
-          }
+          const internal::MessageId message_id =
+              GetNode(parent_message_id, tag)->message_id;
           if (!value.Seek(value_pos)) {
             RIEGELI_ASSERT_UNREACHABLE()
                 << "Seeking submessage reader failed: " << value.message();
           }
-          if (ABSL_PREDICT_FALSE(!AddMessage(
-                  &value, insert_result.first->second.message_id, depth + 1))) {
+          if (ABSL_PREDICT_FALSE(!AddMessage(&value, message_id, depth + 1))) {
             return false;
           }
           encoded_tags_.push_back(GetPosInTagsList(
@@ -454,7 +508,7 @@ inline bool TransposeEncoder::AddMessage(Reader* record,
                 << "Seeking message reader failed: " << record->message();
           }
           BackwardWriter* const buffer =
-              GetBuffer(parent_message_id, field, BufferType::kString);
+              GetBuffer(parent_message_id, tag, BufferType::kString);
           if (ABSL_PREDICT_FALSE(!record->CopyTo(
                   buffer, IntCast<size_t>(value_pos - length_pos) + length))) {
             return Fail(*buffer);
@@ -464,18 +518,9 @@ inline bool TransposeEncoder::AddMessage(Reader* record,
       case internal::WireType::kStartGroup: {
         encoded_tags_.push_back(GetPosInTagsList(
             EncodedTag(parent_message_id, tag, internal::Subtype::kTrivial)));
-        const std::pair<absl::flat_hash_map<NodeId, MessageNode>::iterator,
-                        bool>
-            insert_result =
-                message_nodes_.emplace(NodeId(parent_message_id, field),
-                                       MessageNode(next_message_id_));
-        if (insert_result.second) {
-          // New node was added.
-          ++next_message_id_;
-        }
         group_stack_.push_back(parent_message_id);
         ++depth;
-        parent_message_id = insert_result.first->second.message_id;
+        parent_message_id = GetNode(parent_message_id, tag)->message_id;
       } break;
       case internal::WireType::kEndGroup:
         parent_message_id = group_stack_.back();
@@ -493,31 +538,127 @@ inline bool TransposeEncoder::AddMessage(Reader* record,
   return true;
 }
 
-inline bool TransposeEncoder::AddBuffer(bool force_new_bucket,
+inline void TransposeEncoder::AddBuffer(bool force_new_bucket,
                                         const Chain& next_chunk,
-                                        Writer* data_writer,
-                                        std::vector<size_t>* bucket_lengths,
+                                        std::vector<Chain>* buckets,
                                         std::vector<size_t>* buffer_lengths) {
   buffer_lengths->push_back(next_chunk.size());
-  if (ABSL_PREDICT_FALSE(force_new_bucket ||
-                         compressor_.writer()->pos() + next_chunk.size() >
-                             bucket_size_) &&
-      compressor_.writer()->pos() > 0) {
-    const Position pos_before = data_writer->pos();
-    if (ABSL_PREDICT_FALSE(!compressor_.EncodeAndClose(data_writer))) {
-      return Fail(compressor_);
+  if (buckets->empty() ||
+      (ABSL_PREDICT_FALSE(force_new_bucket ||
+                          buckets->back().size() + next_chunk.size() >
+                              bucket_size_) &&
+       !buckets->back().empty())) {
+    buckets->emplace_back();
+  }
+  buckets->back().Append(next_chunk);
+}
+
+inline bool TransposeEncoder::CompressBuckets(
+    std::vector<Chain> buckets, Writer* data_writer,
+    std::vector<size_t>* bucket_lengths) {
+  bucket_lengths->reserve(bucket_lengths->size() + buckets.size());
+  if (parallelism_ == 0 || buckets.size() <= 1) {
+    for (Chain& bucket : buckets) {
+      compressor_.Reset();
+      if (ABSL_PREDICT_FALSE(!compressor_.writer()->Write(std::move(bucket)))) {
+        return Fail(*compressor_.writer());
+      }
+      const Position pos_before = data_writer->pos();
+      if (ABSL_PREDICT_FALSE(!compressor_.EncodeAndClose(data_writer))) {
+        return Fail(compressor_);
+      }
+      RIEGELI_ASSERT_GE(data_writer->pos(), pos_before)
+          << "Data writer position decreased";
+      bucket_lengths->push_back(
+          IntCast<size_t>(data_writer->pos() - pos_before));
     }
-    RIEGELI_ASSERT_GE(data_writer->pos(), pos_before)
-        << "Data writer position decreased";
-    bucket_lengths->push_back(IntCast<size_t>(data_writer->pos() - pos_before));
-    compressor_.Reset();
+    return true;
   }
-  if (ABSL_PREDICT_FALSE(!compressor_.writer()->Write(next_chunk))) {
-    return Fail(compressor_);
+
+  // Background tasks own their data and options, so that pending tasks may
+  // outlive this TransposeEncoder if compressing an earlier bucket fails.
+  struct CompressedBucket {
+    bool ok = false;
+    Chain data;
+    std::string message;
+  };
+  struct BucketTask {
+    CompressorOptions options;
+    Chain bucket;
+    std::promise<CompressedBucket> compressed;
+  };
+  std::deque<std::future<CompressedBucket>> pending;
+  size_t next_bucket = 0;
+  while (next_bucket < buckets.size() || !pending.empty()) {
+    while (next_bucket < buckets.size() &&
+           pending.size() < IntCast<size_t>(parallelism_)) {
+      BucketTask* const task = new BucketTask();
+      task->options = compressor_options_;
+      task->bucket = std::move(buckets[next_bucket++]);
+      pending.push_back(task->compressed.get_future());
+      internal::DefaultThreadPool().Schedule([task] {
+        CompressedBucket result;
+        // No size hint, as for compressor_, so that the compressed bucket is
+        // the same as when compressed sequentially.
+        internal::Compressor compressor(std::move(task->options));
+        ChainWriter<> compressed_writer(&result.data);
+        if (ABSL_PREDICT_FALSE(
+                !compressor.writer()->Write(std::move(task->bucket)))) {
+          result.message = std::string(compressor.writer()->message());
+        } else if (ABSL_PREDICT_FALSE(
+                       !compressor.EncodeAndClose(&compressed_writer))) {
+          result.message = std::string(compressor.message());
+        } else if (ABSL_PREDICT_FALSE(!compressed_writer.Close())) {
+          result.message = std::string(compressed_writer.message());
+        } else {
+          result.ok = true;
+        }
+        task->compressed.set_value(std::move(result));
+        delete task;
+      });
+    }
+    CompressedBucket compressed = pending.front().get();
+    pending.pop_front();
+    if (ABSL_PREDICT_FALSE(!compressed.ok)) return Fail(compressed.message);
+    bucket_lengths->push_back(compressed.data.size());
+    if (ABSL_PREDICT_FALSE(!data_writer->Write(std::move(compressed.data)))) {
+      return Fail(*data_writer);
+    }
   }
   return true;
 }
 
+inline void TransposeEncoder::AssignFieldGroups() {
+  // Maps message ID of a submessage to the node it is stored in.
+  absl::flat_hash_map<internal::MessageId, NodeId> parent_nodes;
+  for (const std::pair<const NodeId, MessageNode>& entry : message_nodes_) {
+    parent_nodes.emplace(entry.second.message_id, entry.first);
+  }
+  std::vector<uint32_t> path;
+  for (std::vector<BufferWithMetadata>& buffers : data_) {
+    for (BufferWithMetadata& buffer : buffers) {
+      if (buffer.message_id == internal::MessageId::kNonProto) {
+        buffer.field_group = field_groups_.size();
+        continue;
+      }
+      // Build the path of field numbers from the root, in reverse order.
+      path.clear();
+      path.push_back(buffer.field);
+      internal::MessageId message_id = buffer.message_id;
+      while (message_id != internal::MessageId::kRoot) {
+        const absl::flat_hash_map<internal::MessageId, NodeId>::const_iterator
+            iter = parent_nodes.find(message_id);
+        RIEGELI_ASSERT(iter != parent_nodes.end())
+            << "Parent of message not found: "
+            << static_cast<uint32_t>(message_id);
+        path.push_back(iter->second.field);
+        message_id = iter->second.parent_message_id;
+      }
+      buffer.field_group = FindFieldGroup(field_groups_, path);
+    }
+  }
+}
+
 inline bool TransposeEncoder::WriteBuffers(
     Writer* header_writer, Writer* data_writer,
     absl::flat_hash_map<NodeId, uint32_t>* buffer_pos) {
@@ -540,46 +681,44 @@ inline bool TransposeEncoder::WriteBuffers(
   const Chain& nonproto_lengths = nonproto_lengths_writer_.dest();
   if (!nonproto_lengths.empty()) ++num_buffers;
 
+  if (!field_groups_.empty()) AssignFieldGroups();
+
   std::vector<size_t> buffer_lengths;
   buffer_lengths.reserve(num_buffers);
-  std::vector<size_t> bucket_lengths;
-
-  // Write all buffer lengths to the header and data to "bucket_buffer".
-  for (size_t i = 0; i < kNumBufferTypes; ++i) {
-    for (size_t j = 0; j < data_[i].size(); ++j) {
-      const BufferWithMetadata& buffer = data_[i][j];
-      if (ABSL_PREDICT_FALSE(!AddBuffer(j == 0, *buffer.buffer, data_writer,
-                                        &bucket_lengths, &buffer_lengths))) {
-        return false;
+  std::vector<Chain> buckets;
+
+  // Split data buffers into buckets, separately for each field group and
+  // buffer type.
+  for (size_t group = 0; group <= field_groups_.size(); ++group) {
+    for (size_t i = 0; i < kNumBufferTypes; ++i) {
+      bool force_new_bucket = true;
+      for (const BufferWithMetadata& buffer : data_[i]) {
+        if (buffer.field_group != group) continue;
+        AddBuffer(force_new_bucket, *buffer.buffer, &buckets, &buffer_lengths);
+        force_new_bucket = false;
+        const std::pair<absl::flat_hash_map<NodeId, uint32_t>::iterator, bool>
+            insert_result =
+                buffer_pos->emplace(NodeId(buffer.message_id, buffer.field),
+                                    IntCast<uint32_t>(buffer_pos->size()));
+        RIEGELI_ASSERT(insert_result.second)
+            << "Field already has buffer assigned: "
+            << static_cast<uint32_t>(buffer.message_id) << "/" << buffer.field;
       }
-      const std::pair<absl::flat_hash_map<NodeId, uint32_t>::iterator, bool>
-          insert_result =
-              buffer_pos->emplace(NodeId(buffer.message_id, buffer.field),
-                                  IntCast<uint32_t>(buffer_pos->size()));
-      RIEGELI_ASSERT(insert_result.second)
-          << "Field already has buffer assigned: "
-          << static_cast<uint32_t>(buffer.message_id) << "/" << buffer.field;
     }
   }
   if (!nonproto_lengths.empty()) {
     // nonproto_lengths_ is the last buffer if non-empty.
-    if (ABSL_PREDICT_FALSE(!AddBuffer(
-            /*force_new_bucket=*/true, nonproto_lengths, data_writer,
-            &bucket_lengths, &buffer_lengths))) {
-      return false;
-    }
+    AddBuffer(/*force_new_bucket=*/true, nonproto_lengths, &buckets,
+              &buffer_lengths);
     // Note: nonproto_lengths needs no buffer_pos.
   }
+  // Empty buffers are counted in "buffer_lengths" but form no bucket.
+  if (!buckets.empty() && buckets.back().empty()) buckets.pop_back();
 
-  if (compressor_.writer()->pos() > 0) {
-    // Last bucket.
-    const Position pos_before = data_writer->pos();
-    if (ABSL_PREDICT_FALSE(!compressor_.EncodeAndClose(data_writer))) {
-      return Fail(compressor_);
-    }
-    RIEGELI_ASSERT_GE(data_writer->pos(), pos_before)
-        << "Data writer position decreased";
-    bucket_lengths.push_back(IntCast<size_t>(data_writer->pos() - pos_before));
+  std::vector<size_t> bucket_lengths;
+  if (ABSL_PREDICT_FALSE(
+          !CompressBuckets(std::move(buckets), data_writer, &bucket_lengths))) {
+    return false;
   }
 
   if (ABSL_PREDICT_FALSE(!WriteVarint32(
@@ -23,6 +23,7 @@
 #include <vector>
 
 #include "absl/container/flat_hash_map.h"
+#include "absl/container/node_hash_map.h"
 #include "absl/strings/string_view.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/object.h"
@@ -33,6 +34,7 @@
 #include "riegeli/chunk_encoding/compressor.h"
 #include "riegeli/chunk_encoding/compressor_options.h"
 #include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/field_projection.h"
 #include "riegeli/chunk_encoding/transpose_internal.h"
 
 namespace riegeli {
@@ -64,7 +66,18 @@ class Reader;
 class TransposeEncoder : public ChunkEncoder {
  public:
   // Creates an empty TransposeEncoder.
-  explicit TransposeEncoder(CompressorOptions options, uint64_t bucket_size);
+  //
+  // If parallelism > 0, up to "parallelism" buckets are compressed
+  // concurrently in background. This does not change the encoded chunk.
+  //
+  // Values of fields included in each of "field_groups" are put in buckets
+  // separate from values of other fields, so that reading with a projection to
+  // a group does not need to decompress values of unrelated fields. A field is
+  // assigned to the first group which includes it.
+  explicit TransposeEncoder(CompressorOptions options, uint64_t bucket_size,
+                            int parallelism = 0,
+                            std::vector<FieldProjection> field_groups =
+                                std::vector<FieldProjection>());
 
   ~TransposeEncoder();
 
@@ -149,11 +162,34 @@ class TransposeEncoder : public ChunkEncoder {
     uint32_t field;
   };
 
-  // Get BackwardWriter for field "field" in message "parent_message_id".
+  // Entry of "tag_cache_", caching lookups of a tag within a message.
+  struct TagCacheEntry {
+    // Node in "message_nodes_" for the field of the tag, or nullptr if not
+    // looked up yet.
+    MessageNode* node = nullptr;
+    // Positions of the encoded tag in "tags_list_", indexed by subtype.
+    // kInvalidPos if not looked up yet.
+    std::vector<uint32_t> pos_in_tags_list;
+  };
+
+  // Tags smaller than this are cached in "tag_cache_". This covers field
+  // numbers below 64, which are expected to be the majority in practice.
+  static constexpr uint32_t kMaxCachedTag = 64 << 3;
+
+  // Get the entry of "tag_cache_" for "tag" in message "parent_message_id", or
+  // nullptr if "tag" is too large to be cached.
+  TagCacheEntry* GetTagCacheEntry(internal::MessageId parent_message_id,
+                                  uint32_t tag);
+
+  // Get the node for the field of "tag" in message "parent_message_id", adding
+  // it if not present yet.
+  MessageNode* GetNode(internal::MessageId parent_message_id, uint32_t tag);
+
+  // Get BackwardWriter for the field of "tag" in message "parent_message_id".
   // "type" is used to select the right category for the buffer if not created
   // yet.
   BackwardWriter* GetBuffer(internal::MessageId parent_message_id,
-                            uint32_t field, BufferType type);
+                            uint32_t tag, BufferType type);
 
   // Add message recursively to the internal data structures.
   // Precondition: "message" is a valid proto message, i.e. IsProtoMessage on
@@ -162,6 +198,9 @@ class TransposeEncoder : public ChunkEncoder {
   bool AddMessage(Reader* record, internal::MessageId parent_message_id,
                   int depth);
 
+  // Set "field_group" in all buffers in "data_" according to "field_groups_".
+  void AssignFieldGroups();
+
   // Write all buffer lengths to "header_writer" and data buffers in "data_" to
   // "data_writer" (compressed using compressor_). Fill map with the sequential
   // position of each buffer written.
@@ -185,13 +224,21 @@ class TransposeEncoder : public ChunkEncoder {
     uint32_t canonical_source;
   };
 
-  // Add "next_chunk" to compressor_.writer(). If either the current bucket
-  // would become too large or "force_new_bucket" is true, flush the current
-  // bucket to "data_writer" first and create a new bucket.
-  bool AddBuffer(bool force_new_bucket, const Chain& next_chunk,
-                 Writer* data_writer, std::vector<size_t>* bucket_lengths,
+  // Add "next_chunk" to the last bucket in "buckets". If either the current
+  // bucket would become too large or "force_new_bucket" is true, create a new
+  // bucket first.
+  void AddBuffer(bool force_new_bucket, const Chain& next_chunk,
+                 std::vector<Chain>* buckets,
                  std::vector<size_t>* buffer_lengths);
 
+  // Compress each of "buckets" separately and write them to "data_writer" in
+  // order, appending their compressed sizes to "bucket_lengths".
+  //
+  // If parallelism_ > 0, buckets are compressed in background using fresh
+  // compressors, otherwise they are compressed sequentially using compressor_.
+  bool CompressBuckets(std::vector<Chain> buckets, Writer* data_writer,
+                       std::vector<size_t>* bucket_lengths);
+
   // Compute base indices for states in "state_machine" that don't have one yet.
   // "public_list_base" is the index of the start of the public list.
   // "public_list_noops" is the list of NoOp states that don't have a base set
@@ -290,6 +337,9 @@ class TransposeEncoder : public ChunkEncoder {
     internal::MessageId message_id;
     // Field number in message with ID "message_id" that the buffer belongs to.
     uint32_t field;
+    // Index of the first element of "field_groups_" which includes the field,
+    // or field_groups_.size() if none.
+    size_t field_group = 0;
   };
 
   CompressionType compression_type_;
@@ -297,6 +347,13 @@ class TransposeEncoder : public ChunkEncoder {
   // Finer bucket granularity (i.e. smaller size) worsens compression density
   // but makes field projection more effective.
   uint64_t bucket_size_;
+  // Options of compressor_, used also for compressing buckets in background.
+  CompressorOptions compressor_options_;
+  // The maximum number of buckets compressed concurrently in background, or 0
+  // to compress them sequentially.
+  int parallelism_;
+  // Groups of fields to put in separate buckets.
+  std::vector<FieldProjection> field_groups_;
 
   internal::Compressor compressor_;
   // List of all distinct Encoded tags.
@@ -310,8 +367,13 @@ class TransposeEncoder : public ChunkEncoder {
   // Every group creates a new message ID. We keep track of open groups in this
   // vector.
   std::vector<internal::MessageId> group_stack_;
-  // Tree of message nodes.
-  absl::flat_hash_map<NodeId, MessageNode> message_nodes_;
+  // Tree of message nodes. Pointers to nodes are stable and are cached in
+  // "tag_cache_".
+  absl::node_hash_map<NodeId, MessageNode> message_nodes_;
+  // Dense cache of lookups in "message_nodes_" and "encoded_tag_pos_" for small
+  // tags, indexed by parent message ID and then by tag. This avoids hashing in
+  // the common case.
+  std::vector<std::vector<TagCacheEntry>> tag_cache_;
   ChainBackwardWriter<Chain> nonproto_lengths_writer_;
   // Counter used to assign unique IDs to the message nodes.
   internal::MessageId next_message_id_ = internal::MessageId::kRoot + 1;
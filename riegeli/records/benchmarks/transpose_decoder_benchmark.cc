@@ -0,0 +1,227 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the speed of decoding transposed chunks, excluding reading files
+// and decompression (unless requested by --compression).
+//
+// Decoding dispatches on the callback type of each state machine node. To
+// compare computed goto with the portable switch, build once more with
+// -DRIEGELI_TRANSPOSE_DECODER_COMPUTED_GOTO=0.
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_format.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/chunk_encoding/compressor_options.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/transpose_encoder.h"
+#include "riegeli/records/record_reader.h"
+
+namespace {
+
+uint64_t CpuTimeNow_ns() {
+  struct timespec time_info;
+  RIEGELI_CHECK_EQ(clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_info), 0);
+  return riegeli::IntCast<uint64_t>(time_info.tv_sec) * uint64_t{1000000000} +
+         riegeli::IntCast<uint64_t>(time_info.tv_nsec);
+}
+
+double Median(std::vector<double> samples) {
+  RIEGELI_CHECK(!samples.empty()) << "No data";
+  const size_t middle = samples.size() / 2;
+  std::nth_element(samples.begin(), samples.begin() + middle, samples.end());
+  return samples[middle];
+}
+
+// Reads records from a Riegeli/records file, up to *max_size bytes in total.
+bool ReadRecords(const std::string& filename,
+                 std::vector<std::string>* records, size_t* max_size) {
+  riegeli::RecordReader<riegeli::FdReader<>> record_reader(
+      riegeli::FdReader<>(filename, O_RDONLY));
+  std::string record;
+  while (record_reader.ReadRecord(&record)) {
+    if (ABSL_PREDICT_FALSE(*max_size < record.size())) return false;
+    *max_size -= record.size();
+    records->push_back(std::move(record));
+  }
+  RIEGELI_CHECK(record_reader.Close()) << record_reader.message();
+  return true;
+}
+
+// Encodes records into transposed chunks of approximately "chunk_size"
+// decoded bytes each.
+std::vector<riegeli::Chunk> EncodeChunks(
+    const std::vector<std::string>& records,
+    const riegeli::CompressorOptions& compressor_options, uint64_t chunk_size) {
+  std::vector<riegeli::Chunk> chunks;
+  size_t begin = 0;
+  while (begin < records.size()) {
+    riegeli::TransposeEncoder transpose_encoder(compressor_options, chunk_size);
+    uint64_t size = 0;
+    size_t end = begin;
+    do {
+      RIEGELI_CHECK(transpose_encoder.AddRecord(records[end]))
+          << transpose_encoder.message();
+      size += records[end].size();
+      ++end;
+    } while (end < records.size() && size < chunk_size);
+    riegeli::Chunk chunk;
+    riegeli::ChainWriter<> data_writer(&chunk.data);
+    riegeli::ChunkType chunk_type;
+    uint64_t num_records;
+    uint64_t decoded_data_size;
+    RIEGELI_CHECK(transpose_encoder.EncodeAndClose(
+        &data_writer, &chunk_type, &num_records, &decoded_data_size))
+        << transpose_encoder.message();
+    RIEGELI_CHECK(data_writer.Close()) << data_writer.message();
+    chunk.header = riegeli::ChunkHeader(chunk.data, chunk_type, num_records,
+                                        decoded_data_size);
+    chunks.push_back(std::move(chunk));
+    begin = end;
+  }
+  return chunks;
+}
+
+const char kUsage[] =
+    "Usage: transpose_decoder_benchmark (OPTION|FILE)...\n"
+    "\n"
+    "FILEs are Riegeli/records files providing records to encode.\n"
+    "\n"
+    "OPTIONs:\n"
+    "  --compression=OPTIONS\n"
+    "      Compressor options, default uncompressed\n"
+    "  --chunk_size=BYTES\n"
+    "      Decoded size of a chunk, in bytes, default 1000000\n"
+    "  --max_size=BYTES\n"
+    "      Maximum size of records to read, in bytes, default 100000000\n"
+    "  --repetitions=N\n"
+    "      Number of times to repeat decoding, default 5";
+
+const struct option kOptions[] = {
+    {"help", no_argument, nullptr, 0},
+    {"compression", required_argument, nullptr, 1},
+    {"chunk_size", required_argument, nullptr, 2},
+    {"max_size", required_argument, nullptr, 3},
+    {"repetitions", required_argument, nullptr, 4},
+    {nullptr, 0, nullptr, 0}};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string compression = "uncompressed";
+  uint64_t chunk_size = 1000 * 1000;
+  size_t max_size = size_t{100} * 1000 * 1000;
+  int repetitions = 5;
+  for (;;) {
+    int option_index;
+    const int option =
+        getopt_long_only(argc, argv, "", kOptions, &option_index);
+    if (option == -1) break;
+    switch (option) {
+      case 0:  // --help
+        std::cout << kUsage << std::endl;
+        return 0;
+      case 1:  // --compression
+        compression = optarg;
+        break;
+      case 2:  // --chunk_size
+        if (ABSL_PREDICT_TRUE(absl::SimpleAtoi(optarg, &chunk_size) &&
+                              chunk_size > 0)) {
+          break;
+        }
+        std::cerr << argv[0]
+                  << ": option '--chunk_size' requires a positive integer "
+                     "argument\n";
+        return 1;
+      case 3:  // --max_size
+        if (ABSL_PREDICT_TRUE(absl::SimpleAtoi(optarg, &max_size))) break;
+        std::cerr << argv[0]
+                  << ": option '--max_size' requires an integer argument\n";
+        return 1;
+      case 4:  // --repetitions
+        if (ABSL_PREDICT_TRUE(absl::SimpleAtoi(optarg, &repetitions) &&
+                              repetitions > 0)) {
+          break;
+        }
+        std::cerr << argv[0]
+                  << ": option '--repetitions' requires a positive integer "
+                     "argument\n";
+        return 1;
+      case '?':
+        return 1;
+      default:
+        RIEGELI_ASSERT_UNREACHABLE()
+            << "getopt_long_only() returned " << option;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+  if (argc == 1) {
+    std::cerr << kUsage << std::endl;
+    return 1;
+  }
+  riegeli::CompressorOptions compressor_options;
+  {
+    std::string message;
+    RIEGELI_CHECK(compressor_options.Parse(compression, &message)) << message;
+  }
+  std::vector<std::string> records;
+  for (int i = 1; i < argc; ++i) {
+    if (!ReadRecords(argv[i], &records, &max_size)) break;
+  }
+  const std::vector<riegeli::Chunk> chunks =
+      EncodeChunks(records, compressor_options, chunk_size);
+  uint64_t decoded_size = 0;
+  for (const riegeli::Chunk& chunk : chunks) {
+    decoded_size += chunk.header.decoded_data_size();
+  }
+
+  std::vector<double> decoding_cpu_speed;
+  riegeli::ChunkDecoder chunk_decoder;
+  for (int i = 0; i < repetitions + 1; ++i) {
+    const uint64_t cpu_time_before_ns = CpuTimeNow_ns();
+    for (const riegeli::Chunk& chunk : chunks) {
+      RIEGELI_CHECK(chunk_decoder.Reset(chunk)) << chunk_decoder.message();
+    }
+    const uint64_t cpu_time_after_ns = CpuTimeNow_ns();
+    if (i == 0) {
+      // Warm-up.
+    } else {
+      decoding_cpu_speed.push_back(
+          static_cast<double>(decoded_size) /
+          static_cast<double>(cpu_time_after_ns - cpu_time_before_ns) * 1000.0);
+    }
+  }
+  absl::PrintF("Records: %u, chunks: %u, decoded size: %.3f MB\n",
+               records.size(), chunks.size(),
+               static_cast<double>(decoded_size) / 1000000.0);
+  absl::PrintF("Decoding CPU speed: %.0f MB/s\n",
+               Median(std::move(decoding_cpu_speed)));
+}
@@ -16,13 +16,16 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <limits>
 #include <memory>
 #include <utility>
 
 #include "absl/base/optimization.h"
 #include "absl/strings/str_cat.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
 #include "riegeli/base/object.h"
+#include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/constants.h"
@@ -80,47 +83,32 @@ bool DefaultChunkReaderBase::ReadChunk(Chunk* chunk) {
   Reader* const src = src_reader();
   const Position chunk_end = internal::ChunkEnd(chunk_.header, pos_);
 
-  while (chunk_.data.size() < chunk_.header.data_size()) {
-    if (internal::RemainingInBlockHeader(src->pos()) > 0) {
-      const Position block_begin =
-          internal::RoundDownToBlockBoundary(src->pos());
-      if (ABSL_PREDICT_FALSE(!ReadBlockHeader())) return false;
-      if (ABSL_PREDICT_FALSE(block_header_.previous_chunk() !=
-                             block_begin - pos_)) {
-        if (block_header_.next_chunk() <= internal::kBlockSize()) {
-          // Trust the rest of the block header: skip to the next chunk.
-          recoverable_ = Recoverable::kHaveChunk;
-          recoverable_pos_ = block_begin + block_header_.next_chunk();
-        } else {
-          // Skip to the next block header.
-          recoverable_ = Recoverable::kFindChunk;
-          recoverable_pos_ = src->pos();
-        }
-        return Fail(absl::StrCat(
-            "Invalid Riegeli/records file: chunk boundary is ", pos_,
-            " but block header at ", block_begin,
-            " implies a different previous chunk boundary: ",
-            block_begin >= block_header_.previous_chunk()
-                ? absl::StrCat(block_begin - block_header_.previous_chunk())
-                : absl::StrCat("-",
-                               block_header_.previous_chunk() - block_begin)));
-      }
-      if (ABSL_PREDICT_FALSE(block_header_.next_chunk() !=
-                             chunk_end - block_begin)) {
-        recoverable_ = Recoverable::kFindChunk;
-        recoverable_pos_ = src->pos();
-        return Fail(
-            absl::StrCat("Invalid Riegeli/records file: chunk boundary is ",
-                         chunk_end, " but block header at ", block_begin,
-                         " implies a different next chunk boundary: ",
-                         block_begin + block_header_.next_chunk()));
+  if (chunk_.data.size() < chunk_.header.data_size()) {
+    const Position data_end = internal::AddWithOverhead(
+        pos_, chunk_.header.size() + chunk_.header.data_size());
+    RIEGELI_ASSERT_GT(data_end, src->pos())
+        << "Chunk data remaining but the source is at their end";
+    const Position raw_length = data_end - src->pos();
+    if (src->SupportsRandomAccess() &&
+        raw_length > internal::RemainingInBlock(src->pos()) &&
+        raw_length <= std::numeric_limits<size_t>::max()) {
+      // The remaining chunk data are interrupted by block headers. Reading them
+      // together with block headers with a single Read(Chain*) call lets src
+      // read them directly into a Chain instead of in block-sized pieces. Block
+      // headers are then verified and skipped while splitting the data.
+      //
+      // This is done only if src supports random access, because a corrupted
+      // block header found there sets recoverable_pos_ before src->pos(), and
+      // Recover() must then seek backwards.
+      const Position raw_begin = src->pos();
+      Chain raw;
+      src->Read(&raw, IntCast<size_t>(raw_length));
+      ChainReader<> raw_reader(&raw);
+      if (ABSL_PREDICT_FALSE(!ReadChunkData(&raw_reader, raw_begin))) {
+        return false;
       }
-    }
-    if (ABSL_PREDICT_FALSE(!src->Read(
-            &chunk_.data, IntCast<size_t>(UnsignedMin(
-                              chunk_.header.data_size() - chunk_.data.size(),
-                              internal::RemainingInBlock(src->pos())))))) {
-      return ReadingFailed(src);
+    } else {
+      if (ABSL_PREDICT_FALSE(!ReadChunkData(src, 0))) return false;
     }
   }
 
@@ -269,22 +257,80 @@ inline bool DefaultChunkReaderBase::ReadChunkHeader() {
   return true;
 }
 
+inline bool DefaultChunkReaderBase::ReadChunkData(Reader* data_src,
+                                                  Position data_src_base) {
+  const Position chunk_end = internal::ChunkEnd(chunk_.header, pos_);
+  while (chunk_.data.size() < chunk_.header.data_size()) {
+    const Position block_begin =
+        internal::RoundDownToBlockBoundary(data_src_base + data_src->pos());
+    if (internal::RemainingInBlockHeader(data_src_base + data_src->pos()) > 0) {
+      if (ABSL_PREDICT_FALSE(!ReadBlockHeader(data_src, data_src_base))) {
+        return false;
+      }
+      if (ABSL_PREDICT_FALSE(block_header_.previous_chunk() !=
+                             block_begin - pos_)) {
+        if (block_header_.next_chunk() <= internal::kBlockSize()) {
+          // Trust the rest of the block header: skip to the next chunk.
+          recoverable_ = Recoverable::kHaveChunk;
+          recoverable_pos_ = block_begin + block_header_.next_chunk();
+        } else {
+          // Skip to the next block header.
+          recoverable_ = Recoverable::kFindChunk;
+          recoverable_pos_ = data_src_base + data_src->pos();
+        }
+        return Fail(absl::StrCat(
+            "Invalid Riegeli/records file: chunk boundary is ", pos_,
+            " but block header at ", block_begin,
+            " implies a different previous chunk boundary: ",
+            block_begin >= block_header_.previous_chunk()
+                ? absl::StrCat(block_begin - block_header_.previous_chunk())
+                : absl::StrCat("-",
+                               block_header_.previous_chunk() - block_begin)));
+      }
+      if (ABSL_PREDICT_FALSE(block_header_.next_chunk() !=
+                             chunk_end - block_begin)) {
+        recoverable_ = Recoverable::kFindChunk;
+        recoverable_pos_ = data_src_base + data_src->pos();
+        return Fail(
+            absl::StrCat("Invalid Riegeli/records file: chunk boundary is ",
+                         chunk_end, " but block header at ", block_begin,
+                         " implies a different next chunk boundary: ",
+                         block_begin + block_header_.next_chunk()));
+      }
+    }
+    if (ABSL_PREDICT_FALSE(!data_src->Read(
+            &chunk_.data,
+            IntCast<size_t>(UnsignedMin(
+                chunk_.header.data_size() - chunk_.data.size(),
+                internal::RemainingInBlock(data_src_base +
+                                           data_src->pos())))))) {
+      return ReadingFailed(src_reader());
+    }
+  }
+  return true;
+}
+
 inline bool DefaultChunkReaderBase::ReadBlockHeader() {
-  Reader* const src = src_reader();
-  const size_t remaining_length = internal::RemainingInBlockHeader(src->pos());
+  return ReadBlockHeader(src_reader(), 0);
+}
+
+inline bool DefaultChunkReaderBase::ReadBlockHeader(Reader* data_src,
+                                                    Position data_src_base) {
+  const size_t remaining_length =
+      internal::RemainingInBlockHeader(data_src_base + data_src->pos());
   RIEGELI_ASSERT_GT(remaining_length, 0u)
       << "Failed precondition of DefaultChunkReaderBase::ReadBlockHeader(): "
          "not before nor inside a block header";
-  if (ABSL_PREDICT_FALSE(!src->Read(
+  if (ABSL_PREDICT_FALSE(!data_src->Read(
           block_header_.bytes() + block_header_.size() - remaining_length,
           remaining_length))) {
-    return ReadingFailed(src);
+    return ReadingFailed(src_reader());
   }
   const uint64_t computed_header_hash = block_header_.computed_header_hash();
   if (ABSL_PREDICT_FALSE(computed_header_hash !=
                          block_header_.stored_header_hash())) {
     recoverable_ = Recoverable::kFindChunk;
-    recoverable_pos_ = src->pos();
+    recoverable_pos_ = data_src_base + data_src->pos();
     return Fail(absl::StrCat(
         "Corrupted Riegeli/records file: block header hash mismatch "
         "(computed 0x",
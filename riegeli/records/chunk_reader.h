@@ -169,10 +169,25 @@ class DefaultChunkReaderBase : public Object {
   // Reads or continues reading chunk_.header.
   bool ReadChunkHeader();
 
+  // Reads or continues reading chunk_.data.
+  //
+  // Data are read from data_src, which is either src_reader() with
+  // data_src_base == 0, or a Reader of data already read from src_reader(),
+  // where data_src->pos() corresponds to data_src_base + data_src->pos() in
+  // src_reader().
+  //
+  // Precondition: chunk_.header has been read.
+  bool ReadChunkData(Reader* data_src, Position data_src_base);
+
   // Reads or continues reading block_header_.
   //
-  // Precondition: internal::RemainingInBlockHeader(src_reader()->pos()) > 0
+  // ReadBlockHeader(data_src, data_src_base) reads from data_src, which is
+  // interpreted as in ReadChunkData().
+  //
+  // Precondition:
+  //   internal::RemainingInBlockHeader(data_src_base + data_src->pos()) > 0
   bool ReadBlockHeader();
+  bool ReadBlockHeader(Reader* data_src, Position data_src_base);
 
   // Shared implementation of SeekToChunkContaining(), SeekToChunkBefore(), and
   // SeekToChunkAfter().
@@ -0,0 +1,160 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/random_access_record_reader.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <cerrno>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/object.h"
+#include "riegeli/base/str_error.h"
+#include "riegeli/bytes/fd_dependency.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/zstd_dictionary.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/record_position.h"
+#include "riegeli/records/record_reader.h"
+
+namespace riegeli {
+
+namespace {
+
+ABSL_ATTRIBUTE_COLD bool ReadingFailed(RecordPosition pos,
+                                       absl::string_view message,
+                                       std::string* error_message) {
+  if (error_message != nullptr) {
+    *error_message =
+        absl::StrCat("Reading record ", pos.record_index(), " of chunk at ",
+                     pos.chunk_begin(), " failed: ", message);
+  }
+  return false;
+}
+
+}  // namespace
+
+RandomAccessRecordReaderBase::RandomAccessRecordReaderBase(Options&& options)
+    : Object(State::kOpen),
+      field_projection_(std::move(options.field_projection_)),
+      buffer_size_(options.buffer_size_) {}
+
+void RandomAccessRecordReaderBase::SetFilename(int src) {
+  filename_ = absl::StrCat("/proc/self/fd/", src);
+}
+
+int RandomAccessRecordReaderBase::OpenFd(absl::string_view filename,
+                                         int flags) {
+  filename_.assign(filename.data(), filename.size());
+again:
+  const int src = open(filename_.c_str(), flags, 0666);
+  if (ABSL_PREDICT_FALSE(src < 0)) {
+    if (errno == EINTR) goto again;
+    FailOperation("open()");
+    return -1;
+  }
+  return src;
+}
+
+bool RandomAccessRecordReaderBase::FailOperation(absl::string_view operation) {
+  return Fail(absl::StrCat(operation, " failed: ", StrError(errno),
+                           ", reading ", filename_));
+}
+
+void RandomAccessRecordReaderBase::Initialize(int src) {
+  FdReader<int> reader(src,
+                       FdReaderBase::Options().set_buffer_size(buffer_size_));
+  zstd_dictionary_ = internal::ReadZstdDictionary(&reader);
+}
+
+void RandomAccessRecordReaderBase::Done() {
+  field_projection_ = FieldProjection();
+  zstd_dictionary_.reset();
+}
+
+template <typename Record>
+inline bool RandomAccessRecordReaderBase::ReadRecordAtImpl(
+    RecordPosition pos, Record* record, std::string* error_message) const {
+  if (ABSL_PREDICT_FALSE(!healthy())) {
+    if (error_message != nullptr) {
+      *error_message = std::string(message());
+    }
+    return false;
+  }
+  // Everything below is local to this call: FdReader<int> reads with pread()
+  // at its own position and does not change the fd position, so concurrent
+  // calls do not interfere.
+  FdReader<int> src(src_fd(),
+                    FdReaderBase::Options().set_buffer_size(buffer_size_));
+  DefaultChunkReader<> chunk_reader(&src);
+  Chunk chunk;
+  if (ABSL_PREDICT_FALSE(!chunk_reader.Seek(pos.chunk_begin()) ||
+                         !chunk_reader.ReadChunk(&chunk))) {
+    if (chunk_reader.Close()) {
+      return ReadingFailed(pos, "position exceeds file size", error_message);
+    }
+    return ReadingFailed(pos, chunk_reader.message(), error_message);
+  }
+  ChunkDecoder chunk_decoder(ChunkDecoder::Options()
+                                 .set_field_projection(field_projection_)
+                                 .set_zstd_dictionary(zstd_dictionary_));
+  if (ABSL_PREDICT_FALSE(!chunk_decoder.Reset(chunk))) {
+    return ReadingFailed(pos, chunk_decoder.message(), error_message);
+  }
+  if (ABSL_PREDICT_FALSE(pos.record_index() >= chunk_decoder.num_records())) {
+    return ReadingFailed(
+        pos,
+        absl::StrCat("record index out of range, chunk has ",
+                     chunk_decoder.num_records(), " records"),
+        error_message);
+  }
+  chunk_decoder.SetIndex(pos.record_index());
+  if (ABSL_PREDICT_FALSE(!chunk_decoder.ReadRecord(record))) {
+    return ReadingFailed(pos, chunk_decoder.message(), error_message);
+  }
+  return true;
+}
+
+bool RandomAccessRecordReaderBase::ReadRecordAt(
+    RecordPosition pos, google::protobuf::MessageLite* record,
+    std::string* error_message) const {
+  return ReadRecordAtImpl(pos, record, error_message);
+}
+
+bool RandomAccessRecordReaderBase::ReadRecordAt(
+    RecordPosition pos, std::string* record, std::string* error_message) const {
+  return ReadRecordAtImpl(pos, record, error_message);
+}
+
+bool RandomAccessRecordReaderBase::ReadRecordAt(
+    RecordPosition pos, Chain* record, std::string* error_message) const {
+  return ReadRecordAtImpl(pos, record, error_message);
+}
+
+template class RandomAccessRecordReader<OwnedFd>;
+template class RandomAccessRecordReader<int>;
+
+}  // namespace riegeli
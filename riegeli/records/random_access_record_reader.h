@@ -0,0 +1,276 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_RANDOM_ACCESS_RECORD_READER_H_
+#define RIEGELI_RECORDS_RANDOM_ACCESS_RECORD_READER_H_
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "absl/utility/utility.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/dependency.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/fd_dependency.h"
+#include "riegeli/bytes/zstd_dictionary.h"
+#include "riegeli/chunk_encoding/field_projection.h"
+#include "riegeli/records/record_position.h"
+
+namespace riegeli {
+
+// Template parameter invariant part of RandomAccessRecordReader.
+class RandomAccessRecordReaderBase : public Object {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Specifies the set of fields to be included in returned records, allowing
+    // to exclude the remaining fields (but does not guarantee that they will be
+    // excluded). Excluding data makes reading faster.
+    Options& set_field_projection(FieldProjection field_projection) & {
+      field_projection_ = std::move(field_projection);
+      return *this;
+    }
+    Options&& set_field_projection(FieldProjection field_projection) && {
+      return std::move(set_field_projection(std::move(field_projection)));
+    }
+
+    // Size of the buffer used by each ReadRecordAt() call for reading the
+    // chunk containing the record.
+    //
+    // Default: 64K
+    Options& set_buffer_size(size_t buffer_size) & {
+      RIEGELI_ASSERT_GT(buffer_size, 0u)
+          << "Failed precondition of "
+             "RandomAccessRecordReaderBase::Options::set_buffer_size(): "
+             "zero buffer size";
+      buffer_size_ = buffer_size;
+      return *this;
+    }
+    Options&& set_buffer_size(size_t buffer_size) && {
+      return std::move(set_buffer_size(buffer_size));
+    }
+
+   private:
+    friend class RandomAccessRecordReaderBase;
+
+    FieldProjection field_projection_ = FieldProjection::All();
+    size_t buffer_size_ = kDefaultBufferSize();
+  };
+
+  // Returns the fd being read from. If the fd is owned then changed to -1 by
+  // Close(), otherwise unchanged.
+  virtual int src_fd() const = 0;
+
+  // Returns the original name of the file being read from (or
+  // /proc/self/fd/<fd> if fd was given). Unchanged by Close().
+  const std::string& filename() const { return filename_; }
+
+  // Reads the record at the given position, which should have been obtained
+  // by RecordReader::pos(), by RecordReader::ReadRecord() in *key, or by
+  // RecordWriter for the same file.
+  //
+  // ReadRecordAt() reads the chunk containing the record with pread() at the
+  // chunk position, verifies it, and decodes it. No position is shared between
+  // calls, so ReadRecordAt() may be called concurrently from multiple threads
+  // (but not concurrently with Close()). Failures of ReadRecordAt() do not
+  // change the state of the RandomAccessRecordReader.
+  //
+  // ReadRecordAt(MessageLite*) parses raw bytes to a proto message after
+  // reading. The remaining overloads read raw bytes.
+  //
+  // If error_message != nullptr, *error_message is set to the reason of a
+  // failure.
+  //
+  // Return values:
+  //  * true  - success (*record is set)
+  //  * false - failure (*error_message is set)
+  bool ReadRecordAt(RecordPosition pos, google::protobuf::MessageLite* record,
+                    std::string* error_message = nullptr) const;
+  bool ReadRecordAt(RecordPosition pos, std::string* record,
+                    std::string* error_message = nullptr) const;
+  bool ReadRecordAt(RecordPosition pos, Chain* record,
+                    std::string* error_message = nullptr) const;
+
+ protected:
+  explicit RandomAccessRecordReaderBase(State state) noexcept : Object(state) {}
+
+  explicit RandomAccessRecordReaderBase(Options&& options);
+
+  RandomAccessRecordReaderBase(RandomAccessRecordReaderBase&& that) noexcept;
+  RandomAccessRecordReaderBase& operator=(
+      RandomAccessRecordReaderBase&& that) noexcept;
+
+  void SetFilename(int src);
+  int OpenFd(absl::string_view filename, int flags);
+  ABSL_ATTRIBUTE_COLD bool FailOperation(absl::string_view operation);
+  // Reads the Zstd dictionary from file metadata, if any.
+  void Initialize(int src);
+  void Done() override;
+
+ private:
+  template <typename Record>
+  bool ReadRecordAtImpl(RecordPosition pos, Record* record,
+                        std::string* error_message) const;
+
+  FieldProjection field_projection_;
+  size_t buffer_size_ = 0;
+  std::string filename_;
+  // Needed for decoding chunks compressed with it, or nullptr.
+  std::shared_ptr<const ZstdDictionary> zstd_dictionary_;
+};
+
+// RandomAccessRecordReader reads individual records of a Riegeli/records file
+// at known positions. Unlike RecordReader, it keeps no current position, so a
+// single RandomAccessRecordReader may serve lookups from multiple threads
+// sharing a single fd.
+//
+// Each ReadRecordAt() call reads and decodes the whole chunk containing the
+// record. For reading many records of the same chunk, or reading records
+// sequentially, RecordReader is more efficient.
+//
+// The Src template parameter specifies the type of the object providing and
+// possibly owning the fd being read from. Src must support
+// Dependency<int, Src>, e.g. OwnedFd (owned, default), int (not owned).
+//
+// The fd must support pread(), and must not be closed until the
+// RandomAccessRecordReader is closed or no longer used.
+template <typename Src = OwnedFd>
+class RandomAccessRecordReader : public RandomAccessRecordReaderBase {
+ public:
+  // Creates a closed RandomAccessRecordReader.
+  RandomAccessRecordReader() noexcept
+      : RandomAccessRecordReaderBase(State::kClosed) {}
+
+  // Will read from the fd provided by src.
+  //
+  // type_identity_t<Src> disables template parameter deduction (C++17), letting
+  // RandomAccessRecordReader(fd) mean RandomAccessRecordReader<OwnedFd>(fd)
+  // rather than RandomAccessRecordReader<int>(fd).
+  explicit RandomAccessRecordReader(type_identity_t<Src> src,
+                                    Options options = Options());
+
+  // Opens a file for reading.
+  //
+  // flags is the second argument of open, typically O_RDONLY.
+  //
+  // flags must include O_RDONLY or O_RDWR.
+  explicit RandomAccessRecordReader(absl::string_view filename, int flags,
+                                    Options options = Options());
+
+  RandomAccessRecordReader(RandomAccessRecordReader&& that) noexcept;
+  RandomAccessRecordReader& operator=(RandomAccessRecordReader&& that) noexcept;
+
+  // Returns the object providing and possibly owning the fd being read from. If
+  // the fd is owned then changed to -1 by Close(), otherwise unchanged.
+  Src& src() { return src_.manager(); }
+  const Src& src() const { return src_.manager(); }
+  int src_fd() const override { return src_.ptr(); }
+
+ protected:
+  void Done() override;
+
+ private:
+  // The object providing and possibly owning the fd being read from.
+  Dependency<int, Src> src_;
+};
+
+// Implementation details follow.
+
+inline RandomAccessRecordReaderBase::RandomAccessRecordReaderBase(
+    RandomAccessRecordReaderBase&& that) noexcept
+    : Object(std::move(that)),
+      field_projection_(std::move(that.field_projection_)),
+      buffer_size_(absl::exchange(that.buffer_size_, 0)),
+      filename_(absl::exchange(that.filename_, std::string())),
+      zstd_dictionary_(std::move(that.zstd_dictionary_)) {}
+
+inline RandomAccessRecordReaderBase& RandomAccessRecordReaderBase::operator=(
+    RandomAccessRecordReaderBase&& that) noexcept {
+  Object::operator=(std::move(that));
+  field_projection_ = std::move(that.field_projection_);
+  buffer_size_ = absl::exchange(that.buffer_size_, 0);
+  filename_ = absl::exchange(that.filename_, std::string());
+  zstd_dictionary_ = std::move(that.zstd_dictionary_);
+  return *this;
+}
+
+template <typename Src>
+RandomAccessRecordReader<Src>::RandomAccessRecordReader(
+    type_identity_t<Src> src, Options options)
+    : RandomAccessRecordReaderBase(std::move(options)), src_(std::move(src)) {
+  RIEGELI_ASSERT_GE(src_.ptr(), 0)
+      << "Failed precondition of "
+         "RandomAccessRecordReader<Src>::RandomAccessRecordReader(Src): "
+         "negative file descriptor";
+  SetFilename(src_.ptr());
+  Initialize(src_.ptr());
+}
+
+template <typename Src>
+RandomAccessRecordReader<Src>::RandomAccessRecordReader(
+    absl::string_view filename, int flags, Options options)
+    : RandomAccessRecordReaderBase(std::move(options)) {
+  RIEGELI_ASSERT((flags & O_ACCMODE) == O_RDONLY ||
+                 (flags & O_ACCMODE) == O_RDWR)
+      << "Failed precondition of "
+         "RandomAccessRecordReader::RandomAccessRecordReader(string_view): "
+         "flags must include O_RDONLY or O_RDWR";
+  const int src = OpenFd(filename, flags);
+  if (ABSL_PREDICT_FALSE(src < 0)) return;
+  src_ = Dependency<int, Src>(Src(src));
+  Initialize(src_.ptr());
+}
+
+template <typename Src>
+inline RandomAccessRecordReader<Src>::RandomAccessRecordReader(
+    RandomAccessRecordReader&& that) noexcept
+    : RandomAccessRecordReaderBase(std::move(that)),
+      src_(std::move(that.src_)) {}
+
+template <typename Src>
+inline RandomAccessRecordReader<Src>& RandomAccessRecordReader<Src>::operator=(
+    RandomAccessRecordReader&& that) noexcept {
+  RandomAccessRecordReaderBase::operator=(std::move(that));
+  src_ = std::move(that.src_);
+  return *this;
+}
+
+template <typename Src>
+void RandomAccessRecordReader<Src>::Done() {
+  RandomAccessRecordReaderBase::Done();
+  if (src_.kIsOwning() && src_.ptr() >= 0) {
+    const int src = src_.Release();
+    if (ABSL_PREDICT_FALSE(internal::CloseFd(src) < 0) &&
+        ABSL_PREDICT_TRUE(healthy())) {
+      FailOperation(internal::CloseFunctionName());
+    }
+  }
+}
+
+extern template class RandomAccessRecordReader<OwnedFd>;
+extern template class RandomAccessRecordReader<int>;
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_RANDOM_ACCESS_RECORD_READER_H_
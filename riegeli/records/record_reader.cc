@@ -16,6 +16,8 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <string>
 #include <utility>
@@ -25,6 +27,8 @@
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "absl/utility/utility.h"
 #include "google/protobuf/descriptor.h"
 #include "google/protobuf/descriptor.pb.h"
@@ -37,6 +41,7 @@
 #include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/message_parse.h"
 #include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/chunk_decoder.h"
 #include "riegeli/chunk_encoding/constants.h"
@@ -104,7 +109,13 @@ RecordReaderBase::RecordReaderBase(RecordReaderBase&& that) noexcept
     : Object(std::move(that)),
       chunk_begin_(absl::exchange(that.chunk_begin_, 0)),
       chunk_decoder_(std::move(that.chunk_decoder_)),
-      recoverable_(absl::exchange(that.recoverable_, Recoverable::kNo)) {}
+      recoverable_(absl::exchange(that.recoverable_, Recoverable::kNo)),
+      zstd_dictionary_state_(absl::exchange(that.zstd_dictionary_state_,
+                                            ZstdDictionaryState::kUnknown)),
+      follow_min_backoff_(that.follow_min_backoff_),
+      follow_max_backoff_(that.follow_max_backoff_),
+      follow_timeout_(that.follow_timeout_),
+      follow_(that.follow_.exchange(false, std::memory_order_relaxed)) {}
 
 RecordReaderBase& RecordReaderBase::operator=(
     RecordReaderBase&& that) noexcept {
@@ -112,6 +123,13 @@ RecordReaderBase& RecordReaderBase::operator=(
   chunk_begin_ = absl::exchange(that.chunk_begin_, 0);
   chunk_decoder_ = std::move(that.chunk_decoder_);
   recoverable_ = absl::exchange(that.recoverable_, Recoverable::kNo);
+  zstd_dictionary_state_ = absl::exchange(that.zstd_dictionary_state_,
+                                          ZstdDictionaryState::kUnknown);
+  follow_min_backoff_ = that.follow_min_backoff_;
+  follow_max_backoff_ = that.follow_max_backoff_;
+  follow_timeout_ = that.follow_timeout_;
+  follow_.store(that.follow_.exchange(false, std::memory_order_relaxed),
+                std::memory_order_relaxed);
   return *this;
 }
 
@@ -119,6 +137,11 @@ void RecordReaderBase::Initialize(ChunkReader* src, Options&& options) {
   chunk_begin_ = src->pos();
   chunk_decoder_ = ChunkDecoder(ChunkDecoder::Options().set_field_projection(
       std::move(options.field_projection_)));
+  follow_min_backoff_ = options.follow_min_backoff_;
+  follow_max_backoff_ =
+      std::max(options.follow_max_backoff_, options.follow_min_backoff_);
+  follow_timeout_ = options.follow_timeout_;
+  follow_.store(options.follow_, std::memory_order_relaxed);
 }
 
 void RecordReaderBase::Done() {
@@ -175,6 +198,7 @@ bool RecordReaderBase::ReadMetadata(RecordsMetadata* metadata) {
   if (chunk_header->chunk_type() != ChunkType::kFileMetadata) {
     // Missing file metadata chunk, assume empty RecordMetadata.
     metadata->Clear();
+    zstd_dictionary_state_ = ZstdDictionaryState::kKnown;
     return true;
   }
   if (ABSL_PREDICT_FALSE(!src->ReadChunk(&chunk))) {
@@ -189,6 +213,7 @@ bool RecordReaderBase::ReadMetadata(RecordsMetadata* metadata) {
     recoverable_ = Recoverable::kRecoverChunkDecoder;
     return false;
   }
+  SetZstdDictionary(*metadata);
   return true;
 }
 
@@ -206,9 +231,11 @@ inline bool RecordReaderBase::ParseMetadata(const Chunk& chunk,
   TransposeDecoder transpose_decoder;
   ChainBackwardWriter<Chain> serialized_metadata_writer((Chain()));
   std::vector<size_t> limits;
+  // Metadata are compressed without the Zstd dictionary, because the
+  // dictionary is stored in them.
   const bool ok = transpose_decoder.Reset(
       &data_reader, 1, chunk.header.decoded_data_size(), FieldProjection::All(),
-      &serialized_metadata_writer, &limits);
+      nullptr, &serialized_metadata_writer, &limits);
   if (ABSL_PREDICT_FALSE(!serialized_metadata_writer.Close())) {
     return Fail(serialized_metadata_writer);
   }
@@ -230,6 +257,78 @@ inline bool RecordReaderBase::ParseMetadata(const Chunk& chunk,
   return true;
 }
 
+void RecordReaderBase::SetZstdDictionary(const RecordsMetadata& metadata) {
+  if (zstd_dictionary_state_ == ZstdDictionaryState::kKnown) return;
+  zstd_dictionary_state_ = ZstdDictionaryState::kKnown;
+  if (metadata.has_zstd_dictionary()) {
+    chunk_decoder_.SetZstdDictionary(
+        std::make_shared<const ZstdDictionary>(metadata.zstd_dictionary()));
+  }
+}
+
+bool RecordReaderBase::FindZstdDictionary(const Chunk& chunk) {
+  RIEGELI_ASSERT(zstd_dictionary_state_ != ZstdDictionaryState::kKnown)
+      << "Failed precondition of RecordReaderBase::FindZstdDictionary(): "
+         "dictionary already known";
+  switch (chunk.header.chunk_type()) {
+    case ChunkType::kFileSignature:
+      zstd_dictionary_state_ = ZstdDictionaryState::kAfterSignature;
+      return true;
+    case ChunkType::kFileMetadata: {
+      RecordsMetadata metadata;
+      if (ABSL_PREDICT_FALSE(!ParseMetadata(chunk, &metadata))) {
+        chunk_decoder_.Reset();
+        recoverable_ = Recoverable::kRecoverChunkDecoder;
+        return false;
+      }
+      SetZstdDictionary(metadata);
+      return true;
+    }
+    default:
+      break;
+  }
+  if (zstd_dictionary_state_ == ZstdDictionaryState::kAfterSignature) {
+    // Missing file metadata chunk.
+    zstd_dictionary_state_ = ZstdDictionaryState::kKnown;
+    return true;
+  }
+  // Reading started in the middle of the file. Chunks without records do not
+  // need the dictionary, so looking for it is postponed.
+  if (chunk.header.num_records() == 0) return true;
+  zstd_dictionary_state_ = ZstdDictionaryState::kKnown;
+  ChunkReader* const src = src_chunk_reader();
+  // Without random access, chunks compressed with a dictionary fail to decode.
+  if (!src->SupportsRandomAccess()) return true;
+  const Position pos_after_chunk = src->pos();
+  bool metadata_ok = true;
+  if (src->Seek(0)) {
+    Chunk metadata_chunk;
+    const ChunkHeader* chunk_header;
+    if (src->ReadChunk(&metadata_chunk) &&
+        src->PullChunkHeader(&chunk_header) &&
+        chunk_header->chunk_type() == ChunkType::kFileMetadata &&
+        src->ReadChunk(&metadata_chunk)) {
+      RecordsMetadata metadata;
+      metadata_ok = ParseMetadata(metadata_chunk, &metadata);
+      if (ABSL_PREDICT_TRUE(metadata_ok)) {
+        zstd_dictionary_state_ = ZstdDictionaryState::kUnknown;
+        SetZstdDictionary(metadata);
+      }
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!src->healthy() || !src->Seek(pos_after_chunk))) {
+    chunk_decoder_.Reset();
+    recoverable_ = Recoverable::kRecoverChunkReader;
+    return Fail(*src);
+  }
+  if (ABSL_PREDICT_FALSE(!metadata_ok)) {
+    chunk_decoder_.Reset();
+    recoverable_ = Recoverable::kRecoverChunkDecoder;
+    return false;
+  }
+  return true;
+}
+
 template <typename Record>
 bool RecordReaderBase::ReadRecordSlow(Record* record, RecordPosition* key) {
   if (chunk_decoder_.healthy()) {
@@ -238,12 +337,21 @@ bool RecordReaderBase::ReadRecordSlow(Record* record, RecordPosition* key) {
            "records available, use ReadRecord() instead";
   }
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  absl::Duration backoff = follow_min_backoff_;
+  absl::Time deadline = absl::InfinitePast();
   for (;;) {
     if (ABSL_PREDICT_FALSE(!chunk_decoder_.healthy())) {
       recoverable_ = Recoverable::kRecoverChunkDecoder;
       return Fail(chunk_decoder_);
     }
-    if (ABSL_PREDICT_FALSE(!ReadChunk())) return false;
+    if (ABSL_PREDICT_FALSE(!ReadChunk())) {
+      if (ABSL_PREDICT_FALSE(!healthy())) return false;
+      // The source ends at a chunk boundary or inside a partially written
+      // chunk. ChunkReader is positioned at its beginning, so retrying rereads
+      // only the incomplete chunk.
+      if (!WaitForChunk(&backoff, &deadline)) return false;
+      continue;
+    }
     if (ABSL_PREDICT_TRUE(chunk_decoder_.ReadRecord(record))) {
       RIEGELI_ASSERT_GT(chunk_decoder_.index(), 0u)
           << "ChunkDecoder::ReadRecord() left record index at 0";
@@ -264,6 +372,49 @@ template bool RecordReaderBase::ReadRecordSlow(std::string* record,
 template bool RecordReaderBase::ReadRecordSlow(Chain* record,
                                                RecordPosition* key);
 
+template <typename Record>
+bool RecordReaderBase::ReadRecordBackwardImpl(Record* record,
+                                              RecordPosition* key) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  while (chunk_decoder_.index() == 0) {
+    if (chunk_begin_ == 0) return false;
+    if (ABSL_PREDICT_FALSE(!ReadPreviousChunk())) return false;
+  }
+  const uint64_t index = chunk_decoder_.index() - 1;
+  chunk_decoder_.SetIndex(index);
+  if (ABSL_PREDICT_FALSE(!chunk_decoder_.ReadRecord(record))) {
+    recoverable_ = Recoverable::kRecoverChunkDecoderBackward;
+    return Fail(chunk_decoder_);
+  }
+  chunk_decoder_.SetIndex(index);
+  if (key != nullptr) *key = RecordPosition(chunk_begin_, index);
+  return true;
+}
+
+template bool RecordReaderBase::ReadRecordBackwardImpl(
+    google::protobuf::MessageLite* record, RecordPosition* key);
+template bool RecordReaderBase::ReadRecordBackwardImpl(
+    absl::string_view* record, RecordPosition* key);
+template bool RecordReaderBase::ReadRecordBackwardImpl(std::string* record,
+                                                       RecordPosition* key);
+template bool RecordReaderBase::ReadRecordBackwardImpl(Chain* record,
+                                                       RecordPosition* key);
+
+bool RecordReaderBase::WaitForChunk(absl::Duration* backoff,
+                                    absl::Time* deadline) {
+  if (!follow_.load(std::memory_order_relaxed)) return false;
+  const absl::Time now = absl::Now();
+  if (*deadline == absl::InfinitePast()) *deadline = now + follow_timeout_;
+  if (now >= *deadline) return false;
+  absl::SleepFor(std::min(*backoff, *deadline - now));
+  *backoff = std::min(*backoff * 2, follow_max_backoff_);
+  return follow_.load(std::memory_order_relaxed);
+}
+
+void RecordReaderBase::StopFollowing() {
+  follow_.store(false, std::memory_order_relaxed);
+}
+
 bool RecordReaderBase::Recover(SkippedRegion* skipped_region) {
   if (recoverable_ == Recoverable::kNo) return false;
   ChunkReader* const src = src_chunk_reader();
@@ -293,6 +444,22 @@ bool RecordReaderBase::Recover(SkippedRegion* skipped_region) {
       }
       return true;
     }
+    case Recoverable::kRecoverChunkDecoderBackward: {
+      const uint64_t index_before = chunk_decoder_.index();
+      Position region_begin = chunk_begin_ + index_before;
+      if (ABSL_PREDICT_TRUE(chunk_decoder_.Recover())) {
+        chunk_decoder_.SetIndex(index_before);
+      } else {
+        // Skip the rest of the chunk, which is before the record.
+        chunk_decoder_.Reset();
+        region_begin = chunk_begin_;
+      }
+      if (skipped_region != nullptr) {
+        const Position region_end = chunk_begin_ + index_before + 1;
+        *skipped_region = SkippedRegion(region_begin, region_end);
+      }
+      return true;
+    }
   }
   RIEGELI_ASSERT_UNREACHABLE()
       << "Unknown recoverable method: " << static_cast<int>(recoverable);
@@ -385,6 +552,11 @@ inline bool RecordReaderBase::ReadChunk() {
     }
     return false;
   }
+  if (ABSL_PREDICT_FALSE(zstd_dictionary_state_ !=
+                         ZstdDictionaryState::kKnown) &&
+      ABSL_PREDICT_FALSE(!FindZstdDictionary(chunk))) {
+    return false;
+  }
   if (ABSL_PREDICT_FALSE(!chunk_decoder_.Reset(chunk))) {
     recoverable_ = Recoverable::kRecoverChunkDecoder;
     return Fail(chunk_decoder_);
@@ -392,6 +564,22 @@ inline bool RecordReaderBase::ReadChunk() {
   return true;
 }
 
+bool RecordReaderBase::ReadPreviousChunk() {
+  RIEGELI_ASSERT_GT(chunk_begin_, 0u)
+      << "Failed precondition of RecordReaderBase::ReadPreviousChunk(): "
+         "at the beginning of the file";
+  ChunkReader* const src = src_chunk_reader();
+  if (ABSL_PREDICT_FALSE(!src->SeekToChunkBefore(chunk_begin_ - 1))) {
+    chunk_begin_ = src->pos();
+    chunk_decoder_.Reset();
+    recoverable_ = Recoverable::kRecoverChunkReader;
+    return Fail(*src);
+  }
+  if (ABSL_PREDICT_FALSE(!ReadChunk())) return false;
+  chunk_decoder_.SetIndex(chunk_decoder_.num_records());
+  return true;
+}
+
 template class RecordReader<Reader*>;
 template class RecordReader<std::unique_ptr<Reader>>;
 template class RecordReader<ChunkReader*>;
@@ -399,4 +587,19 @@ template class RecordReader<std::unique_ptr<ChunkReader>>;
 template class RecordReader<DefaultChunkReader<Reader*>>;
 template class RecordReader<DefaultChunkReader<std::unique_ptr<Reader>>>;
 
+namespace internal {
+
+std::shared_ptr<const ZstdDictionary> ReadZstdDictionary(Reader* src) {
+  if (ABSL_PREDICT_FALSE(!src->Seek(0))) return nullptr;
+  RecordReader<Reader*> record_reader(src);
+  RecordsMetadata metadata;
+  if (ABSL_PREDICT_FALSE(!record_reader.ReadMetadata(&metadata)) ||
+      !metadata.has_zstd_dictionary()) {
+    return nullptr;
+  }
+  return std::make_shared<const ZstdDictionary>(metadata.zstd_dictionary());
+}
+
+}  // namespace internal
+
 }  // namespace riegeli
@@ -15,12 +15,14 @@
 #ifndef RIEGELI_RECORDS_RECORD_READER_H_
 #define RIEGELI_RECORDS_RECORD_READER_H_
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <utility>
 
 #include "absl/base/optimization.h"
 #include "absl/strings/string_view.h"
+#include "absl/time/time.h"
 #include "absl/utility/utility.h"
 #include "google/protobuf/descriptor.h"
 #include "google/protobuf/message_lite.h"
@@ -29,6 +31,7 @@
 #include "riegeli/base/dependency.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "riegeli/chunk_encoding/chunk_decoder.h"
 #include "riegeli/chunk_encoding/field_projection.h"
 #include "riegeli/records/chunk_reader.h"
@@ -89,10 +92,78 @@ class RecordReaderBase : public Object {
       return std::move(set_field_projection(std::move(field_projection)));
     }
 
+    // If true, the file is assumed to be still being written. When ReadRecord()
+    // reaches the end of the data written so far, either at a chunk boundary or
+    // in the middle of a partially written chunk, it waits for the file to grow
+    // and resumes from the beginning of the incomplete chunk, instead of
+    // returning false.
+    //
+    // Waiting polls the source with exponential backoff between
+    // follow_min_backoff() and follow_max_backoff(). ReadRecord() returns false
+    // if no complete chunk appears during follow_timeout(), or after
+    // StopFollowing() is called.
+    //
+    // This requires a source which observes data appended after it reported
+    // its end, e.g. FdReader or FdStreamReader, but not FdMMapReader.
+    //
+    // Default: false
+    Options& set_follow(bool follow) & {
+      follow_ = follow;
+      return *this;
+    }
+    Options&& set_follow(bool follow) && {
+      return std::move(set_follow(follow));
+    }
+
+    // Bounds of the delay between attempts to read more data in follow mode.
+    // The delay starts at follow_min_backoff() and doubles after each
+    // unsuccessful attempt, up to follow_max_backoff().
+    //
+    // Default: 1ms, 1s
+    Options& set_follow_min_backoff(absl::Duration follow_min_backoff) & {
+      RIEGELI_ASSERT_GT(follow_min_backoff, absl::ZeroDuration())
+          << "Failed precondition of "
+             "RecordReaderBase::Options::set_follow_min_backoff(): "
+             "non-positive backoff";
+      follow_min_backoff_ = follow_min_backoff;
+      return *this;
+    }
+    Options&& set_follow_min_backoff(absl::Duration follow_min_backoff) && {
+      return std::move(set_follow_min_backoff(follow_min_backoff));
+    }
+    Options& set_follow_max_backoff(absl::Duration follow_max_backoff) & {
+      RIEGELI_ASSERT_GT(follow_max_backoff, absl::ZeroDuration())
+          << "Failed precondition of "
+             "RecordReaderBase::Options::set_follow_max_backoff(): "
+             "non-positive backoff";
+      follow_max_backoff_ = follow_max_backoff;
+      return *this;
+    }
+    Options&& set_follow_max_backoff(absl::Duration follow_max_backoff) && {
+      return std::move(set_follow_max_backoff(follow_max_backoff));
+    }
+
+    // How long ReadRecord() waits in follow mode for a complete chunk before
+    // returning false. The RecordReader remains healthy then, and a later
+    // ReadRecord() continues waiting.
+    //
+    // Default: absl::InfiniteDuration()
+    Options& set_follow_timeout(absl::Duration follow_timeout) & {
+      follow_timeout_ = follow_timeout;
+      return *this;
+    }
+    Options&& set_follow_timeout(absl::Duration follow_timeout) && {
+      return std::move(set_follow_timeout(follow_timeout));
+    }
+
    private:
     friend class RecordReaderBase;
 
     FieldProjection field_projection_ = FieldProjection::All();
+    bool follow_ = false;
+    absl::Duration follow_min_backoff_ = absl::Milliseconds(1);
+    absl::Duration follow_max_backoff_ = absl::Seconds(1);
+    absl::Duration follow_timeout_ = absl::InfiniteDuration();
   };
 
   // Returns the Riegeli/records file being read from. Unchanged by Close().
@@ -144,6 +215,31 @@ class RecordReaderBase : public Object {
   bool ReadRecord(std::string* record, RecordPosition* key = nullptr);
   bool ReadRecord(Chain* record, RecordPosition* key = nullptr);
 
+  // Reads the record before the current position, leaving the position before
+  // that record, i.e. ReadRecordBackward() iterates over records in reverse.
+  //
+  // To read the last records of a file, Seek() to Size() and then call
+  // ReadRecordBackward() repeatedly. Chunks are located from the end using
+  // block headers, and each chunk is decoded once, so this costs about as much
+  // as reading the chunks containing the records, not the whole file.
+  //
+  // ReadRecordBackward() requires SupportsRandomAccess().
+  //
+  // After a failure in ReadRecordBackward(), Recover() skips an unparsable
+  // message backwards, but recovery of the ChunkReader (skipping invalid file
+  // contents) continues forwards, as for ReadRecord().
+  //
+  // Return values:
+  //  * true                    - success (*record is set)
+  //  * false (when healthy())  - beginning of the source reached
+  //  * false (when !healthy()) - failure
+  bool ReadRecordBackward(google::protobuf::MessageLite* record,
+                          RecordPosition* key = nullptr);
+  bool ReadRecordBackward(absl::string_view* record,
+                          RecordPosition* key = nullptr);
+  bool ReadRecordBackward(std::string* record, RecordPosition* key = nullptr);
+  bool ReadRecordBackward(Chain* record, RecordPosition* key = nullptr);
+
   // If !healthy() and the failure was caused by invalid file contents, then
   // Recover() tries to recover from the failure and allow reading again by
   // skipping over the invalid region.
@@ -162,6 +258,17 @@ class RecordReaderBase : public Object {
   //  * false - failure not caused by invalid file contents
   bool Recover(SkippedRegion* skipped_region = nullptr);
 
+  // Makes a ReadRecord() waiting in follow mode return false, and disables
+  // waiting in later calls, which behave as if set_follow(false) was used.
+  //
+  // StopFollowing() may be called concurrently with other operations, e.g. from
+  // another thread to end a reading loop blocked on a file which is no longer
+  // being written. It has no effect if set_follow(true) was not used.
+  //
+  // Waiting notices StopFollowing() before the next poll, i.e. within
+  // follow_max_backoff().
+  void StopFollowing();
+
   // Returns the current position.
   //
   // pos().numeric() returns the position as an integer of type Position.
@@ -214,7 +321,12 @@ class RecordReaderBase : public Object {
 #endif
 
  protected:
-  enum class Recoverable { kNo, kRecoverChunkReader, kRecoverChunkDecoder };
+  enum class Recoverable {
+    kNo,
+    kRecoverChunkReader,
+    kRecoverChunkDecoder,
+    kRecoverChunkDecoderBackward
+  };
 
   explicit RecordReaderBase(State state) noexcept;
 
@@ -245,6 +357,10 @@ class RecordReaderBase : public Object {
   //  * Recoverable::kRecoverChunkDecoder - Recover() tries to recover
   //                                        chunk_decoder_, skips the chunk if
   //                                        that failed
+  //  * Recoverable::kRecoverChunkDecoderBackward
+  //                                      - like kRecoverChunkDecoder, but
+  //                                        leaves the position before the
+  //                                        skipped record
   //
   // Invariants:
   //   if healthy() then recoverable_ == Recoverable::kNo
@@ -253,16 +369,65 @@ class RecordReaderBase : public Object {
   Recoverable recoverable_ = Recoverable::kNo;
 
  private:
+  // Progress of finding the Zstd dictionary stored in file metadata, which is
+  // needed for decoding chunks compressed with it.
+  enum class ZstdDictionaryState {
+    kUnknown,         // File metadata have not been seen.
+    kAfterSignature,  // File metadata may be the next chunk.
+    kKnown,           // chunk_decoder_ has the dictionary, if any.
+  };
+
   bool ParseMetadata(const Chunk& chunk, RecordsMetadata* metadata);
 
+  // Makes chunk_decoder_ use the Zstd dictionary from metadata, if any.
+  void SetZstdDictionary(const RecordsMetadata& metadata);
+
+  // Updates zstd_dictionary_state_ before decoding chunk, which has just been
+  // read from chunk_begin_. If reading started in the middle of the file,
+  // reads file metadata from the beginning of the file if possible.
+  //
+  // Precondition: zstd_dictionary_state_ != ZstdDictionaryState::kKnown
+  bool FindZstdDictionary(const Chunk& chunk);
+
+  // Sleeps before the next attempt to read a chunk in follow mode.
+  //
+  // *backoff is the delay to use, updated for the next attempt. *deadline
+  // should be absl::InfinitePast() before the first call for a given
+  // ReadRecord(), and is then set from follow_timeout_.
+  //
+  // Return values:
+  //  * true  - ReadRecord() should try again
+  //  * false - ReadRecord() should give up (timeout or StopFollowing())
+  bool WaitForChunk(absl::Duration* backoff, absl::Time* deadline);
+
   // Precondition: !chunk_decoder_.healthy() ||
   //               chunk_decoder_.index() == chunk_decoder_.num_records()
   template <typename Record>
   bool ReadRecordSlow(Record* record, RecordPosition* key);
 
+  template <typename Record>
+  bool ReadRecordBackwardImpl(Record* record, RecordPosition* key);
+
+  // Reads the chunk ending at chunk_begin_ and decodes it into chunk_decoder_
+  // and chunk_begin_, with the record index at the end of the chunk. On failure
+  // resets chunk_decoder_.
+  //
+  // Precondition: chunk_begin_ > 0
+  bool ReadPreviousChunk();
+
   // Reads the next chunk from chunk_reader_ and decodes it into chunk_decoder_
   // and chunk_begin_. On failure resets chunk_decoder_.
   bool ReadChunk();
+
+  ZstdDictionaryState zstd_dictionary_state_ = ZstdDictionaryState::kUnknown;
+
+  absl::Duration follow_min_backoff_;
+  absl::Duration follow_max_backoff_;
+  absl::Duration follow_timeout_;
+
+  // Whether ReadRecord() waits for more data at the end of the source. Cleared
+  // by StopFollowing().
+  std::atomic<bool> follow_{false};
 };
 
 // RecordReader reads records of a Riegeli/records file. A record is
@@ -354,6 +519,17 @@ class RecordReader : public RecordReaderBase {
   Dependency<ChunkReader*, Src> src_;
 };
 
+namespace internal {
+
+// Reads the Zstd dictionary stored in metadata of the Riegeli/records file read
+// by src, from the beginning of the file.
+//
+// Returns nullptr if there is no dictionary or reading metadata failed; in the
+// latter case decoding chunks compressed with the dictionary will fail.
+std::shared_ptr<const ZstdDictionary> ReadZstdDictionary(Reader* src);
+
+}  // namespace internal
+
 // Implementation details follow.
 
 inline RecordsMetadataDescriptors::RecordsMetadataDescriptors(
@@ -421,10 +597,32 @@ inline bool RecordReaderBase::ReadRecord(Chain* record, RecordPosition* key) {
   return ReadRecordSlow(record, key);
 }
 
+inline bool RecordReaderBase::ReadRecordBackward(
+    google::protobuf::MessageLite* record, RecordPosition* key) {
+  return ReadRecordBackwardImpl(record, key);
+}
+
+inline bool RecordReaderBase::ReadRecordBackward(absl::string_view* record,
+                                                 RecordPosition* key) {
+  return ReadRecordBackwardImpl(record, key);
+}
+
+inline bool RecordReaderBase::ReadRecordBackward(std::string* record,
+                                                 RecordPosition* key) {
+  return ReadRecordBackwardImpl(record, key);
+}
+
+inline bool RecordReaderBase::ReadRecordBackward(Chain* record,
+                                                 RecordPosition* key) {
+  return ReadRecordBackwardImpl(record, key);
+}
+
 inline RecordPosition RecordReaderBase::pos() const {
   if (ABSL_PREDICT_TRUE(chunk_decoder_.index() <
                         chunk_decoder_.num_records()) ||
-      ABSL_PREDICT_FALSE(recoverable_ == Recoverable::kRecoverChunkDecoder)) {
+      ABSL_PREDICT_FALSE(recoverable_ == Recoverable::kRecoverChunkDecoder ||
+                         recoverable_ ==
+                             Recoverable::kRecoverChunkDecoderBackward)) {
     return RecordPosition(chunk_begin_, chunk_decoder_.index());
   }
   return RecordPosition(src_chunk_reader()->pos(), 0);
@@ -466,7 +664,9 @@ template <typename Src>
 inline RecordPosition RecordReader<Src>::pos() const {
   if (ABSL_PREDICT_TRUE(chunk_decoder_.index() <
                         chunk_decoder_.num_records()) ||
-      ABSL_PREDICT_FALSE(recoverable_ == Recoverable::kRecoverChunkDecoder)) {
+      ABSL_PREDICT_FALSE(recoverable_ == Recoverable::kRecoverChunkDecoder ||
+                         recoverable_ ==
+                             Recoverable::kRecoverChunkDecoderBackward)) {
     return RecordPosition(chunk_begin_, chunk_decoder_.index());
   }
   return RecordPosition(src_->pos(), 0);
@@ -46,6 +46,7 @@
 #include "riegeli/bytes/writer.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/chunk_encoder.h"
+#include "riegeli/chunk_encoding/compressor_options.h"
 #include "riegeli/chunk_encoding/constants.h"
 #include "riegeli/chunk_encoding/deferred_encoder.h"
 #include "riegeli/chunk_encoding/simple_encoder.h"
@@ -110,7 +111,15 @@ bool RecordWriterBase::Options::Parse(absl::string_view text,
                            ValueParser::CopyTo(&compressor_text));
   options_parser.AddOption("brotli", ValueParser::CopyTo(&compressor_text));
   options_parser.AddOption("zstd", ValueParser::CopyTo(&compressor_text));
+  options_parser.AddOption("lz4", ValueParser::CopyTo(&compressor_text));
+  options_parser.AddOption("snappy", ValueParser::CopyTo(&compressor_text));
   options_parser.AddOption("window_log", ValueParser::CopyTo(&compressor_text));
+  options_parser.AddOption("zstd_long_distance_matching",
+                           ValueParser::CopyTo(&compressor_text));
+  options_parser.AddOption("zstd_ldm_hash_log",
+                           ValueParser::CopyTo(&compressor_text));
+  options_parser.AddOption("zstd_workers",
+                           ValueParser::CopyTo(&compressor_text));
   options_parser.AddOption(
       "chunk_size", ValueParser::Bytes(&chunk_size_, 1,
                                        std::numeric_limits<uint64_t>::max()));
@@ -199,7 +208,8 @@ RecordWriterBase::Worker::MakeChunkEncoder() {
                   ? static_cast<uint64_t>(long_double_bucket_size)
                   : uint64_t{1};
     chunk_encoder = absl::make_unique<TransposeEncoder>(
-        options_.compressor_options_, bucket_size);
+        options_.compressor_options_, bucket_size, options_.parallelism_,
+        options_.field_groups_);
   } else {
     chunk_encoder = absl::make_unique<SimpleEncoder>(
         options_.compressor_options_, options_.chunk_size_);
@@ -216,8 +226,12 @@ inline void RecordWriterBase::Worker::EncodeSignature(Chunk* chunk) {
 }
 
 inline bool RecordWriterBase::Worker::EncodeMetadata(Chunk* chunk) {
-  TransposeEncoder transpose_encoder(options_.compressor_options_,
-                                     options_.metadata_.ByteSizeLong());
+  // Metadata are compressed without the Zstd dictionary, because the
+  // dictionary is stored in them.
+  TransposeEncoder transpose_encoder(
+      CompressorOptions(options_.compressor_options_)
+          .set_zstd_dictionary(nullptr),
+      options_.metadata_.ByteSizeLong());
   if (ABSL_PREDICT_FALSE(!transpose_encoder.AddRecord(options_.metadata_))) {
     return Fail(transpose_encoder);
   }
@@ -573,6 +587,19 @@ void RecordWriterBase::Initialize(ChunkWriter* chunk_writer,
   // num_records * sizeof(uint64_t) under desired_chunk_size_.
   desired_chunk_size_ =
       UnsignedMin(options.chunk_size_, kMaxNumRecords() * sizeof(uint64_t));
+  if (options.compressor_options_.zstd_dictionary() != nullptr) {
+    if (options.compressor_options_.compression_type() ==
+            CompressionType::kZstd &&
+        chunk_writer->pos() == 0) {
+      // Readers need the dictionary, so it is stored in file metadata.
+      options.metadata_.set_zstd_dictionary(std::string(
+          options.compressor_options_.zstd_dictionary()->data()));
+    } else {
+      // The dictionary cannot be stored in file metadata, or it would not be
+      // used anyway.
+      options.compressor_options_.set_zstd_dictionary(nullptr);
+    }
+  }
   if (options.parallelism_ == 0) {
     worker_ = absl::make_unique<SerialWorker>(chunk_writer, std::move(options));
   } else {
@@ -15,11 +15,13 @@
 #ifndef RIEGELI_RECORDS_RECORD_WRITER_H_
 #define RIEGELI_RECORDS_RECORD_WRITER_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <memory>
 #include <string>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "absl/base/optimization.h"
 #include "absl/meta/type_traits.h"
@@ -31,7 +33,9 @@
 #include "riegeli/base/object.h"
 #include "riegeli/base/stable_dependency.h"
 #include "riegeli/bytes/writer.h"
+#include "riegeli/bytes/zstd_dictionary.h"
 #include "riegeli/chunk_encoding/compressor_options.h"
+#include "riegeli/chunk_encoding/field_projection.h"
 #include "riegeli/records/chunk_writer.h"
 #include "riegeli/records/chunk_writer_dependency.h"
 #include "riegeli/records/record_position.h"
@@ -62,13 +66,21 @@ class RecordWriterBase : public Object {
     //     "uncompressed" |
     //     "brotli" (":" brotli_level)? |
     //     "zstd" (":" zstd_level)? |
+    //     "lz4" (":" lz4_level)? |
+    //     "snappy" |
     //     "window_log" ":" window_log |
+    //     "zstd_long_distance_matching" (":" ("true" | "false"))? |
+    //     "zstd_ldm_hash_log" ":" zstd_ldm_hash_log |
+    //     "zstd_workers" ":" zstd_workers |
     //     "chunk_size" ":" chunk_size |
     //     "bucket_fraction" ":" bucket_fraction |
     //     "parallelism" ":" parallelism
     //   brotli_level ::= integer 0..11 (default 9)
     //   zstd_level ::= integer -32..22 (default 9)
+    //   lz4_level ::= integer -32..12 (default 0)
     //   window_log ::= "auto" or integer 10..31
+    //   zstd_ldm_hash_log ::= "auto" or integer 6..30
+    //   zstd_workers ::= integer 0..200
     //   chunk_size ::=
     //     integer expressed as real with optional suffix [BkKMGTPE], 1..
     //   bucket_fraction ::= real 0..1
@@ -146,6 +158,40 @@ class RecordWriterBase : public Object {
       return std::move(set_zstd(compression_level));
     }
 
+    // Changes compression algorithm to LZ4. Sets compression level which tunes
+    // the tradeoff between compression density and compression speed (higher =
+    // better density but slower).
+    //
+    // LZ4 compresses less densely than Brotli and Zstd, but decompresses much
+    // faster, and at low levels also compresses much faster.
+    //
+    // compression_level must be between kMinLz4() (-32) and kMaxLz4() (12).
+    // Levels 3 and higher use LZ4-HC. Default: kDefaultLz4() (0).
+    static constexpr int kMinLz4() { return CompressorOptions::kMinLz4(); }
+    static constexpr int kMaxLz4() { return CompressorOptions::kMaxLz4(); }
+    static constexpr int kDefaultLz4() {
+      return CompressorOptions::kDefaultLz4();
+    }
+    Options& set_lz4(int compression_level = kDefaultLz4()) & {
+      compressor_options_.set_lz4(compression_level);
+      return *this;
+    }
+    Options&& set_lz4(int compression_level = kDefaultLz4()) && {
+      return std::move(set_lz4(compression_level));
+    }
+
+    // Changes compression algorithm to Snappy.
+    //
+    // Snappy has no compression levels. Like LZ4, it compresses less densely
+    // than Brotli and Zstd, but decompresses much faster.
+    //
+    // Snappy requires that uncompressed data of each chunk do not exceed 4 GB.
+    Options& set_snappy() & {
+      compressor_options_.set_snappy();
+      return *this;
+    }
+    Options&& set_snappy() && { return std::move(set_snappy()); }
+
     // Logarithm of the LZ77 sliding window size. This tunes the tradeoff
     // between compression density and memory usage (higher = better density but
     // more memory).
@@ -153,7 +199,8 @@ class RecordWriterBase : public Object {
     // Special value kDefaultWindowLog() (-1) means to keep the default
     // (brotli: 22, zstd: derived from compression level and chunk size).
     //
-    // For uncompressed, window_log must be kDefaultWindowLog() (-1).
+    // For uncompressed, lz4, and snappy, window_log must be
+    // kDefaultWindowLog() (-1).
     //
     // For brotli, window_log must be kDefaultWindowLog() (-1) or between
     // BrotliWriterBase::Options::kMinWindowLog() (10) and
@@ -178,6 +225,111 @@ class RecordWriterBase : public Object {
       return std::move(set_window_log(window_log));
     }
 
+    // Sets a Zstd dictionary for compressing chunks with zstd.
+    //
+    // A dictionary improves compression density of small records resembling
+    // it, which makes smaller chunks practical. It can be trained by
+    // TrainZstdDictionary() from samples of records, e.g. from the first
+    // records to be written.
+    //
+    // The dictionary is stored in file metadata, where readers find it. It is
+    // used only if compression is zstd and the file is written from the
+    // beginning; chunks appended to a file are compressed without it.
+    //
+    // If nullptr, no dictionary is used.
+    //
+    // Default: nullptr
+    Options& set_zstd_dictionary(
+        std::shared_ptr<const ZstdDictionary> zstd_dictionary) & {
+      compressor_options_.set_zstd_dictionary(std::move(zstd_dictionary));
+      return *this;
+    }
+    Options&& set_zstd_dictionary(
+        std::shared_ptr<const ZstdDictionary> zstd_dictionary) && {
+      return std::move(set_zstd_dictionary(std::move(zstd_dictionary)));
+    }
+
+    // If true, enables zstd long distance matching, which finds long matches
+    // far back in a chunk. This improves compression density of chunks
+    // repeating long data far apart, e.g. large blobs, at the cost of memory
+    // and compression speed.
+    //
+    // If window_log is kDefaultWindowLog(), this also increases the window to
+    // cover the whole chunk, up to 128 MB. Decompression needs memory
+    // proportional to the window size.
+    //
+    // Default: false.
+    Options& set_zstd_long_distance_matching(
+        bool zstd_long_distance_matching) & {
+      compressor_options_.set_zstd_long_distance_matching(
+          zstd_long_distance_matching);
+      return *this;
+    }
+    Options&& set_zstd_long_distance_matching(
+        bool zstd_long_distance_matching) && {
+      return std::move(
+          set_zstd_long_distance_matching(zstd_long_distance_matching));
+    }
+
+    // Logarithm of the size of the table used by zstd long distance matching
+    // (higher = better density but more memory).
+    //
+    // Special value kDefaultZstdLdmHashLog() (-1) means to derive it from
+    // window_log.
+    //
+    // zstd_ldm_hash_log must be kDefaultZstdLdmHashLog() (-1) or between
+    // kMinZstdLdmHashLog() (6) and kMaxZstdLdmHashLog() (30).
+    // Default: kDefaultZstdLdmHashLog() (-1).
+    static int kMinZstdLdmHashLog() {
+      return CompressorOptions::kMinZstdLdmHashLog();
+    }
+    static int kMaxZstdLdmHashLog() {
+      return CompressorOptions::kMaxZstdLdmHashLog();
+    }
+    static constexpr int kDefaultZstdLdmHashLog() {
+      return CompressorOptions::kDefaultZstdLdmHashLog();
+    }
+    Options& set_zstd_ldm_hash_log(int zstd_ldm_hash_log) & {
+      compressor_options_.set_zstd_ldm_hash_log(zstd_ldm_hash_log);
+      return *this;
+    }
+    Options&& set_zstd_ldm_hash_log(int zstd_ldm_hash_log) && {
+      return std::move(set_zstd_ldm_hash_log(zstd_ldm_hash_log));
+    }
+
+    // Number of worker threads compressing a chunk in parallel with zstd.
+    //
+    // This speeds up compression of large chunks, e.g. with high compression
+    // levels, at the cost of slightly lower compression density. Unlike
+    // parallelism, this helps also when a single chunk is being encoded.
+    // Decompression is not affected.
+    //
+    // zstd_workers must be between 0 and kMaxZstdWorkers() (200).
+    // Default: 0.
+    static constexpr int kMaxZstdWorkers() {
+      return CompressorOptions::kMaxZstdWorkers();
+    }
+    Options& set_zstd_workers(int zstd_workers) & {
+      compressor_options_.set_zstd_workers(zstd_workers);
+      return *this;
+    }
+    Options&& set_zstd_workers(int zstd_workers) && {
+      return std::move(set_zstd_workers(zstd_workers));
+    }
+
+    // Size of a part of a chunk compressed by a single zstd worker.
+    //
+    // Special value 0 means to derive it from compression parameters.
+    //
+    // Default: 0.
+    Options& set_zstd_job_size(size_t zstd_job_size) & {
+      compressor_options_.set_zstd_job_size(zstd_job_size);
+      return *this;
+    }
+    Options&& set_zstd_job_size(size_t zstd_job_size) && {
+      return std::move(set_zstd_job_size(zstd_job_size));
+    }
+
     // Sets the desired uncompressed size of a chunk which groups messages to be
     // transposed, compressed, and written together.
     //
@@ -226,6 +378,23 @@ class RecordWriterBase : public Object {
       return std::move(set_bucket_fraction(fraction));
     }
 
+    // Sets groups of fields which are expected to be read together with field
+    // projection. Values of fields included in each group are put in buckets
+    // separate from values of other fields, so that reading with a projection
+    // to a group decompresses less unrelated data. A field is assigned to the
+    // first group which includes it.
+    //
+    // This is meaningful if transpose and compression are enabled.
+    //
+    // Default: no groups
+    Options& set_field_groups(std::vector<FieldProjection> field_groups) & {
+      field_groups_ = std::move(field_groups);
+      return *this;
+    }
+    Options&& set_field_groups(std::vector<FieldProjection> field_groups) && {
+      return std::move(set_field_groups(std::move(field_groups)));
+    }
+
     // Sets file metadata to be written at the beginning (if metadata has any
     // fields set).
     //
@@ -248,7 +417,10 @@ class RecordWriterBase : public Object {
     // where it no longer matters; smaller parallelism reduces memory usage.
     //
     // If parallelism > 0, chunks are written to the byte Writer in background
-    // and reporting writing errors is delayed.
+    // and reporting writing errors is delayed. Buckets of a transposed chunk
+    // are also compressed in parallel, up to "parallelism" at a time per
+    // chunk, so up to parallelism^2 compressions and their buffers can be live
+    // at once.
     //
     // Default: 0
     Options& set_parallelism(int parallelism) & {
@@ -270,6 +442,7 @@ class RecordWriterBase : public Object {
     CompressorOptions compressor_options_;
     uint64_t chunk_size_ = uint64_t{1} << 20;
     double bucket_fraction_ = 1.0;
+    std::vector<FieldProjection> field_groups_;
     RecordsMetadata metadata_;
     int parallelism_ = 0;
   };
@@ -0,0 +1,421 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/shuffled_record_reader.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <cerrno>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
+#include "absl/numeric/int128.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/utility/utility.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/base/str_error.h"
+#include "riegeli/bytes/fd_dependency.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/zstd_dictionary.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/chunk_encoding/field_projection.h"
+#include "riegeli/records/block.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/record_position.h"
+#include "riegeli/records/record_reader.h"
+
+namespace riegeli {
+
+namespace {
+
+// SplitMix64 pseudo-random generator. Unlike distributions of the standard
+// library, it gives the same results on all platforms, which keeps the order of
+// records reproducible.
+class Random {
+ public:
+  explicit Random(uint64_t seed) : state_(seed) {}
+
+  uint64_t Next() {
+    uint64_t z = state_ += uint64_t{0x9e3779b97f4a7c15};
+    z = (z ^ (z >> 30)) * uint64_t{0xbf58476d1ce4e5b9};
+    z = (z ^ (z >> 27)) * uint64_t{0x94d049bb133111eb};
+    return z ^ (z >> 31);
+  }
+
+  // Returns a number in [0, n), with a negligible bias.
+  uint64_t Uniform(uint64_t n) {
+    return absl::Uint128High64(absl::uint128(Next()) * n);
+  }
+
+ private:
+  uint64_t state_;
+};
+
+template <typename T>
+void Shuffle(std::vector<T>* values, Random* random) {
+  for (size_t i = values->size(); i > 1; --i) {
+    using std::swap;
+    swap((*values)[i - 1], (*values)[IntCast<size_t>(random->Uniform(i))]);
+  }
+}
+
+}  // namespace
+
+ShuffledRecordReaderBase::ShuffledRecordReaderBase(Options&& options)
+    : Object(State::kOpen),
+      field_projection_(std::move(options.field_projection_)),
+      seed_(options.seed_),
+      shuffle_window_(options.shuffle_window_),
+      parallelism_(options.parallelism_),
+      shard_index_(options.shard_index_),
+      num_shards_(options.num_shards_),
+      buffer_size_(options.buffer_size_) {}
+
+ShuffledRecordReaderBase::ShuffledRecordReaderBase(
+    ShuffledRecordReaderBase&& that) noexcept
+    : Object(std::move(that)),
+      field_projection_(std::move(that.field_projection_)),
+      seed_(absl::exchange(that.seed_, 0)),
+      shuffle_window_(absl::exchange(that.shuffle_window_, 0)),
+      parallelism_(absl::exchange(that.parallelism_, 0)),
+      shard_index_(absl::exchange(that.shard_index_, 0)),
+      num_shards_(absl::exchange(that.num_shards_, 0)),
+      buffer_size_(absl::exchange(that.buffer_size_, 0)),
+      filename_(absl::exchange(that.filename_, std::string())),
+      zstd_dictionary_(std::move(that.zstd_dictionary_)),
+      chunks_(absl::exchange(that.chunks_, std::vector<ChunkInfo>())),
+      num_records_(absl::exchange(that.num_records_, 0)),
+      pos_(absl::exchange(that.pos_, 0)),
+      window_index_(absl::exchange(that.window_index_, 0)),
+      window_begin_pos_(absl::exchange(that.window_begin_pos_, 0)),
+      window_chunks_(
+          absl::exchange(that.window_chunks_, std::vector<ChunkDecoder>())),
+      window_records_(
+          absl::exchange(that.window_records_, std::vector<WindowRecord>())),
+      next_chunk_(absl::exchange(that.next_chunk_, 0)),
+      pending_chunks_(std::move(that.pending_chunks_)),
+      recoverable_(absl::exchange(that.recoverable_, false)) {}
+
+ShuffledRecordReaderBase& ShuffledRecordReaderBase::operator=(
+    ShuffledRecordReaderBase&& that) noexcept {
+  CancelChunks();
+  Object::operator=(std::move(that));
+  field_projection_ = std::move(that.field_projection_);
+  seed_ = absl::exchange(that.seed_, 0);
+  shuffle_window_ = absl::exchange(that.shuffle_window_, 0);
+  parallelism_ = absl::exchange(that.parallelism_, 0);
+  shard_index_ = absl::exchange(that.shard_index_, 0);
+  num_shards_ = absl::exchange(that.num_shards_, 0);
+  buffer_size_ = absl::exchange(that.buffer_size_, 0);
+  filename_ = absl::exchange(that.filename_, std::string());
+  zstd_dictionary_ = std::move(that.zstd_dictionary_);
+  chunks_ = absl::exchange(that.chunks_, std::vector<ChunkInfo>());
+  num_records_ = absl::exchange(that.num_records_, 0);
+  pos_ = absl::exchange(that.pos_, 0);
+  window_index_ = absl::exchange(that.window_index_, 0);
+  window_begin_pos_ = absl::exchange(that.window_begin_pos_, 0);
+  window_chunks_ =
+      absl::exchange(that.window_chunks_, std::vector<ChunkDecoder>());
+  window_records_ =
+      absl::exchange(that.window_records_, std::vector<WindowRecord>());
+  next_chunk_ = absl::exchange(that.next_chunk_, 0);
+  pending_chunks_ = std::move(that.pending_chunks_);
+  recoverable_ = absl::exchange(that.recoverable_, false);
+  return *this;
+}
+
+void ShuffledRecordReaderBase::SetFilename(int src) {
+  filename_ = absl::StrCat("/proc/self/fd/", src);
+}
+
+int ShuffledRecordReaderBase::OpenFd(absl::string_view filename, int flags) {
+  filename_.assign(filename.data(), filename.size());
+again:
+  const int src = open(filename_.c_str(), flags, 0666);
+  if (ABSL_PREDICT_FALSE(src < 0)) {
+    if (errno == EINTR) goto again;
+    FailOperation("open()");
+    return -1;
+  }
+  return src;
+}
+
+bool ShuffledRecordReaderBase::FailOperation(absl::string_view operation) {
+  return Fail(absl::StrCat(operation, " failed: ", StrError(errno),
+                           ", reading ", filename_));
+}
+
+void ShuffledRecordReaderBase::Initialize(int src) {
+  FdReader<int> reader(src,
+                       FdReaderBase::Options().set_buffer_size(buffer_size_));
+  zstd_dictionary_ = internal::ReadZstdDictionary(&reader);
+  // Find chunks with records by reading only chunk headers.
+  DefaultChunkReader<> chunk_reader(&reader);
+  if (ABSL_PREDICT_FALSE(!chunk_reader.Seek(0))) {
+    Fail(chunk_reader);
+    return;
+  }
+  size_t chunk_index = 0;
+  const ChunkHeader* chunk_header;
+  while (chunk_reader.PullChunkHeader(&chunk_header)) {
+    if (chunk_header->num_records() > 0) {
+      if (chunk_index % IntCast<size_t>(num_shards_) ==
+          IntCast<size_t>(shard_index_)) {
+        chunks_.push_back(
+            ChunkInfo{chunk_reader.pos(), chunk_header->num_records()});
+        num_records_ += chunk_header->num_records();
+      }
+      ++chunk_index;
+    }
+    // The chunk end is known from the chunk header, so there is no need to
+    // search for the next chunk boundary.
+    if (ABSL_PREDICT_FALSE(!chunk_reader.Seek(
+            internal::ChunkEnd(*chunk_header, chunk_reader.pos())))) {
+      break;
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!chunk_reader.Close())) {
+    Fail(chunk_reader);
+    return;
+  }
+  Random random(seed_);
+  Shuffle(&chunks_, &random);
+}
+
+void ShuffledRecordReaderBase::Done() {
+  CancelChunks();
+  recoverable_ = false;
+  window_chunks_ = std::vector<ChunkDecoder>();
+  window_records_ = std::vector<WindowRecord>();
+  chunks_ = std::vector<ChunkInfo>();
+  field_projection_ = FieldProjection();
+  zstd_dictionary_.reset();
+}
+
+template <typename Record>
+inline bool ShuffledRecordReaderBase::ReadRecordImpl(Record* record,
+                                                     RecordPosition* key) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(pos_ == num_records_)) return false;
+  if (ABSL_PREDICT_FALSE(pos_ < window_begin_pos_ ||
+                         pos_ - window_begin_pos_ >= window_records_.size())) {
+    if (ABSL_PREDICT_FALSE(!LoadWindow())) return false;
+  }
+  const WindowRecord& window_record =
+      window_records_[IntCast<size_t>(pos_ - window_begin_pos_)];
+  ChunkDecoder& chunk_decoder = window_chunks_[window_record.chunk];
+  chunk_decoder.SetIndex(window_record.record_index);
+  ++pos_;
+  if (ABSL_PREDICT_FALSE(!chunk_decoder.ReadRecord(record))) {
+    const bool ok = Fail(chunk_decoder);
+    // Keep chunk_decoder usable for other records of the chunk.
+    chunk_decoder.Recover();
+    recoverable_ = true;
+    return ok;
+  }
+  if (key != nullptr) {
+    *key = RecordPosition(
+        chunks_[window_index_ * shuffle_window_ + window_record.chunk]
+            .chunk_begin,
+        window_record.record_index);
+  }
+  return true;
+}
+
+bool ShuffledRecordReaderBase::ReadRecord(google::protobuf::MessageLite* record,
+                                          RecordPosition* key) {
+  return ReadRecordImpl(record, key);
+}
+
+bool ShuffledRecordReaderBase::ReadRecord(absl::string_view* record,
+                                          RecordPosition* key) {
+  return ReadRecordImpl(record, key);
+}
+
+bool ShuffledRecordReaderBase::ReadRecord(std::string* record,
+                                          RecordPosition* key) {
+  return ReadRecordImpl(record, key);
+}
+
+bool ShuffledRecordReaderBase::ReadRecord(Chain* record, RecordPosition* key) {
+  return ReadRecordImpl(record, key);
+}
+
+bool ShuffledRecordReaderBase::Recover() {
+  if (!recoverable_) return false;
+  RIEGELI_ASSERT(!healthy())
+      << "Failed invariant of ShuffledRecordReader: "
+         "recovery applicable but ShuffledRecordReader healthy";
+  recoverable_ = false;
+  if (closed()) return false;
+  MarkNotFailed();
+  return true;
+}
+
+bool ShuffledRecordReaderBase::Seek(uint64_t new_pos) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  // The window containing new_pos is loaded by the next ReadRecord().
+  pos_ = UnsignedMin(new_pos, num_records_);
+  return true;
+}
+
+ShuffledRecordReaderBase::DecodedChunk ShuffledRecordReaderBase::DecodeChunk(
+    int src, Position chunk_begin, size_t buffer_size,
+    const FieldProjection& field_projection,
+    const std::shared_ptr<const ZstdDictionary>& zstd_dictionary) {
+  ChunkDecoder chunk_decoder(ChunkDecoder::Options()
+                                 .set_field_projection(field_projection)
+                                 .set_zstd_dictionary(zstd_dictionary));
+  // FdReader<int> reads with pread() at its own position and does not change
+  // the fd position, so chunks can be read concurrently.
+  FdReader<int> reader(src,
+                       FdReaderBase::Options().set_buffer_size(buffer_size));
+  DefaultChunkReader<> chunk_reader(&reader);
+  Chunk chunk;
+  if (ABSL_PREDICT_FALSE(!chunk_reader.Seek(chunk_begin) ||
+                         !chunk_reader.ReadChunk(&chunk))) {
+    return {std::move(chunk_decoder),
+            absl::StrCat("Reading chunk at ", chunk_begin, " failed: ",
+                         chunk_reader.Close() ? "position exceeds file size"
+                                              : chunk_reader.message())};
+  }
+  if (ABSL_PREDICT_FALSE(!chunk_decoder.Reset(chunk))) {
+    return {std::move(chunk_decoder),
+            absl::StrCat("Decoding chunk at ", chunk_begin,
+                         " failed: ", chunk_decoder.message())};
+  }
+  return {std::move(chunk_decoder), std::string()};
+}
+
+bool ShuffledRecordReaderBase::LoadWindow() {
+  RIEGELI_ASSERT_LT(pos_, num_records_)
+      << "Failed precondition of ShuffledRecordReaderBase::LoadWindow(): "
+         "no records left";
+  // Find the window containing pos_. In sequential reading it follows the
+  // current window.
+  size_t window_index;
+  uint64_t window_begin_pos;
+  if (!window_records_.empty() &&
+      pos_ == window_begin_pos_ + window_records_.size()) {
+    window_index = window_index_ + 1;
+    window_begin_pos = pos_;
+  } else {
+    window_index = 0;
+    window_begin_pos = 0;
+  }
+  for (;;) {
+    const size_t begin = window_index * shuffle_window_;
+    const size_t end = UnsignedMin(begin + shuffle_window_, chunks_.size());
+    uint64_t window_num_records = 0;
+    for (size_t i = begin; i < end; ++i) {
+      window_num_records += chunks_[i].num_records;
+    }
+    if (pos_ < window_begin_pos + window_num_records) break;
+    ++window_index;
+    window_begin_pos += window_num_records;
+  }
+  window_records_.clear();
+  window_chunks_.clear();
+  const size_t begin = window_index * shuffle_window_;
+  const size_t end = UnsignedMin(begin + shuffle_window_, chunks_.size());
+  if (next_chunk_ != begin) {
+    CancelChunks();
+    next_chunk_ = begin;
+  }
+  for (size_t i = begin; i < end; ++i) {
+    ScheduleChunks();
+    DecodedChunk decoded_chunk;
+    if (pending_chunks_.empty()) {
+      decoded_chunk =
+          DecodeChunk(src_fd(), chunks_[i].chunk_begin, buffer_size_,
+                      field_projection_, zstd_dictionary_);
+    } else {
+      decoded_chunk = pending_chunks_.front().get();
+      pending_chunks_.pop_front();
+    }
+    ++next_chunk_;
+    if (ABSL_PREDICT_FALSE(!decoded_chunk.error_message.empty())) {
+      window_records_.clear();
+      window_chunks_.clear();
+      return Fail(decoded_chunk.error_message);
+    }
+    const uint32_t chunk = IntCast<uint32_t>(window_chunks_.size());
+    for (uint64_t record_index = 0;
+         record_index < decoded_chunk.chunk_decoder.num_records();
+         ++record_index) {
+      window_records_.push_back(WindowRecord{chunk, record_index});
+    }
+    window_chunks_.push_back(std::move(decoded_chunk.chunk_decoder));
+  }
+  // Start decoding chunks of the next window while records of this window are
+  // being read.
+  ScheduleChunks();
+  Random random(seed_ ^
+                (IntCast<uint64_t>(window_index + 1) * 0x9e3779b97f4a7c15));
+  Shuffle(&window_records_, &random);
+  window_index_ = window_index;
+  window_begin_pos_ = window_begin_pos;
+  if (ABSL_PREDICT_FALSE(pos_ - window_begin_pos_ >= window_records_.size())) {
+    // Chunks contain fewer records than their headers claimed.
+    window_records_.clear();
+    window_chunks_.clear();
+    return Fail(absl::StrCat(
+        "Invalid Riegeli/records file: chunks contain fewer records than "
+        "chunk headers claim, reading ",
+        filename_));
+  }
+  return true;
+}
+
+void ShuffledRecordReaderBase::ScheduleChunks() {
+  const size_t end =
+      UnsignedMin(next_chunk_ + IntCast<size_t>(parallelism_), chunks_.size());
+  for (size_t i = next_chunk_ + pending_chunks_.size(); i < end; ++i) {
+    std::promise<DecodedChunk>* const promise =
+        new std::promise<DecodedChunk>();
+    pending_chunks_.push_back(promise->get_future());
+    internal::DefaultThreadPool().Schedule(
+        [src = src_fd(), chunk_begin = chunks_[i].chunk_begin,
+         buffer_size = buffer_size_, field_projection = field_projection_,
+         zstd_dictionary = zstd_dictionary_, promise] {
+          promise->set_value(DecodeChunk(src, chunk_begin, buffer_size,
+                                         field_projection, zstd_dictionary));
+          delete promise;
+        });
+  }
+}
+
+void ShuffledRecordReaderBase::CancelChunks() {
+  for (std::future<DecodedChunk>& pending_chunk : pending_chunks_) {
+    pending_chunk.wait();
+  }
+  pending_chunks_.clear();
+}
+
+template class ShuffledRecordReader<OwnedFd>;
+template class ShuffledRecordReader<int>;
+
+}  // namespace riegeli
@@ -0,0 +1,443 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_SHUFFLED_RECORD_READER_H_
+#define RIEGELI_RECORDS_SHUFFLED_RECORD_READER_H_
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "absl/utility/utility.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/dependency.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/fd_dependency.h"
+#include "riegeli/bytes/zstd_dictionary.h"
+#include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/chunk_encoding/field_projection.h"
+#include "riegeli/records/record_position.h"
+
+namespace riegeli {
+
+// Template parameter invariant part of ShuffledRecordReader.
+class ShuffledRecordReaderBase : public Object {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Specifies the set of fields to be included in returned records, allowing
+    // to exclude the remaining fields (but does not guarantee that they will be
+    // excluded). Excluding data makes reading faster.
+    Options& set_field_projection(FieldProjection field_projection) & {
+      field_projection_ = std::move(field_projection);
+      return *this;
+    }
+    Options&& set_field_projection(FieldProjection field_projection) && {
+      return std::move(set_field_projection(std::move(field_projection)));
+    }
+
+    // Seed of the pseudo-random order of chunks and records. The order depends
+    // only on the seed, the other options, and the file, so reading can be
+    // reproduced, and resumed with Seek(). Use a different seed for each epoch
+    // to get a different order.
+    //
+    // Default: 0
+    Options& set_seed(uint64_t seed) & {
+      seed_ = seed;
+      return *this;
+    }
+    Options&& set_seed(uint64_t seed) && { return std::move(set_seed(seed)); }
+
+    // Number of chunks whose records are mixed together. Chunks are visited in
+    // a pseudo-random order, and records of each group of shuffle_window()
+    // consecutively visited chunks are returned in a pseudo-random order.
+    //
+    // A larger window gives better randomization at the cost of memory for
+    // keeping that many decoded chunks.
+    //
+    // Default: 16
+    Options& set_shuffle_window(size_t shuffle_window) & {
+      RIEGELI_ASSERT_GT(shuffle_window, 0u)
+          << "Failed precondition of "
+             "ShuffledRecordReaderBase::Options::set_shuffle_window(): "
+             "zero shuffle window";
+      shuffle_window_ = shuffle_window;
+      return *this;
+    }
+    Options&& set_shuffle_window(size_t shuffle_window) && {
+      return std::move(set_shuffle_window(shuffle_window));
+    }
+
+    // Maximum number of chunks being read and decoded in background, ahead of
+    // the chunks whose records are being returned.
+    //
+    // If 0, chunks are read and decoded in the thread calling ReadRecord().
+    //
+    // Default: 4
+    Options& set_parallelism(int parallelism) & {
+      RIEGELI_ASSERT_GE(parallelism, 0)
+          << "Failed precondition of "
+             "ShuffledRecordReaderBase::Options::set_parallelism(): "
+             "negative parallelism";
+      parallelism_ = parallelism;
+      return *this;
+    }
+    Options&& set_parallelism(int parallelism) && {
+      return std::move(set_parallelism(parallelism));
+    }
+
+    // Restricts reading to a subset of chunks, so that num_shards readers with
+    // shard_index from 0 to num_shards - 1 read disjoint sets of records which
+    // together cover the whole file.
+    //
+    // Chunk i in file order belongs to shard i % num_shards.
+    //
+    // Default: shard 0 of 1
+    Options& set_shard(int shard_index, int num_shards) & {
+      RIEGELI_ASSERT_GT(num_shards, 0)
+          << "Failed precondition of "
+             "ShuffledRecordReaderBase::Options::set_shard(): "
+             "non-positive number of shards";
+      RIEGELI_ASSERT_GE(shard_index, 0)
+          << "Failed precondition of "
+             "ShuffledRecordReaderBase::Options::set_shard(): "
+             "negative shard index";
+      RIEGELI_ASSERT_LT(shard_index, num_shards)
+          << "Failed precondition of "
+             "ShuffledRecordReaderBase::Options::set_shard(): "
+             "shard index out of range";
+      shard_index_ = shard_index;
+      num_shards_ = num_shards;
+      return *this;
+    }
+    Options&& set_shard(int shard_index, int num_shards) && {
+      return std::move(set_shard(shard_index, num_shards));
+    }
+
+    // Size of the buffer used for reading each chunk.
+    //
+    // Default: 64K
+    Options& set_buffer_size(size_t buffer_size) & {
+      RIEGELI_ASSERT_GT(buffer_size, 0u)
+          << "Failed precondition of "
+             "ShuffledRecordReaderBase::Options::set_buffer_size(): "
+             "zero buffer size";
+      buffer_size_ = buffer_size;
+      return *this;
+    }
+    Options&& set_buffer_size(size_t buffer_size) && {
+      return std::move(set_buffer_size(buffer_size));
+    }
+
+   private:
+    friend class ShuffledRecordReaderBase;
+
+    FieldProjection field_projection_ = FieldProjection::All();
+    uint64_t seed_ = 0;
+    size_t shuffle_window_ = 16;
+    int parallelism_ = 4;
+    int shard_index_ = 0;
+    int num_shards_ = 1;
+    size_t buffer_size_ = kDefaultBufferSize();
+  };
+
+  // Returns the fd being read from. If the fd is owned then changed to -1 by
+  // Close(), otherwise unchanged.
+  virtual int src_fd() const = 0;
+
+  // Returns the original name of the file being read from (or
+  // /proc/self/fd/<fd> if fd was given). Unchanged by Close().
+  const std::string& filename() const { return filename_; }
+
+  // Reads the next record in the shuffled order.
+  //
+  // ReadRecord(MessageLite*) parses raw bytes to a proto message after reading.
+  // The remaining overloads read raw bytes. For ReadRecord(string_view*) the
+  // string_view is valid until the next non-const operation on this
+  // ShuffledRecordReader.
+  //
+  // If key != nullptr, *key is set to the canonical record position in the
+  // file on success.
+  //
+  // Return values:
+  //  * true                    - success (*record is set)
+  //  * false (when healthy())  - all records have been read
+  //  * false (when !healthy()) - failure
+  bool ReadRecord(google::protobuf::MessageLite* record,
+                  RecordPosition* key = nullptr);
+  bool ReadRecord(absl::string_view* record, RecordPosition* key = nullptr);
+  bool ReadRecord(std::string* record, RecordPosition* key = nullptr);
+  bool ReadRecord(Chain* record, RecordPosition* key = nullptr);
+
+  // If !healthy() and the failure was caused by an unparsable message, then
+  // Recover() allows reading again by skipping the unparsable message.
+  //
+  // Return values:
+  //  * true  - success
+  //  * false - failure not caused by an unparsable message
+  bool Recover();
+
+  // Returns the number of records in the shuffled order which have been read
+  // or skipped. This can be saved as a checkpoint, and restored with Seek() by
+  // a ShuffledRecordReader reading the same file with the same Options.
+  uint64_t pos() const { return pos_; }
+
+  // Returns the number of records to be read, i.e. the number of records in the
+  // chunks of this shard.
+  uint64_t num_records() const { return num_records_; }
+
+  // Continues reading from the given position in the shuffled order, as
+  // returned by pos().
+  //
+  // If new_pos > num_records(), the position is set to num_records().
+  //
+  // Only the chunks needed for reading from the new position are decoded, so
+  // restoring a checkpoint is cheap.
+  //
+  // Return values:
+  //  * true  - success
+  //  * false - failure (!healthy())
+  bool Seek(uint64_t new_pos);
+
+ protected:
+  explicit ShuffledRecordReaderBase(State state) noexcept : Object(state) {}
+
+  explicit ShuffledRecordReaderBase(Options&& options);
+
+  ShuffledRecordReaderBase(ShuffledRecordReaderBase&& that) noexcept;
+  ShuffledRecordReaderBase& operator=(ShuffledRecordReaderBase&& that) noexcept;
+
+  void SetFilename(int src);
+  int OpenFd(absl::string_view filename, int flags);
+  ABSL_ATTRIBUTE_COLD bool FailOperation(absl::string_view operation);
+  // Reads the Zstd dictionary from file metadata, if any, scans chunk headers
+  // of the file, and determines the order of chunks.
+  void Initialize(int src);
+  void Done() override;
+
+  // Waits for background decoding of chunks which have not been taken, and
+  // discards them.
+  void CancelChunks();
+
+ private:
+  struct ChunkInfo {
+    Position chunk_begin;
+    uint64_t num_records;
+  };
+
+  // A chunk read and decoded, possibly in background.
+  struct DecodedChunk {
+    ChunkDecoder chunk_decoder;
+    // Empty on success.
+    std::string error_message;
+  };
+
+  // A record in the current window: index of its chunk in window_chunks_, and
+  // its index in the chunk.
+  struct WindowRecord {
+    uint32_t chunk;
+    uint64_t record_index;
+  };
+
+  // Reads and decodes the chunk at chunk_begin. May be called in background.
+  static DecodedChunk DecodeChunk(
+      int src, Position chunk_begin, size_t buffer_size,
+      const FieldProjection& field_projection,
+      const std::shared_ptr<const ZstdDictionary>& zstd_dictionary);
+
+  template <typename Record>
+  bool ReadRecordImpl(Record* record, RecordPosition* key);
+
+  // Makes the window containing pos_ current, reading and decoding its chunks.
+  //
+  // Precondition: pos_ < num_records_
+  bool LoadWindow();
+
+  // Schedules background decoding of chunks following the chunks which have
+  // been taken, up to parallelism_ chunks.
+  void ScheduleChunks();
+
+  FieldProjection field_projection_;
+  uint64_t seed_ = 0;
+  size_t shuffle_window_ = 0;
+  int parallelism_ = 0;
+  int shard_index_ = 0;
+  int num_shards_ = 0;
+  size_t buffer_size_ = 0;
+  std::string filename_;
+  // Needed for decoding chunks compressed with it, or nullptr.
+  std::shared_ptr<const ZstdDictionary> zstd_dictionary_;
+
+  // Chunks with records of this shard, in the order of visiting them.
+  std::vector<ChunkInfo> chunks_;
+  uint64_t num_records_ = 0;
+  uint64_t pos_ = 0;
+
+  // The current window is window_index_, consisting of chunks beginning with
+  // chunks_[window_index_ * shuffle_window_], and records in the shuffled
+  // order beginning with window_begin_pos_. If window_records_ is empty, no
+  // window is current.
+  size_t window_index_ = 0;
+  uint64_t window_begin_pos_ = 0;
+  std::vector<ChunkDecoder> window_chunks_;
+  std::vector<WindowRecord> window_records_;
+
+  // Chunks being decoded in background: chunks_[next_chunk_] and following
+  // ones.
+  size_t next_chunk_ = 0;
+  std::deque<std::future<DecodedChunk>> pending_chunks_;
+
+  // Whether Recover() is applicable.
+  //
+  // Invariant: if healthy() then !recoverable_
+  bool recoverable_ = false;
+};
+
+// ShuffledRecordReader reads records of a Riegeli/records file in a
+// pseudo-random order, e.g. as input for training machine learning models.
+//
+// Chunks are visited in a pseudo-random order, which keeps reading in large
+// sequential pieces, and records of several chunks are mixed together. Chunks
+// are read and decoded in background, each one once. Unlike a shuffle buffer
+// built on top of RecordReader::Seek(), this does not decode chunks repeatedly.
+//
+// The order is determined by Options::set_seed(), and the position in the
+// order can be saved with pos() and restored with Seek(). Chunks can be divided
+// among workers with Options::set_shard().
+//
+// The Src template parameter specifies the type of the object providing and
+// possibly owning the fd being read from. Src must support
+// Dependency<int, Src>, e.g. OwnedFd (owned, default), int (not owned).
+//
+// The fd must support pread(), and must not be closed until the
+// ShuffledRecordReader is closed or no longer used. The file should not be
+// appended to while being read: chunks are found when the ShuffledRecordReader
+// is created.
+template <typename Src = OwnedFd>
+class ShuffledRecordReader : public ShuffledRecordReaderBase {
+ public:
+  // Creates a closed ShuffledRecordReader.
+  ShuffledRecordReader() noexcept : ShuffledRecordReaderBase(State::kClosed) {}
+
+  // Will read from the fd provided by src.
+  //
+  // type_identity_t<Src> disables template parameter deduction (C++17), letting
+  // ShuffledRecordReader(fd) mean ShuffledRecordReader<OwnedFd>(fd) rather than
+  // ShuffledRecordReader<int>(fd).
+  explicit ShuffledRecordReader(type_identity_t<Src> src,
+                                Options options = Options());
+
+  // Opens a file for reading.
+  //
+  // flags is the second argument of open, typically O_RDONLY.
+  //
+  // flags must include O_RDONLY or O_RDWR.
+  explicit ShuffledRecordReader(absl::string_view filename, int flags,
+                                Options options = Options());
+
+  ShuffledRecordReader(ShuffledRecordReader&& that) noexcept;
+  ShuffledRecordReader& operator=(ShuffledRecordReader&& that) noexcept;
+
+  ~ShuffledRecordReader() { CancelChunks(); }
+
+  // Returns the object providing and possibly owning the fd being read from. If
+  // the fd is owned then changed to -1 by Close(), otherwise unchanged.
+  Src& src() { return src_.manager(); }
+  const Src& src() const { return src_.manager(); }
+  int src_fd() const override { return src_.ptr(); }
+
+ protected:
+  void Done() override;
+
+ private:
+  // The object providing and possibly owning the fd being read from.
+  Dependency<int, Src> src_;
+};
+
+// Implementation details follow.
+
+template <typename Src>
+ShuffledRecordReader<Src>::ShuffledRecordReader(type_identity_t<Src> src,
+                                                Options options)
+    : ShuffledRecordReaderBase(std::move(options)), src_(std::move(src)) {
+  RIEGELI_ASSERT_GE(src_.ptr(), 0)
+      << "Failed precondition of "
+         "ShuffledRecordReader<Src>::ShuffledRecordReader(Src): "
+         "negative file descriptor";
+  SetFilename(src_.ptr());
+  Initialize(src_.ptr());
+}
+
+template <typename Src>
+ShuffledRecordReader<Src>::ShuffledRecordReader(absl::string_view filename,
+                                                int flags, Options options)
+    : ShuffledRecordReaderBase(std::move(options)) {
+  RIEGELI_ASSERT((flags & O_ACCMODE) == O_RDONLY ||
+                 (flags & O_ACCMODE) == O_RDWR)
+      << "Failed precondition of "
+         "ShuffledRecordReader::ShuffledRecordReader(string_view): "
+         "flags must include O_RDONLY or O_RDWR";
+  const int src = OpenFd(filename, flags);
+  if (ABSL_PREDICT_TRUE(src >= 0)) {
+    src_ = Dependency<int, Src>(Src(src));
+    Initialize(src_.ptr());
+  }
+}
+
+template <typename Src>
+inline ShuffledRecordReader<Src>::ShuffledRecordReader(
+    ShuffledRecordReader&& that) noexcept
+    : ShuffledRecordReaderBase(std::move(that)), src_(std::move(that.src_)) {}
+
+template <typename Src>
+inline ShuffledRecordReader<Src>& ShuffledRecordReader<Src>::operator=(
+    ShuffledRecordReader&& that) noexcept {
+  ShuffledRecordReaderBase::operator=(std::move(that));
+  src_ = std::move(that.src_);
+  return *this;
+}
+
+template <typename Src>
+void ShuffledRecordReader<Src>::Done() {
+  // ShuffledRecordReaderBase::Done() waits for background reading, which must
+  // finish before the fd is closed.
+  ShuffledRecordReaderBase::Done();
+  if (src_.kIsOwning() && src_.ptr() >= 0) {
+    const int src = src_.Release();
+    if (ABSL_PREDICT_FALSE(internal::CloseFd(src) < 0) &&
+        ABSL_PREDICT_TRUE(healthy())) {
+      FailOperation(internal::CloseFunctionName());
+    }
+  }
+}
+
+extern template class ShuffledRecordReader<OwnedFd>;
+extern template class ShuffledRecordReader<int>;
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_SHUFFLED_RECORD_READER_H_